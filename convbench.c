@@ -0,0 +1,620 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Throughput of the conversion kernels of raw2pnm, yuv2yuv, pnm2yuv,
+ * pnm2raw, pnm2txt, and txt2raw on synthetic frames. Each kernel runs
+ * once to warm up and then repeatedly for at least the given time at
+ * each resolution. Results are written as JSON, one result per line,
+ * and compared with the results of an earlier run if given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+#include "linux/videodev2.h"
+
+#include "extradefs.h"
+#include "utillib.h"
+#include "convlib.h"
+#include "rawlib.h"
+#include "yuvlib.h"
+#include "cpulib.h"
+
+#define SIZE(x)		(sizeof(x)/sizeof((x)[0]))
+
+static void error(char *msg, ...)
+{
+	va_list ap;
+
+	va_start(ap, msg);
+	fprintf(stderr, "convbench: ");
+	vfprintf(stderr, msg, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	exit(1);
+}
+
+static void *xmalloc(long size)
+{
+	void *p = malloc(size);
+
+	if (!p) error("out of memory");
+	return p;
+}
+
+static const struct resolution {
+	const char *name;
+	int width, height;
+} resolutions[] = {
+	{ "vga",	640,	480 },
+	{ "720p",	1280,	720 },
+	{ "1080p",	1920,	1080 },
+	{ "4k",		3840,	2160 },
+	{ "8k",		7680,	4320 },
+};
+
+#define FMT(id)		{ V4L2_PIX_FMT_##id, #id }
+#define BAYER_FMT(id)	FMT(SBGGR##id), FMT(SGBRG##id), FMT(SGRBG##id), FMT(SRGGB##id)
+static const struct format {
+	__u32 format;
+	const char *name;
+} formats[] = {
+	FMT(YUYV), FMT(UYVY), FMT(YVYU), FMT(VYUY),
+	FMT(NV12), FMT(NV21), FMT(NV24), FMT(NV42), FMT(YYUV420_V32),
+	FMT(GREY), FMT(Y16), FMT(RGB24), FMT(BGR24),
+	BAYER_FMT(8), BAYER_FMT(10), BAYER_FMT(12), BAYER_FMT(14), BAYER_FMT(16),
+	BAYER_FMT(10P), BAYER_FMT(12P), BAYER_FMT(14P),
+	BAYER_FMT(10ALAW8), BAYER_FMT(10DPCM8), BAYER_FMT(10V32), BAYER_FMT(12V32),
+};
+
+static const char *const raw_formats[] = { "SGRBG8", "SGRBG10", "SGRBG10P", "SGRBG12P", "SGRBG14P" };
+
+/*
+ * A kernel with its parameters and the synthetic frame it runs on.
+ * prepare() allocates and fills the buffers for the size, returning -1
+ * if the kernel does not support it, and sets the bytes read by a run.
+ */
+struct job {
+	char name[64];
+	int (*prepare)(struct job *j);
+	void (*run)(struct job *j);
+
+	__u32 format;			/* raw2pnm */
+	struct conv_output o;
+	int threads;			/* raw2pnm, set in o after conv_output_init() */
+	const struct yuv_layout *from, *to;	/* yuv2yuv */
+	struct raw_format raw;		/* pnm2raw, txt2raw, hex */
+	int bps;			/* pnm2yuv, pnm2raw */
+
+	int width, height, stride;
+	long bytes;
+	unsigned char *in, *out;
+	unsigned short *row;
+	struct pnm_image img;
+	struct yuv_frame fin, fout;
+};
+
+/* Fill with pseudo-random bytes, the same ones on every run */
+static void fill_random(unsigned char *p, long n)
+{
+	static unsigned int x = 2463534242u;
+	long i;
+
+	for (i = 0; i < n; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		p[i] = x >> 24;
+	}
+}
+
+/* Fill RGB image with samples of bps bytes */
+static void fill_image(struct pnm_image *img, int width, int height, int bps)
+{
+	memset(img, 0, sizeof(*img));
+	img->width = width;
+	img->height = height;
+	img->channels = 3;
+	img->bps = bps;
+	img->maxval = bps == 1 ? 255 : 65535;
+	img->size = width * height * 3 * bps;
+	img->data = xmalloc(img->size);
+	img->alloc = img->size;
+	fill_random(img->data, img->size);
+}
+
+static int prepare_convert(struct job *j)
+{
+	int ow, oh, size, i;
+
+	j->stride = -1;
+	size = conv_frame_size(j->format, j->width, j->height, &j->stride);
+	if (size < 0)
+		return -1;
+	j->in = xmalloc(size);
+	fill_random(j->in, size);
+	j->bytes = size;
+
+	/* Keep pixels of more than 8 bits in two bytes within their range, Y16 in 10 bits */
+	conv_output_init(&j->o, j->format, CONV_TYPE_PPM, 16, 1);
+	if (j->format == V4L2_PIX_FMT_Y16)
+		j->o.maxval = 1023;
+	if (j->o.maxval > 255 && j->o.maxval < 65535 && j->stride == j->width * 2)
+		for (i = 1; i < size; i += 2)
+			j->in[i] &= j->o.maxval >> 8;
+
+	conv_output_init(&j->o, j->format, CONV_TYPE_PPM, 8, 1);
+	j->o.threads = j->threads;
+	j->out = xmalloc(conv_output_size(&j->o, j->width, j->height, &ow, &oh));
+	return conv_convert(j->in, size, j->width, j->height, j->stride, j->format,
+			    &j->o, j->out) < 0 ? -1 : 0;
+}
+
+static void run_convert(struct job *j)
+{
+	conv_convert(j->in, j->bytes, j->width, j->height, j->stride, j->format, &j->o, j->out);
+}
+
+static int prepare_yuv(struct job *j)
+{
+	int in_size = yuv_frame_init(&j->fin, j->from, j->width, j->height, 0, NULL);
+	int out_size = yuv_frame_init(&j->fout, j->to, j->width, j->height, 0, NULL);
+
+	j->in = xmalloc(in_size);
+	j->out = xmalloc(out_size);
+	fill_random(j->in, in_size);
+	yuv_frame_init(&j->fin, j->from, j->width, j->height, 0, j->in);
+	yuv_frame_init(&j->fout, j->to, j->width, j->height, 0, j->out);
+	j->bytes = in_size;
+	return 0;
+}
+
+static void run_yuv(struct job *j)
+{
+	if (yuv_convert(&j->fin, &j->fout, YUV_SITING_CENTER) < 0)
+		error("out of memory");
+}
+
+static int prepare_rgb_to_yuv(struct job *j)
+{
+	fill_image(&j->img, j->width, j->height, j->bps);
+	j->out = xmalloc(j->width * j->height * 3 / 2);
+	j->bytes = j->img.size;
+	return 0;
+}
+
+/* NV12 as written by pnm2yuv */
+static void run_rgb_to_yuv(struct job *j)
+{
+	const int pixels = j->width * j->height;
+
+	yuv_rgb_to_420(&j->img, j->out, j->out + pixels, j->out + pixels + 1, 2);
+}
+
+static int prepare_pnm2raw(struct job *j)
+{
+	fill_image(&j->img, j->width, j->height, j->bps);
+	j->stride = raw_line_size(&j->raw, j->width);
+	j->out = xmalloc((long)j->stride * j->height);
+	j->row = xmalloc(j->width * sizeof(*j->row));
+	j->bytes = j->img.size;
+	return 0;
+}
+
+static void run_pnm2raw(struct job *j)
+{
+	int y;
+
+	for (y = 0; y < j->height; y++) {
+		raw_mosaic_row(&j->img, y, &j->raw, j->row);
+		raw_pack_row(&j->raw, j->row, j->width, j->out + (long)y * j->stride);
+	}
+}
+
+/* Packed frame, and text of it for decoding */
+static int prepare_packed(struct job *j)
+{
+	j->stride = raw_line_size(&j->raw, j->width);
+	j->bytes = (long)j->stride * j->height;
+	j->in = xmalloc(j->bytes);
+	fill_random(j->in, j->bytes);
+	j->out = xmalloc(j->bytes * 3);
+	return 0;
+}
+
+static void run_unpack(struct job *j)
+{
+	int y;
+
+	for (y = 0; y < j->height; y++)
+		raw_unpack_mipi(j->raw.bits, j->in + (long)y * j->stride, j->stride, j->width,
+				j->out + (long)y * j->width * 2);
+}
+
+static void run_hex_encode(struct job *j)
+{
+	unsigned char *t = j->out;
+	int y;
+
+	for (y = 0; y < j->height; y++)
+		t += hex_encode_line(j->in + (long)y * j->stride, j->stride, (char *)t);
+}
+
+static int prepare_hex_decode(struct job *j)
+{
+	prepare_packed(j);
+	run_hex_encode(j);
+	j->bytes *= 3;
+	return 0;
+}
+
+static void run_hex_decode(struct job *j)
+{
+	FILE *f = fmemopen(j->out, j->bytes, "r");
+	struct hex_reader r;
+	unsigned char *line;
+	int y = 0;
+
+	if (!f) error("can not open memory stream");
+	hex_reader_init(&r, f);
+	while (hex_read_line(&r, &line) > 0)
+		y++;
+	if (y != j->height)
+		error("decoded %i lines of %i", y, j->height);
+	hex_reader_free(&r);
+	fclose(f);
+}
+
+static int prepare_orient(struct job *j)
+{
+	j->bytes = (long)j->width * j->height;
+	j->in = xmalloc(j->bytes);
+	j->out = xmalloc(j->bytes);
+	fill_random(j->in, j->bytes);
+	return 0;
+}
+
+static void run_orient(struct job *j)
+{
+	orient_image(j->in, j->width, j->height, 1, orient_rotate(90), j->out);
+}
+
+static void release(struct job *j)
+{
+	free(j->in);
+	free(j->out);
+	free(j->row);
+	free(j->img.data);
+	j->in = j->out = NULL;
+	j->row = NULL;
+	j->img.data = NULL;
+}
+
+static struct job *jobs;
+static int njobs;
+
+static struct job *add_job(int (*prepare)(struct job *j), void (*run)(struct job *j),
+			   const char *name, ...)
+{
+	struct job *j;
+	va_list ap;
+
+	jobs = realloc(jobs, (njobs + 1) * sizeof(*jobs));
+	if (!jobs) error("out of memory");
+	j = &jobs[njobs++];
+	memset(j, 0, sizeof(*j));
+	j->prepare = prepare;
+	j->run = run;
+	va_start(ap, name);
+	vsnprintf(j->name, sizeof(j->name), name, ap);
+	va_end(ap);
+	return j;
+}
+
+/* Return nonzero if layout l is another name of an earlier one */
+static int yuv_alias(const struct yuv_layout *l)
+{
+	const struct yuv_layout *e;
+	int i;
+
+	for (i = 0; (e = yuv_layout_index(i)) != l; i++)
+		if (e->vsub == l->vsub && e->type == l->type &&
+		    e->swap == l->swap && e->yofs == l->yofs)
+			return 1;
+	return 0;
+}
+
+static void add_jobs(void)
+{
+	const struct yuv_layout *nv12 = yuv_layout_get("NV12");
+	const struct yuv_layout *l;
+	struct job *j;
+	int i, bps;
+
+	for (i = 0; i < SIZE(formats); i++)
+		add_job(prepare_convert, run_convert, "convert/%s", formats[i].name)->format =
+			formats[i].format;
+
+	for (i = 0; (l = yuv_layout_index(i)); i++) {
+		if (l == nv12 || yuv_alias(l))
+			continue;
+		j = add_job(prepare_yuv, run_yuv, "yuv2yuv/%s-NV12", l->name);
+		j->from = l;
+		j->to = nv12;
+		j = add_job(prepare_yuv, run_yuv, "yuv2yuv/NV12-%s", l->name);
+		j->from = nv12;
+		j->to = l;
+	}
+
+	for (bps = 1; bps <= 2; bps++)
+		add_job(prepare_rgb_to_yuv, run_rgb_to_yuv, "pnm2yuv/rgb%i", bps * 8)->bps = bps;
+
+	for (i = 0; i < SIZE(raw_formats); i++) {
+		j = add_job(prepare_pnm2raw, run_pnm2raw, "pnm2raw/%s", raw_formats[i]);
+		raw_format_parse(&j->raw, raw_formats[i]);
+		j->bps = 1;
+	}
+
+	for (i = 10; i <= 14; i += 2) {
+		j = add_job(prepare_packed, run_unpack, "txt2raw/unpack%i", i);
+		j->raw.bits = i;
+		j->raw.packed = 1;
+	}
+
+	j = add_job(prepare_packed, run_hex_encode, "pnm2txt/hex_encode");
+	raw_format_parse(&j->raw, "SGRBG10P");
+	j = add_job(prepare_hex_decode, run_hex_decode, "txt2raw/hex_decode");
+	raw_format_parse(&j->raw, "SGRBG10P");
+
+	add_job(prepare_orient, run_orient, "orient/rotate90");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned long long cycles(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* Results of an earlier run */
+struct baseline {
+	char kernel[64];
+	char resolution[16];
+	double mpix;
+};
+
+static struct baseline *baseline;
+static int nbaseline;
+
+static void read_baseline(const char *name)
+{
+	FILE *f = fopen(name, "r");
+	struct baseline b;
+	char line[512];
+
+	if (!f) error("can not open baseline `%s'", name);
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, " {\"kernel\": \"%63[^\"]\", \"resolution\": \"%15[^\"]\", "
+			   "\"width\": %*d, \"height\": %*d, \"iterations\": %*d, "
+			   "\"seconds\": %*f, \"mpix_per_s\": %lf",
+			   b.kernel, b.resolution, &b.mpix) != 3)
+			continue;
+		baseline = realloc(baseline, (nbaseline + 1) * sizeof(*baseline));
+		if (!baseline) error("out of memory");
+		baseline[nbaseline++] = b;
+	}
+	fclose(f);
+	if (!nbaseline)
+		error("no results in baseline `%s'", name);
+}
+
+static const struct baseline *find_baseline(const char *kernel, const char *resolution)
+{
+	int i;
+
+	for (i = 0; i < nbaseline; i++)
+		if (!strcmp(baseline[i].kernel, kernel) &&
+		    !strcmp(baseline[i].resolution, resolution))
+			return &baseline[i];
+	return NULL;
+}
+
+static void usage(void)
+{
+	int i;
+
+	printf("Usage: convbench [-o results.json] [-b baseline.json] [-T percent]\n"
+	       "                 [-r resolution,...] [-k kernel] [-t seconds] [-j threads]\n");
+	printf("-o: Write results as JSON\n");
+	printf("-b: Compare with results of an earlier run, exit with 1 if any kernel is\n"
+	       "    slower by more than -T percent, default 10\n");
+	printf("-r: Resolutions to run, default all:");
+	for (i = 0; i < SIZE(resolutions); i++)
+		printf(" %s", resolutions[i].name);
+	printf("\n-k: Run only kernels whose name contains the string\n");
+	printf("-t: Minimum time for each kernel and resolution, default 0.25 seconds\n");
+	printf("-j: Threads used by raw2pnm conversion of a frame, default 1\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *json_name = NULL;
+	const char *res_names = NULL;
+	const char *filter = NULL;
+	double min_time = 0.25;
+	double tolerance = 10;
+	int threads = 0;
+	int regressions = 0;
+	int first = 1;
+	FILE *json = NULL;
+	int opt, r, i;
+
+	while ((opt = getopt(argc, argv, "ho:b:T:r:k:t:j:")) != -1) {
+		switch (opt) {
+		case 'o':
+			json_name = optarg;
+			break;
+		case 'b':
+			read_baseline(optarg);
+			break;
+		case 'T':
+			tolerance = atof(optarg);
+			break;
+		case 'r':
+			res_names = optarg;
+			break;
+		case 'k':
+			filter = optarg;
+			break;
+		case 't':
+			min_time = atof(optarg);
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			if (threads < 0 || threads > CONV_MAX_THREADS)
+				error("bad number of threads");
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	add_jobs();
+	if (json_name) {
+		json = fopen(json_name, "w");
+		if (!json) error("can not open `%s'", json_name);
+		fprintf(json, "{\n\"tsc\": %s,\n\"cpu\": \"%s\",\n\"results\": [\n",
+#ifdef HAVE_TSC
+			"true",
+#else
+			"false",
+#endif
+			cpu_level_name(cpu_level()));
+	}
+
+	printf("CPU level %s\n", cpu_level_name(cpu_level()));
+	printf("%-24s %-6s %10s %10s %10s\n", "kernel", "size", "MPix/s", "MB/s", "cyc/pix");
+	for (r = 0; r < SIZE(resolutions); r++) {
+		const struct resolution *res = &resolutions[r];
+
+		if (res_names) {
+			const char *p = strstr(res_names, res->name);
+			int n = strlen(res->name);
+			if (!p || (p != res_names && p[-1] != ',') || (p[n] && p[n] != ','))
+				continue;
+		}
+
+		for (i = 0; i < njobs; i++) {
+			struct job *j = &jobs[i];
+			const struct baseline *b;
+			unsigned long long c0, c1;
+			double t0, t1, mpix, pixels;
+			int iterations = 0;
+			int slower = 0;
+
+			if (filter && !strstr(j->name, filter))
+				continue;
+			j->width = res->width;
+			j->height = res->height;
+			j->threads = threads;
+			if (j->prepare(j) < 0) {
+				release(j);
+				continue;
+			}
+
+			j->run(j);		/* Warm up caches and lazy tables */
+			t0 = now();
+			c0 = cycles();
+			do {
+				j->run(j);
+				iterations++;
+				t1 = now();
+			} while (t1 - t0 < min_time || iterations < 3);
+			c1 = cycles();
+			release(j);
+
+			pixels = (double)j->width * j->height * iterations;
+			mpix = pixels / (t1 - t0) / 1e6;
+			b = find_baseline(j->name, res->name);
+			if (b && mpix < b->mpix * (1 - tolerance / 100)) {
+				slower = 1;
+				regressions++;
+			}
+
+			printf("%-24s %-6s %10.1f %10.1f", j->name, res->name, mpix,
+			       j->bytes * iterations / (t1 - t0) / 1e6);
+#ifdef HAVE_TSC
+			printf(" %10.2f", (c1 - c0) / pixels);
+#else
+			printf(" %10s", "-");
+#endif
+			if (b)
+				printf("  %+.1f%%%s", (mpix / b->mpix - 1) * 100,
+				       slower ? " REGRESSION" : "");
+			printf("\n");
+			fflush(stdout);
+
+			if (!json)
+				continue;
+			fprintf(json, "%s{\"kernel\": \"%s\", \"resolution\": \"%s\", "
+				"\"width\": %i, \"height\": %i, \"iterations\": %i, "
+				"\"seconds\": %.6f, \"mpix_per_s\": %.3f, \"bytes_per_s\": %.0f, "
+				"\"cycles_per_pixel\": ",
+				first ? "" : ",\n", j->name, res->name, j->width, j->height,
+				iterations, t1 - t0, mpix, j->bytes * iterations / (t1 - t0));
+#ifdef HAVE_TSC
+			fprintf(json, "%.3f", (c1 - c0) / pixels);
+#else
+			fprintf(json, "null");
+#endif
+			if (b)
+				fprintf(json, ", \"baseline_mpix_per_s\": %.3f, \"regression\": %s",
+					b->mpix, slower ? "true" : "false");
+			fprintf(json, "}");
+			first = 0;
+		}
+	}
+
+	if (json) {
+		fprintf(json, "\n]\n}\n");
+		if (fclose(json) != 0)
+			error("failed writing `%s'", json_name);
+	}
+	if (regressions)
+		printf("%i results slower than baseline by more than %g%%\n", regressions, tolerance);
+	free(jobs);
+	free(baseline);
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,1540 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "linux/videodev2.h"
+
+#include "extradefs.h"
+#include "cpulib.h"
+#include "utillib.h"
+#include "rawlib.h"
+#include "convlib.h"
+
+#define MIN(a,b)	((a) <= (b) ? (a) : (b))
+#define MAX(a,b)	((a) >= (b) ? (a) : (b))
+#define CLAMP(a,lo,hi)	((a) < (lo) ? (lo) : (a) > (hi) ? (hi) : (a))
+#define CLAMPB(a)	CLAMP(a, 0, 255)
+#define DIV_ROUND_UP(a,b)	(((a) + (b) - 1) / (b))
+#define SIZE(x)		(sizeof(x)/sizeof((x)[0]))
+
+static const char *const types[] = { "ppm", "pgm", "pam", "y4m", "rgb" };
+
+static void default_error(const char *msg)
+{
+	fprintf(stderr, "%s\n", msg);
+	exit(1);
+}
+
+static void (*error_fn)(const char *msg) = default_error;
+static void (*warning_fn)(const char *msg);
+
+void conv_set_handlers(void (*error)(const char *msg), void (*warning)(const char *msg))
+{
+	error_fn = error ? error : default_error;
+	warning_fn = warning;
+}
+
+/* Report the error with errno preserved for the handler, never return */
+static void error(char *msg, ...)
+{
+	char b[256];
+	va_list ap;
+	int e = errno;
+
+	va_start(ap, msg);
+	vsnprintf(b, sizeof(b), msg, ap);
+	va_end(ap);
+	errno = e;
+	error_fn(b);
+	exit(1);
+}
+
+static void warning(char *msg, ...)
+{
+	char b[256];
+	va_list ap;
+
+	if (!warning_fn)
+		return;
+	va_start(ap, msg);
+	vsnprintf(b, sizeof(b), msg, ap);
+	va_end(ap);
+	warning_fn(b);
+}
+
+int conv_type(const char *name)
+{
+	int i;
+
+	for (i = 0; i < SIZE(types); i++)
+		if (!strcmp(name, types[i]))
+			return i;
+	return -1;
+}
+
+const char *conv_type_name(int type)
+{
+	return type >= 0 && type < SIZE(types) ? types[type] : NULL;
+}
+
+
+static void *duplicate_buffer(void *buffer, int size, int new_size)
+{
+	void *b = calloc(1, new_size);
+	if (!b)
+		error("out of memory, can not allocate %i bytes", new_size);
+	memcpy(b, buffer, MIN(size, new_size));
+	if (new_size > size)
+		warning("input buffer too small by %i bytes, setting the rest to zero",
+			new_size - size);
+	return b;
+}
+
+/*
+ * Return the input buffer if it has at least size bytes. Otherwise
+ * return a zero-padded copy of it, which is also stored into copy.
+ */
+static unsigned char *get_input(void *buffer, int in_size, int size, unsigned char **copy)
+{
+	if (in_size >= size)
+		return buffer;
+	*copy = duplicate_buffer(buffer, in_size, size);
+	return *copy;
+}
+
+static void inline yuv_to_rgb(unsigned char rgb[3], int y, int cb, int cr)
+{
+	static const int R = 0;
+	static const int G = 1;
+	static const int B = 2;
+	int u = cb;
+	int v = cr;
+#if 0
+	/* http://www.fourcc.org/fccyvrgb.php */
+	rgb[B] = CLAMPB(1.164*(y - 16)                   + 2.018*(u - 128));
+	rgb[G] = CLAMPB(1.164*(y - 16) - 0.813*(v - 128) - 0.391*(u - 128));
+	rgb[R] = CLAMPB(1.164*(y - 16) + 1.596*(v - 128));
+#else
+	/* http://en.wikipedia.org/wiki/YUV
+	 * conversion from Y'UV to RGB (NTSC version): */
+	int c = y - 16;
+	int d = u - 128;
+	int e = v - 128;
+	rgb[R] = CLAMPB((298*c + 409*e + 128) >> 8);
+	rgb[G] = CLAMPB((298*c - 100*d - 208*e + 128) >> 8);
+	rgb[B] = CLAMPB((298*c + 516*d + 128) >> 8);
+#endif
+}
+
+#ifdef __SSE2__
+/* Sum groups of k = 2, 4, or 8 consecutive bytes, return number of sums done */
+static int area_add_sse2(uint32_t *acc, const unsigned char *s, int n, int k)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask = _mm_set1_epi16(0xff);
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i v, p, a;
+	int i;
+
+	if (k != 2 && k != 4 && k != 8)
+		return 0;
+
+	for (i = 0; i + 16 / k <= n; i += 16 / k) {
+		v = _mm_loadu_si128((const __m128i *)(s + i * k));
+		p = _mm_add_epi16(_mm_and_si128(v, mask), _mm_srli_epi16(v, 8));
+		if (k == 2) {
+			a = _mm_loadu_si128((__m128i *)&acc[i]);
+			a = _mm_add_epi32(a, _mm_unpacklo_epi16(p, zero));
+			_mm_storeu_si128((__m128i *)&acc[i], a);
+			a = _mm_loadu_si128((__m128i *)&acc[i + 4]);
+			a = _mm_add_epi32(a, _mm_unpackhi_epi16(p, zero));
+			_mm_storeu_si128((__m128i *)&acc[i + 4], a);
+		} else if (k == 4) {
+			a = _mm_loadu_si128((__m128i *)&acc[i]);
+			a = _mm_add_epi32(a, _mm_madd_epi16(p, ones));
+			_mm_storeu_si128((__m128i *)&acc[i], a);
+		} else {
+			p = _mm_shuffle_epi32(_mm_sad_epu8(v, zero), _MM_SHUFFLE(3, 3, 2, 0));
+			a = _mm_loadl_epi64((__m128i *)&acc[i]);
+			_mm_storel_epi64((__m128i *)&acc[i], _mm_add_epi32(a, p));
+		}
+	}
+	return i;
+}
+#endif
+
+/*
+ * Add sums of groups of k samples into n accumulators. Samples are
+ * step bytes apart and take bpp bytes, LSB first.
+ */
+static void area_add(uint32_t *acc, const unsigned char *s, int step, int n, int k, int bpp)
+{
+	const unsigned char *p;
+	uint32_t sum;
+	int i = 0, j;
+
+#ifdef __SSE2__
+	if (step == 1 && bpp == 1)
+		i = area_add_sse2(acc, s, n, k);
+#endif
+	for (; i < n; i++) {
+		p = s + i * k * step;
+		sum = 0;
+		for (j = 0; j < k; j++, p += step)
+			sum += bpp == 2 ? p[0] | (p[1] << 8) : p[0];
+		acc[i] += sum;
+	}
+}
+
+enum { CH_R, CH_G, CH_B };
+
+/*
+ * Raw Bayer conversion. Every output pixel gets its R, G, and B components
+ * from the nearest raw pixels of the same colour: the pixel itself, the
+ * previous pixel on the row, or the pixel on the row above. The last seen
+ * component values are carried in c[] from pixel to pixel and row to row.
+ */
+typedef void bayer_row_fn(const unsigned char *s, const unsigned char *a,
+			  unsigned char *d, int width, unsigned int c[3]);
+
+struct bayer_kernel {
+	bayer_row_fn *row[2];		/* For even and odd rows */
+	bayer_row_fn *row16[2];		/* Same with 16-bit output */
+};
+
+static inline unsigned int bayer_load(const unsigned char *p, int i, const int bpp)
+{
+	if (bpp == 1)
+		return p[i];
+	return p[i * 2] | (p[i * 2 + 1] << 8);
+}
+
+/*
+ * Convert one row of raw Bayer data pointed by s into RGB. The row above
+ * is pointed by a. The row contains green pixels and pixels of colour cc,
+ * the other colour is taken from the row above at the green pixels.
+ * If out16 is set, the samples are stored without shifting as 16 bits,
+ * MSB first, otherwise shifted down to 8 bits.
+ * Always inlined so that all of the const arguments are known at
+ * compile time in the specialized kernels and the pixel loop has no branches.
+ */
+static inline __attribute__((always_inline)) void
+bayer_row(const unsigned char *s, const unsigned char *a, unsigned char *d,
+	  int width, unsigned int c[3], const int bpp, const int shift,
+	  const int cc, const int gfirst, const int out16)
+{
+	const int ac = CH_B - cc;
+	const int dbpp = out16 ? 6 : 3;
+	unsigned int v[3] = { c[CH_R], c[CH_G], c[CH_B] };
+	int x;
+
+#define BAYER_STORE(d, v) do {				\
+		if (out16) {					\
+			(d)[0] = v[CH_R] >> 8;			\
+			(d)[1] = v[CH_R];			\
+			(d)[2] = v[CH_G] >> 8;			\
+			(d)[3] = v[CH_G];			\
+			(d)[4] = v[CH_B] >> 8;			\
+			(d)[5] = v[CH_B];			\
+		} else {					\
+			(d)[0] = v[CH_R] >> shift;		\
+			(d)[1] = v[CH_G] >> shift;		\
+			(d)[2] = v[CH_B] >> shift;		\
+		}						\
+	} while (0)
+
+	for (x = 0; x < width - 1; x += 2) {
+		if (gfirst) {
+			v[CH_G] = bayer_load(s, x, bpp);
+			v[ac] = bayer_load(a, x, bpp);
+			BAYER_STORE(d, v);
+			v[cc] = bayer_load(s, x + 1, bpp);
+			BAYER_STORE(d + dbpp, v);
+		} else {
+			v[cc] = bayer_load(s, x, bpp);
+			BAYER_STORE(d, v);
+			v[CH_G] = bayer_load(s, x + 1, bpp);
+			v[ac] = bayer_load(a, x + 1, bpp);
+			BAYER_STORE(d + dbpp, v);
+		}
+		d += dbpp * 2;
+	}
+	if (x < width) {
+		if (gfirst) {
+			v[CH_G] = bayer_load(s, x, bpp);
+			v[ac] = bayer_load(a, x, bpp);
+		} else {
+			v[cc] = bayer_load(s, x, bpp);
+		}
+		BAYER_STORE(d, v);
+	}
+#undef BAYER_STORE
+
+	c[CH_R] = v[CH_R];
+	c[CH_G] = v[CH_G];
+	c[CH_B] = v[CH_B];
+}
+
+/* Row kernels for given bits per pixel and colour pattern such as "gr" */
+#define BAYER_ROW_KERNEL(bits, pat, cc, gfirst)					\
+static void bayer_row_##bits##_##pat(const unsigned char *s,			\
+		const unsigned char *a, unsigned char *d, int width,		\
+		unsigned int c[3])						\
+{										\
+	bayer_row(s, a, d, width, c, (bits) > 8 ? 2 : 1, (bits) - 8, cc, gfirst, 0); \
+}										\
+static void bayer_row16_##bits##_##pat(const unsigned char *s,			\
+		const unsigned char *a, unsigned char *d, int width,		\
+		unsigned int c[3])						\
+{										\
+	bayer_row(s, a, d, width, c, (bits) > 8 ? 2 : 1, (bits) - 8, cc, gfirst, 1); \
+}
+
+/* CFA order given by the colour patterns of even and odd rows */
+#define BAYER_ORDER(bits, order, even, odd)					\
+	static const struct bayer_kernel bayer_##bits##_##order = {		\
+		{ bayer_row_##bits##_##even, bayer_row_##bits##_##odd },	\
+		{ bayer_row16_##bits##_##even, bayer_row16_##bits##_##odd },	\
+	};
+
+/* All row kernels and CFA orders for given bits per pixel */
+#define BAYER_KERNELS(bits)							\
+	BAYER_ROW_KERNEL(bits, gr, CH_R, 1)					\
+	BAYER_ROW_KERNEL(bits, rg, CH_R, 0)					\
+	BAYER_ROW_KERNEL(bits, bg, CH_B, 0)					\
+	BAYER_ROW_KERNEL(bits, gb, CH_B, 1)					\
+	BAYER_ORDER(bits, bggr, bg, gr)						\
+	BAYER_ORDER(bits, gbrg, gb, rg)						\
+	BAYER_ORDER(bits, rggb, rg, gb)						\
+	BAYER_ORDER(bits, grbg, gr, bg)
+
+BAYER_KERNELS(8)
+BAYER_KERNELS(10)
+BAYER_KERNELS(12)
+BAYER_KERNELS(14)
+BAYER_KERNELS(16)
+
+/*
+ * Unpack one row of packed or compressed raw data into 16-bit pixels,
+ * stored LSB first, for the Bayer row kernels.
+ */
+typedef void bayer_unpack_fn(const unsigned char *s, int stride, unsigned char *d, int width);
+
+struct bayer_packing {
+	int pixels;			/* Pixels in a group */
+	int bytes;			/* Bytes taken by a group on a row */
+	int rows;			/* Rows in a group */
+	bayer_unpack_fn *unpack[2];	/* For even and odd rows */
+	int whole_row;			/* Rows must be unpacked from the beginning */
+};
+
+static inline void put_le16(unsigned char *d, unsigned int v)
+{
+	d[0] = v & 0xff;
+	d[1] = (v >> 8) & 0xff;
+}
+
+/* Copy n 16-bit samples from LSB first into MSB first byte order */
+static void swap16(unsigned char *d, const unsigned char *s, int n)
+{
+	unsigned char t;
+	int i = 0;
+
+#ifdef __SSE2__
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&s[i * 2]);
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *)&d[i * 2], v);
+	}
+#endif
+	for (; i < n; i++) {
+		t = s[i * 2];
+		d[i * 2] = s[i * 2 + 1];
+		d[i * 2 + 1] = t;
+	}
+}
+
+/* MIPI RAW10, RAW12, and RAW14, rows are padded to whole groups */
+static void unpack_raw10(const unsigned char *s, int stride, unsigned char *d, int width)
+{
+	raw_unpack_mipi(10, s, DIV_ROUND_UP(width, 4) * 5, width, d);
+}
+
+static void unpack_raw12(const unsigned char *s, int stride, unsigned char *d, int width)
+{
+	raw_unpack_mipi(12, s, DIV_ROUND_UP(width, 2) * 3, width, d);
+}
+
+static void unpack_raw14(const unsigned char *s, int stride, unsigned char *d, int width)
+{
+	raw_unpack_mipi(14, s, DIV_ROUND_UP(width, 4) * 7, width, d);
+}
+
+/*
+ * A-law compressed 10-bit data: piecewise linear segments, each code
+ * is expanded to the middle of the range of values it represents.
+ */
+static const struct alaw_segment {
+	int code;			/* First code of the segment */
+	int value;			/* First value of the segment */
+	int step;			/* Value increment per code */
+} alaw_segments[] = {
+	{   0,   0,  1 },		/* 0..127 */
+	{ 128, 128,  2 },		/* 128..255 */
+	{ 192, 256,  8 },		/* 256..511 */
+	{ 224, 512, 16 },		/* 512..1023 */
+};
+
+static uint16_t alaw_lut[256];
+static pthread_once_t alaw_once = PTHREAD_ONCE_INIT;
+
+static void alaw_init(void)
+{
+	const struct alaw_segment *seg = alaw_segments;
+	int c;
+
+	for (c = 0; c < 256; c++) {
+		if (seg < &alaw_segments[SIZE(alaw_segments) - 1] && c >= seg[1].code)
+			seg++;
+		alaw_lut[c] = seg->value + (c - seg->code) * seg->step + seg->step / 2;
+	}
+}
+
+static void unpack_alaw8(const unsigned char *s, int stride, unsigned char *d, int width)
+{
+	int x = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	int i;
+
+	/* Evaluate the segments for 16 pixels at a time */
+	for (; x + 16 <= width; x += 16) {
+		__m128i c8 = _mm_loadu_si128((const __m128i *)&s[x]);
+		__m128i c[2] = { _mm_unpacklo_epi8(c8, zero), _mm_unpackhi_epi8(c8, zero) };
+		for (i = 0; i < 2; i++) {
+			const struct alaw_segment *seg;
+			__m128i v = c[i];
+			for (seg = &alaw_segments[1]; seg < &alaw_segments[SIZE(alaw_segments)]; seg++) {
+				__m128i m = _mm_cmpgt_epi16(c[i], _mm_set1_epi16(seg->code - 1));
+				__m128i t = _mm_mullo_epi16(_mm_sub_epi16(c[i], _mm_set1_epi16(seg->code)),
+							    _mm_set1_epi16(seg->step));
+				t = _mm_add_epi16(t, _mm_set1_epi16(seg->value + seg->step / 2));
+				v = _mm_or_si128(_mm_and_si128(m, t), _mm_andnot_si128(m, v));
+			}
+			_mm_storeu_si128((__m128i *)&d[(x + i * 8) * 2], v);
+		}
+	}
+#endif
+	pthread_once(&alaw_once, alaw_init);
+	for (; x < width; x++)
+		put_le16(&d[x * 2], alaw_lut[s[x]]);
+}
+
+/*
+ * 10-8-10 DPCM compressed data with MIPI CSI-2 / SMIA Predictor1: each
+ * pixel is predicted from the previous pixel of the same colour. The first
+ * two pixels of a row are PCM coded, so rows can be decoded independently.
+ */
+static void unpack_dpcm8(const unsigned char *s, int stride, unsigned char *d, int width)
+{
+	int pred[2] = { 0, 0 };
+	int x, c, v, value;
+
+	for (x = 0; x < width; x++) {
+		c = s[x];
+		if (x < 2) {
+			v = (c << 2) + 2;
+		} else if ((c & 0xc0) == 0x00) {	/* DPCM1: 00sxxxxx */
+			value = c & 0x1f;
+			v = (c & 0x20) ? pred[x & 1] - value : pred[x & 1] + value;
+		} else if ((c & 0xe0) == 0x40) {	/* DPCM2: 010sxxxx */
+			value = ((c & 0x0f) << 1) + 32;
+			v = (c & 0x10) ? pred[x & 1] - value : pred[x & 1] + value;
+		} else if ((c & 0xe0) == 0x60) {	/* DPCM3: 011sxxxx */
+			value = ((c & 0x0f) << 2) + 64 + 1;
+			v = (c & 0x10) ? pred[x & 1] - value : pred[x & 1] + value;
+		} else {				/* PCM: 1xxxxxxx */
+			value = (c & 0x7f) << 3;
+			v = value > pred[x & 1] ? value + 3 : value + 4;
+		}
+		v = CLAMP(v, 0, 1023);
+		pred[x & 1] = v;
+		put_le16(&d[x * 2], v);
+	}
+}
+
+/*
+ * ISP vector layout: each pair of rows is stored as vectors of 64 pixels,
+ * each vector containing 32 Gr, 32 R, 32 B, and 32 Gb pixels in this order,
+ * 16 bits per pixel. Even rows get Gr and R, odd rows B and Gb.
+ */
+static void unpack_v32(const unsigned char *s, unsigned char *d, int width)
+{
+	int x, i;
+
+	for (x = 0; x < width; x += 64) {
+#ifdef __SSE2__
+		if (x + 64 <= width) {
+			for (i = 0; i < 64; i += 16) {
+				__m128i g = _mm_loadu_si128((const __m128i *)&s[i]);
+				__m128i c = _mm_loadu_si128((const __m128i *)&s[i + 64]);
+				_mm_storeu_si128((__m128i *)&d[i * 2], _mm_unpacklo_epi16(g, c));
+				_mm_storeu_si128((__m128i *)&d[i * 2 + 16], _mm_unpackhi_epi16(g, c));
+			}
+			s += 256;
+			d += 64 * 2;
+			continue;
+		}
+#endif
+		for (i = 0; i < 32 && x + i * 2 < width; i++) {
+			d[i * 4 + 0] = s[i * 2 + 0];
+			d[i * 4 + 1] = s[i * 2 + 1];
+			if (x + i * 2 + 1 < width) {
+				d[i * 4 + 2] = s[i * 2 + 64];
+				d[i * 4 + 3] = s[i * 2 + 65];
+			}
+		}
+		s += 256;
+		d += 64 * 2;
+	}
+}
+
+static void unpack_v32_even(const unsigned char *s, int stride, unsigned char *d, int width)
+{
+	unpack_v32(s, d, width);
+}
+
+static void unpack_v32_odd(const unsigned char *s, int stride, unsigned char *d, int width)
+{
+	unpack_v32(s - stride + 128, d, width);
+}
+
+static const struct bayer_packing packing_raw10 = { 4, 5, 1, { unpack_raw10, unpack_raw10 } };
+static const struct bayer_packing packing_raw12 = { 2, 3, 1, { unpack_raw12, unpack_raw12 } };
+static const struct bayer_packing packing_raw14 = { 4, 7, 1, { unpack_raw14, unpack_raw14 } };
+static const struct bayer_packing packing_alaw8 = { 1, 1, 1, { unpack_alaw8, unpack_alaw8 } };
+static const struct bayer_packing packing_dpcm8 = { 1, 1, 1, { unpack_dpcm8, unpack_dpcm8 }, 1 };
+static const struct bayer_packing packing_v32 = { 64, 128, 2, { unpack_v32_even, unpack_v32_odd } };
+
+struct bayer_format {
+	__u32 format;
+	int bits;			/* Bits per pixel, stored in 1 or 2 bytes LSB first */
+	const struct bayer_kernel *kernel;
+	const struct bayer_packing *packing;	/* NULL if not packed */
+	const char *order;		/* Colours of the first two rows */
+};
+
+#define BAYER(fmt, bits, order)	{ V4L2_PIX_FMT_##fmt, bits, &bayer_##bits##_##order, NULL, #order }
+#define BAYER_PACKED(fmt, bits, order, packing) \
+	{ V4L2_PIX_FMT_##fmt, bits, &bayer_##bits##_##order, &packing_##packing, #order }
+static const struct bayer_format bayer_formats[] = {
+	BAYER(SBGGR8, 8, bggr),
+	BAYER(SGBRG8, 8, gbrg),
+	BAYER(SGRBG8, 8, grbg),
+	BAYER(SRGGB8, 8, rggb),
+	BAYER(SBGGR10, 10, bggr),
+	BAYER(SGBRG10, 10, gbrg),
+	BAYER(SGRBG10, 10, grbg),
+	BAYER(SRGGB10, 10, rggb),
+	BAYER(SBGGR12, 12, bggr),
+	BAYER(SGBRG12, 12, gbrg),
+	BAYER(SGRBG12, 12, grbg),
+	BAYER(SRGGB12, 12, rggb),
+	BAYER(SBGGR14, 14, bggr),
+	BAYER(SGBRG14, 14, gbrg),
+	BAYER(SGRBG14, 14, grbg),
+	BAYER(SRGGB14, 14, rggb),
+	BAYER(SBGGR16, 16, bggr),
+	BAYER(SGBRG16, 16, gbrg),
+	BAYER(SGRBG16, 16, grbg),
+	BAYER(SRGGB16, 16, rggb),
+	BAYER_PACKED(SBGGR10P, 10, bggr, raw10),
+	BAYER_PACKED(SGBRG10P, 10, gbrg, raw10),
+	BAYER_PACKED(SGRBG10P, 10, grbg, raw10),
+	BAYER_PACKED(SRGGB10P, 10, rggb, raw10),
+	BAYER_PACKED(SBGGR12P, 12, bggr, raw12),
+	BAYER_PACKED(SGBRG12P, 12, gbrg, raw12),
+	BAYER_PACKED(SGRBG12P, 12, grbg, raw12),
+	BAYER_PACKED(SRGGB12P, 12, rggb, raw12),
+	BAYER_PACKED(SBGGR14P, 14, bggr, raw14),
+	BAYER_PACKED(SGBRG14P, 14, gbrg, raw14),
+	BAYER_PACKED(SGRBG14P, 14, grbg, raw14),
+	BAYER_PACKED(SRGGB14P, 14, rggb, raw14),
+	BAYER_PACKED(SBGGR10ALAW8, 10, bggr, alaw8),
+	BAYER_PACKED(SGBRG10ALAW8, 10, gbrg, alaw8),
+	BAYER_PACKED(SGRBG10ALAW8, 10, grbg, alaw8),
+	BAYER_PACKED(SRGGB10ALAW8, 10, rggb, alaw8),
+	BAYER_PACKED(SBGGR10DPCM8, 10, bggr, dpcm8),
+	BAYER_PACKED(SGBRG10DPCM8, 10, gbrg, dpcm8),
+	BAYER_PACKED(SGRBG10DPCM8, 10, grbg, dpcm8),
+	BAYER_PACKED(SRGGB10DPCM8, 10, rggb, dpcm8),
+	BAYER_PACKED(SBGGR10V32, 10, bggr, v32),
+	BAYER_PACKED(SGBRG10V32, 10, gbrg, v32),
+	BAYER_PACKED(SGRBG10V32, 10, grbg, v32),
+	BAYER_PACKED(SRGGB10V32, 10, rggb, v32),
+	BAYER_PACKED(SBGGR12V32, 12, bggr, v32),
+	BAYER_PACKED(SGBRG12V32, 12, gbrg, v32),
+	BAYER_PACKED(SGRBG12V32, 12, grbg, v32),
+	BAYER_PACKED(SRGGB12V32, 12, rggb, v32),
+	{ 0, 0, NULL, NULL, NULL }
+};
+
+static const struct bayer_format *bayer_format_get(__u32 format)
+{
+	const struct bayer_format *bf;
+
+	for (bf = bayer_formats; bf->kernel; bf++)
+		if (bf->format == format)
+			return bf;
+	return NULL;
+}
+
+/* Return the column from which a row must be unpacked to get pixels from column x onwards */
+static int bayer_unpack_from(const struct bayer_packing *p, int x)
+{
+	if (p->whole_row)
+		return 0;
+	return x - x % p->pixels;
+}
+
+/* Return the offset in a row of the group starting from column u0 from bayer_unpack_from() */
+static int bayer_unpack_offset(const struct bayer_packing *p, int u0)
+{
+	return u0 / p->pixels * p->bytes * p->rows;
+}
+
+/* Return the minimum number of bytes in a row of raw Bayer image */
+static int bayer_row_bytes(const struct bayer_format *bf, int width)
+{
+	if (bf->packing)
+		return DIV_ROUND_UP(width, bf->packing->pixels) * bf->packing->bytes;
+	return width * (bf->bits > 8 ? 2 : 1);
+}
+
+struct bayer_band {
+	const struct bayer_format *bf;
+	const struct conv_output *o;
+	const unsigned char *s;		/* Beginning of the raw image */
+	unsigned char *d;		/* Beginning of the RGB image */
+	int width;
+	int stride;
+	int x, y, w;			/* Output starts from raw pixel (x,y), w pixels wide */
+	int y0, y1;			/* Convert output rows y0..y1-1 */
+	pthread_t thread;
+};
+
+/* Store one row of raw Bayer pixels as grey samples */
+static void bayer_grey_row(const struct bayer_format *bf, const unsigned char *s,
+			   unsigned char *d, int width, int bps)
+{
+	int x;
+
+	if (bps == 2)
+		swap16(d, s, width);
+	else if (bf->bits > 8)
+		for (x = 0; x < width; x++)
+			d[x] = (s[x * 2] | (s[x * 2 + 1] << 8)) >> (bf->bits - 8);
+	else
+		memcpy(d, s, width);
+}
+
+/*
+ * Convert a band of rows from raw Bayer image into RGB or grey image,
+ * return NULL or error message. Packed rows are unpacked one at a time into a line buffer which is fed
+ * to the row kernel. A band not starting from the top first converts the
+ * preceding row into a scratch buffer: with at least two pixels per row
+ * that restores exactly the R, G, and B values carried into the band.
+ * Similarly output starting from column 2 or more is converted from the
+ * pair of pixels preceding it, otherwise the values carried from the end
+ * of the previous row are needed and whole rows are converted.
+ */
+static void *bayer_convert_band(void *arg)
+{
+	const struct bayer_band *band = arg;
+	const struct bayer_format *bf = band->bf;
+	const struct bayer_packing *p = bf->packing;
+	const int bpp = bf->bits > 8 ? 2 : 1;
+	const int bps = CONV_OUTPUT_BPS(band->o);
+	const int dbpp = band->o->channels * bps;
+	const int dstride = band->w * dbpp;
+	const struct bayer_kernel *k = band->bf->kernel;
+	bayer_row_fn * const *row = bps == 2 ? k->row16 : k->row;
+	unsigned int c[3] = { 0, 0, 0 };
+	const unsigned char *s, *a, *r;
+	unsigned char *zero, *line[2], *out, *d;
+	int x0, x1, u0;			/* Convert columns x0..x1-1, unpack from u0 */
+	int u0ofs = 0;			/* Offset of column u0 in a row */
+	int width, direct;
+	int y, y0;
+
+	if (band->o->channels == 1) {
+		x0 = band->x;
+		x1 = band->x + band->w;
+	} else if (band->x >= 2) {
+		x0 = (band->x & ~1) - 2;
+		x1 = band->x + band->w;
+	} else {
+		x0 = 0;
+		x1 = band->width;
+	}
+	width = x1 - x0;
+	direct = x0 == band->x && width == band->w;
+	u0 = x0;
+	if (p) {
+		u0 = bayer_unpack_from(p, x0);
+		u0ofs = bayer_unpack_offset(p, u0);
+	}
+
+	zero = calloc(1, width * bpp + (x1 - u0) * bpp * 2 + width * dbpp);
+	if (!zero)
+		return "out of memory";
+	line[0] = zero + width * bpp;
+	line[1] = line[0] + (x1 - u0) * bpp;
+	out = line[1] + (x1 - u0) * bpp;	/* Scratch output row */
+
+	/* The first row has no row above, use zeroes instead */
+	a = zero;
+	y0 = band->y + band->y0;
+	d = band->d + band->y0 * dstride;
+	for (y = MAX(y0 - 2, 0); y < band->y + band->y1; y++) {
+		s = band->s + y * band->stride;
+		r = s + x0 * bpp;
+		if (p) {
+			p->unpack[y & 1](s + u0ofs, band->stride, line[y & 1], x1 - u0);
+			r = line[y & 1] + (x0 - u0) * bpp;
+		}
+		if (y < y0 - 1) {
+			/* Only row above is needed */
+		} else if (band->o->channels == 1) {
+			if (y >= y0)
+				bayer_grey_row(bf, r, d, width, bps);
+		} else if (y == y0 - 1) {
+			row[y & 1](r, a, out, width, c);
+		} else if (direct) {
+			row[y & 1](r, a, d, width, c);
+		} else {
+			row[y & 1](r, a, out, width, c);
+			memcpy(d, out + (band->x - x0) * dbpp, dstride);
+		}
+		if (y >= y0)
+			d += dstride;
+		a = r;
+	}
+
+	free(zero);
+	return NULL;
+}
+
+/*
+ * Downscale a band of rows from raw Bayer image by binning: each output
+ * pixel gets the mean of each colour in a block of scale x scale pixels,
+ * so no demosaicing is needed. Grey output is the mean of all samples.
+ * Return NULL or error message.
+ */
+static void *bayer_bin_band(void *arg)
+{
+	const struct bayer_band *band = arg;
+	const struct bayer_format *bf = band->bf;
+	const struct bayer_packing *p = bf->packing;
+	const struct conv_output *o = band->o;
+	const int bpp = bf->bits > 8 ? 2 : 1;
+	const int k = o->scale;
+	const int width = band->w / k;
+	const int bps = CONV_OUTPUT_BPS(o);
+	const int shift = bps == 2 ? 0 : bf->bits - 8;
+	const int site_r = strchr(bf->order, 'r') - bf->order;
+	const int site_b = strchr(bf->order, 'b') - bf->order;
+	const unsigned int n = k * k / 4;	/* Samples of a site in a block */
+	const unsigned char *s;
+	unsigned char *line, *d;
+	uint32_t *acc, *a, sum;
+	unsigned int v[3];
+	int x, y, i, c, u0 = band->x, u0ofs = 0;
+
+	if (p) {
+		u0 = bayer_unpack_from(p, band->x);
+		u0ofs = bayer_unpack_offset(p, u0);
+	}
+	acc = malloc(width * 4 * sizeof(*acc) + (band->x + band->w - u0) * bpp);
+	if (!acc)
+		return "out of memory";
+	line = (unsigned char *)(acc + width * 4);
+
+	d = band->d + band->y0 * width * o->channels * bps;
+	for (y = band->y0; y < band->y1; y++) {
+		memset(acc, 0, width * 4 * sizeof(*acc));
+		for (i = band->y + y * k; i < band->y + (y + 1) * k; i++) {
+			s = band->s + i * band->stride;
+			if (p) {
+				p->unpack[i & 1](s + u0ofs, band->stride, line, band->x + band->w - u0);
+				s = line + (band->x - u0) * bpp;
+			} else {
+				s += band->x * bpp;
+			}
+			a = acc + (i & 1) * 2 * width;
+			area_add(a + (band->x & 1) * width, s, 2 * bpp, width, k / 2, bpp);
+			area_add(a + (~band->x & 1) * width, s + bpp, 2 * bpp, width, k / 2, bpp);
+		}
+		for (x = 0; x < width; x++) {
+			a = acc + x;
+			sum = a[0] + a[width] + a[width * 2] + a[width * 3];
+			if (o->channels == 1) {
+				v[0] = (sum + 2 * n) / (4 * n) >> shift;
+			} else {
+				v[CH_R] = (a[site_r * width] + n / 2) / n >> shift;
+				v[CH_B] = (a[site_b * width] + n / 2) / n >> shift;
+				v[CH_G] = (sum - a[site_r * width] - a[site_b * width] + n) / (2 * n) >> shift;
+			}
+			for (c = 0; c < o->channels; c++) {
+				if (bps == 2) {
+					d[0] = v[c] >> 8;
+					d[1] = v[c];
+				} else {
+					d[0] = v[c];
+				}
+				d += bps;
+			}
+		}
+	}
+
+	free(acc);
+	return NULL;
+}
+
+/*
+ * Convert region x, y, w, h of raw Bayer image into RGB or grey image,
+ * return NULL or error message. The bands report errors by returning,
+ * as they may run in other threads than the one to report them. Bands
+ * for which no thread could be created are converted by the caller.
+ */
+static const char *bayer_convert(const struct bayer_format *bf, const unsigned char *s,
+				 int width, int stride, int x, int y, int w, int h,
+				 const struct conv_output *o, unsigned char *d)
+{
+	void *(*fn)(void *) = o->scale > 1 ? bayer_bin_band : bayer_convert_band;
+	struct bayer_band bands[CONV_MAX_THREADS];
+	int height = h / o->scale;
+	void *msg, *r;
+	int i, n, started;
+
+	n = width < 2 ? 1 : CLAMP(height / 16, 1, MAX(o->threads, 1));
+	for (i = 0; i < n; i++) {
+		bands[i].bf = bf;
+		bands[i].o = o;
+		bands[i].s = s;
+		bands[i].d = d;
+		bands[i].width = width;
+		bands[i].stride = stride;
+		bands[i].x = x;
+		bands[i].y = y;
+		bands[i].w = w;
+		bands[i].y0 = height * i / n;
+		bands[i].y1 = height * (i + 1) / n;
+	}
+	for (i = 1; i < n; i++)
+		if (pthread_create(&bands[i].thread, NULL, fn, &bands[i]))
+			break;
+	started = i;
+	msg = fn(&bands[0]);
+	for (i = started; i < n; i++)
+		if ((r = fn(&bands[i])))
+			msg = r;
+	for (i = 1; i < started; i++) {
+		pthread_join(bands[i].thread, &r);
+		if (r)
+			msg = r;
+	}
+	return msg;
+}
+
+/*
+ * Convert region x, y, w, h of raw Bayer image into oriented RGB or grey
+ * image, return NULL or error message. The raw pixels of the region are unpacked and oriented before
+ * demosaicing, which moves one or two bytes per pixel instead of three
+ * or six, and the image is then converted as unpacked format with the
+ * CFA order of the oriented pixels.
+ */
+static const char *bayer_convert_oriented(const struct bayer_format *bf, const unsigned char *s,
+					  int stride, int x, int y, int w, int h,
+					  const struct conv_output *o, unsigned char *d)
+{
+	const int bpp = bf->bits > 8 ? 2 : 1;
+	const int t = o->orient & ORIENT_TRANSPOSE;
+	const int ow = t ? h : w, oh = t ? w : h;
+	const struct bayer_format *obf;
+	struct conv_output plain = *o;
+	unsigned char *raw, *line;
+	const char *msg;
+	char order[5];
+	int i, u, v, u0 = x, u0ofs = 0;
+
+	/* Colour of the oriented pixel (i & 1, i >> 1) */
+	for (i = 0; i < 4; i++) {
+		u = t ? i >> 1 : i & 1;
+		v = t ? i & 1 : i >> 1;
+		u = x + (o->orient & ORIENT_MIRROR_X ? w - 1 - u : u);
+		v = y + (o->orient & ORIENT_MIRROR_Y ? h - 1 - v : v);
+		order[i] = bf->order[(v & 1) * 2 + (u & 1)];
+	}
+	order[4] = 0;
+	for (obf = bayer_formats; obf->kernel; obf++)
+		if (obf->bits == bf->bits && !obf->packing && !strcmp(obf->order, order))
+			break;
+
+	if (bf->packing) {
+		u0 = bayer_unpack_from(bf->packing, x);
+		u0ofs = bayer_unpack_offset(bf->packing, u0);
+	}
+	raw = malloc(w * h * bpp * 2 + (x + w - u0) * bpp);
+	if (!raw)
+		return "out of memory";
+	line = raw + w * h * bpp * 2;
+
+	for (i = 0; i < h; i++) {
+		const unsigned char *r = s + (y + i) * stride;
+		if (bf->packing) {
+			bf->packing->unpack[(y + i) & 1](r + u0ofs, stride, line, x + w - u0);
+			r = line + (x - u0) * bpp;
+		} else {
+			r += x * bpp;
+		}
+		memcpy(raw + i * w * bpp, r, w * bpp);
+	}
+	orient_image(raw, w, h, bpp, o->orient, raw + w * h * bpp);
+
+	plain.orient = 0;
+	msg = bayer_convert(obf, raw + w * h * bpp, ow, ow * bpp, 0, 0, ow, oh, &plain, d);
+	free(raw);
+	return msg;
+}
+
+/* Convert one row of NV12/NV21/NV24/NV42 image into RGB */
+static inline __attribute__((always_inline)) void
+nv_row_body(const int cpu, const unsigned char *s, const unsigned char *u, unsigned char *d,
+	    int width, int subsample, int chromaord)
+{
+	int x;
+
+	/* Indexed, not stepped, to let the loop vectorize */
+	if (subsample == 1) {
+		for (x = 0; x < width; x++)
+			yuv_to_rgb(d + x * 3, s[x], u[x * 2 + chromaord], u[x * 2 + (chromaord ^ 1)]);
+		return;
+	}
+
+	for (x = 0; x < width; x++) {
+		yuv_to_rgb(d, s[x], u[chromaord], u[chromaord ^ 1]);
+		d += 3;
+		if (x & 1)
+			u += 2;
+	}
+}
+
+CPU_KERNEL(nv_row, (const unsigned char *s, const unsigned char *u, unsigned char *d,
+		    int width, int subsample, int chromaord),
+	   s, u, d, width, subsample, chromaord)
+
+#define YYUV420_V32_VEC_SIZE	((64 + 2*32 + 64) * 2)	/* In bytes */
+
+/*
+ * Decode two rows of vectorized NV12 image into two luma rows and one
+ * interleaved chroma row. Each vector contains 64 pixels from both rows,
+ * 16 bits per sample: 64 luma samples, 32 U and 32 V samples, 64 luma samples.
+ */
+static void yyuv420_v32_rows(const unsigned char *s, unsigned char *l0, unsigned char *l1,
+			     unsigned char *uv, int width)
+{
+	static const int LUMA_SHIFT = 8;			/* In theory 8, 7 gives brighter image */
+	static const int CHROMA_SHIFT = 6;			/* Should be verified */
+	const uint16_t *s0 = (const uint16_t *)s;
+	int x, x0, c, p;
+
+	for (x = 0; x < width; x += 64) {
+		for (x0 = 0; x0 < MIN(64, width - x); x0++) {
+			int x1 = x0 & 31;
+			int y1 = (x0 & 32) >> 5;
+			p = s0[y1 * 128 + x1] >> LUMA_SHIFT;
+			l0[x + x0] = CLAMPB(p);
+			p = s0[y1 * 128 + (x1 | 32)] >> LUMA_SHIFT;
+			l1[x + x0] = CLAMPB(p);
+		}
+		for (x0 = 0; x0 < 32 && x + x0 * 2 < width; x0++)
+			for (c = 0; c < 2; c++) {
+				p = (int16_t)s0[64 + x0 + 32 * c];
+				uv[x + x0 * 2 + c] = CLAMPB((p >> CHROMA_SHIFT) + 128);
+			}
+		s0 += YYUV420_V32_VEC_SIZE / 2;
+	}
+}
+
+/*
+ * Downscale YUV, grey, or RGB image by averaging each component over
+ * blocks of scale x scale pixels before converting it into RGB or grey,
+ * so that only the downscaled image goes through colour conversion.
+ * Subsampled chroma is averaged over the samples covering the block, which
+ * therefore must start from even column, and even row for 4:2:0 images,
+ * as checked by conv_convert(). Return NULL or error message.
+ */
+static const char *area_convert(const unsigned char *s, int width, int height, int stride,
+			 int x0, int y0, int w, int h,
+			 __u32 format, const struct conv_output *o, unsigned char *d)
+{
+	const int k = o->scale;
+	const int ow = w / k;
+	const int bps = CONV_OUTPUT_BPS(o);
+	const unsigned char *r, *c = s + height * stride;
+	unsigned char *l = NULL;
+	const char *msg = NULL;
+	uint32_t *acc;
+	unsigned int n[3];		/* Samples in a block for each component */
+	unsigned int v[3];
+	int lumaofs, chromaord;
+	int xofs = x0;			/* Offset of the region on a row */
+	int x, y, i, j;
+
+	acc = malloc(ow * 3 * sizeof(*acc));
+	if (format == V4L2_PIX_FMT_YYUV420_V32)
+		l = malloc(width * 3);
+	if (!acc || (format == V4L2_PIX_FMT_YYUV420_V32 && !l)) {
+		free(acc);
+		free(l);
+		return "out of memory";
+	}
+	n[0] = n[1] = n[2] = k * k;
+	chromaord = (format == V4L2_PIX_FMT_YUYV || format == V4L2_PIX_FMT_UYVY ||
+		     format == V4L2_PIX_FMT_NV12 || format == V4L2_PIX_FMT_NV24) ? 0 : 1;
+	lumaofs = (format == V4L2_PIX_FMT_YUYV || format == V4L2_PIX_FMT_YVYU) ? 0 : 1;
+	switch (format) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_VYUY:
+		n[1] = n[2] = k * k / 2;
+		xofs = x0 * 2;
+		break;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_YYUV420_V32:
+		n[1] = n[2] = k * k / 4;
+		break;
+	case V4L2_PIX_FMT_Y16:
+		xofs = x0 * 2;
+		break;
+	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_RGB24:
+		xofs = x0 * 3;
+		break;
+	}
+
+	for (y = 0; y < h / k; y++) {
+		memset(acc, 0, ow * 3 * sizeof(*acc));
+		for (i = y0 + y * k; i < y0 + (y + 1) * k; i++) {
+			r = s + i * stride + xofs;
+			switch (format) {
+			case V4L2_PIX_FMT_YUYV:
+			case V4L2_PIX_FMT_UYVY:
+			case V4L2_PIX_FMT_YVYU:
+			case V4L2_PIX_FMT_VYUY:
+				area_add(acc, r + lumaofs, 2, ow, k, 1);
+				area_add(acc + ow, r + (lumaofs ^ 1) + chromaord * 2, 4, ow, k / 2, 1);
+				area_add(acc + ow * 2, r + (lumaofs ^ 1) + (chromaord ^ 1) * 2, 4, ow, k / 2, 1);
+				break;
+			case V4L2_PIX_FMT_NV12:
+			case V4L2_PIX_FMT_NV21:
+				area_add(acc, r, 1, ow, k, 1);
+				if (i & 1)
+					break;
+				r = c + i / 2 * stride + x0;
+				area_add(acc + ow, r + chromaord, 2, ow, k / 2, 1);
+				area_add(acc + ow * 2, r + (chromaord ^ 1), 2, ow, k / 2, 1);
+				break;
+			case V4L2_PIX_FMT_NV24:
+			case V4L2_PIX_FMT_NV42:
+				area_add(acc, r, 1, ow, k, 1);
+				r = c + i * 2 * stride + x0 * 2;
+				area_add(acc + ow, r + chromaord, 2, ow, k, 1);
+				area_add(acc + ow * 2, r + (chromaord ^ 1), 2, ow, k, 1);
+				break;
+			case V4L2_PIX_FMT_YYUV420_V32:
+				/* Stride covers two rows */
+				if (i & 1) {
+					area_add(acc, l + width + x0, 1, ow, k, 1);
+					break;
+				}
+				yyuv420_v32_rows(s + i / 2 * stride, l, l + width, l + width * 2, width);
+				area_add(acc, l + x0, 1, ow, k, 1);
+				area_add(acc + ow, l + width * 2 + x0, 2, ow, k / 2, 1);
+				area_add(acc + ow * 2, l + width * 2 + x0 + 1, 2, ow, k / 2, 1);
+				break;
+			case V4L2_PIX_FMT_GREY:
+				area_add(acc, r, 1, ow, k, 1);
+				break;
+			case V4L2_PIX_FMT_Y16:
+				area_add(acc, r, 2, ow, k, 2);
+				break;
+			case V4L2_PIX_FMT_BGR24:
+			case V4L2_PIX_FMT_RGB24:
+				j = format == V4L2_PIX_FMT_RGB24 ? 0 : 2;
+				area_add(acc, r + j, 3, ow, k, 1);
+				area_add(acc + ow, r + 1, 3, ow, k, 1);
+				area_add(acc + ow * 2, r + (j ^ 2), 3, ow, k, 1);
+				break;
+			}
+		}
+
+		for (x = 0; x < ow; x++) {
+			for (j = 0; j < 3; j++)
+				v[j] = (acc[ow * j + x] + n[j] / 2) / n[j];
+			switch (format) {
+			case V4L2_PIX_FMT_GREY:
+			case V4L2_PIX_FMT_Y16:
+				if (bps == 2) {
+					d[0] = v[0] >> 8;
+					d[1] = v[0];
+				} else {
+					if (format == V4L2_PIX_FMT_Y16) {
+						if (v[0] > 1023) {
+							msg = "Y16 image not in range 0..1023";
+							goto out;
+						}
+						v[0] >>= 2;
+					}
+					d[0] = v[0];
+				}
+				if (o->channels == 3) {
+					memcpy(d + bps, d, bps);
+					memcpy(d + bps * 2, d, bps);
+				}
+				break;
+			case V4L2_PIX_FMT_BGR24:
+			case V4L2_PIX_FMT_RGB24:
+				d[0] = v[0];
+				d[1] = v[1];
+				d[2] = v[2];
+				break;
+			default:
+				if (o->channels == 1)
+					d[0] = v[0];
+				else
+					yuv_to_rgb(d, v[0], v[1], v[2]);
+				break;
+			}
+			d += o->channels * bps;
+		}
+	}
+
+out:
+	free(l);
+	free(acc);
+	return msg;
+}
+
+int conv_frame_size(__u32 format, int width, int height, int *stride)
+{
+	const struct bayer_format *bf;
+
+	switch (format) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_VYUY:
+		if (*stride <= 0) *stride = width * 2;
+		return *stride * height;
+
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+		if (*stride <= 0) *stride = width;
+		return *stride * height * 3/2;
+
+	case V4L2_PIX_FMT_NV24:
+	case V4L2_PIX_FMT_NV42:
+		if (*stride <= 0) *stride = width;
+		return *stride * height * 3;
+
+	case V4L2_PIX_FMT_YYUV420_V32:
+		/* Stride on the input buffer is meaningless, so overwrite it */
+		*stride = DIV_ROUND_UP(width, 64) * YYUV420_V32_VEC_SIZE;
+		return *stride * height / 2;
+
+	case V4L2_PIX_FMT_GREY:
+		if (*stride <= 0) *stride = width;
+		return *stride * height;
+
+	case V4L2_PIX_FMT_Y16:
+		if (*stride <= 0) *stride = width * 2;
+		return *stride * height;
+
+	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_RGB24:
+		if (*stride <= 0) *stride = width * 3;
+		return *stride * height;
+	}
+
+	bf = bayer_format_get(format);
+	if (!bf)
+		return -1;
+	if (*stride <= 0) *stride = bayer_row_bytes(bf, width);
+	return *stride * height;
+}
+
+/* Return the number of significant bits per pixel of the format */
+static int format_bits(__u32 format)
+{
+	const struct bayer_format *bf = bayer_format_get(format);
+
+	if (bf)
+		return bf->bits;
+	if (format == V4L2_PIX_FMT_Y16)
+		return 16;
+	return 8;
+}
+
+int conv_output_init(struct conv_output *o, __u32 format, int type, int depth, int scale)
+{
+	memset(o, 0, sizeof(*o));
+	o->channels = type == CONV_TYPE_PGM ||
+		      (type != CONV_TYPE_PPM && type != CONV_TYPE_RGB &&
+		       (format == V4L2_PIX_FMT_GREY || format == V4L2_PIX_FMT_Y16)) ? 1 : 3;
+	o->maxval = depth > 8 ? (1 << format_bits(format)) - 1 : 255;
+	o->scale = scale;
+	if (type == CONV_TYPE_Y4M && CONV_OUTPUT_BPS(o) != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+int conv_output_size(const struct conv_output *o, int width, int height,
+		     int *out_width, int *out_height)
+{
+	int w = (o->width ? o->width : width) / o->scale;
+	int h = (o->width ? o->height : height) / o->scale;
+
+	*out_width = o->orient & ORIENT_TRANSPOSE ? h : w;
+	*out_height = o->orient & ORIENT_TRANSPOSE ? w : h;
+	return w * h * o->channels * CONV_OUTPUT_BPS(o);
+}
+
+/*
+ * Convert the region of o from image s, which holds the whole frame, into
+ * d, return NULL or error message. The format and region are checked by
+ * conv_convert(), so that errors found here only need the buffers freed.
+ */
+static const char *convert_image(const unsigned char *s, int width, int height, int stride,
+				 __u32 format, const struct bayer_format *bf,
+				 const struct conv_output *o, unsigned char *d)
+{
+	const int dbpp = o->channels * CONV_OUTPUT_BPS(o);
+	const int cx = o->x, cy = o->y;
+	const int cw = o->width ? o->width : width;
+	const int ch = o->width ? o->height : height;
+	int y, x, i, bpp;
+	int lumaofs, chromaord, subsample;
+	unsigned char *row = NULL;	/* Whole row when converting only a part of it */
+	unsigned char *l = NULL;
+	const unsigned char *s1, *u;
+	unsigned char *d1;
+	unsigned int dstride = cw * dbpp;
+	const char *msg = NULL;
+
+	if (o->orient && !bf) {
+		struct conv_output plain = *o;
+		plain.orient = 0;
+		row = malloc(cw / o->scale * ch / o->scale * dbpp);
+		if (!row)
+			return "out of memory";
+		msg = convert_image(s, width, height, stride, format, bf, &plain, row);
+		if (!msg)
+			orient_image(row, cw / o->scale, ch / o->scale, dbpp, o->orient, d);
+		free(row);
+		return msg;
+	}
+	if (o->scale > 1 && !bf)
+		return area_convert(s, width, height, stride, cx, cy, cw, ch, format, o, d);
+	if (cw != width && !bf) {
+		row = malloc(width * dbpp);
+		if (!row)
+			return "out of memory";
+	}
+
+	switch (format) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_VYUY:
+		lumaofs = (format==V4L2_PIX_FMT_YUYV || format==V4L2_PIX_FMT_YVYU) ? 0 : 1;
+		chromaord = (format==V4L2_PIX_FMT_YUYV || format==V4L2_PIX_FMT_UYVY) ? 0 : 1;
+		for (y = cy; y < cy + ch; y++) {
+			int cb = 0, cr = 0;
+			s1 = s + y * stride;
+			d1 = row ? row : d;
+			for (x = 0; x < width && o->channels == 1; x++)
+				d1[x] = s1[x * 2 + lumaofs];
+			for (x = 0; x < width && o->channels == 3; x++) {
+				int b = s1[lumaofs];
+				if ((x & 1) == chromaord)
+					cb = s1[lumaofs^1];
+				else
+					cr = s1[lumaofs^1];
+				yuv_to_rgb(d1, b, cb, cr);
+				s1 += 2;
+				d1 += dbpp;
+			}
+			if (row)
+				memcpy(d, row + cx * dbpp, dstride);
+			d += dstride;
+		}
+		break;
+
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_NV24:
+	case V4L2_PIX_FMT_NV42:
+		subsample = (format == V4L2_PIX_FMT_NV12 ||
+			     format == V4L2_PIX_FMT_NV21) ? 2 : 1;
+		chromaord = (format == V4L2_PIX_FMT_NV12 ||
+			     format == V4L2_PIX_FMT_NV24) ? 0 : 1;
+		for (y = cy; y < cy + ch; y++) {
+			s1 = s + y * stride;
+			u = &s[height * stride] + y / subsample * 2 * stride / subsample;
+			if (o->channels == 1) {
+				memcpy(d, s1 + cx, cw);
+			} else {
+				nv_row(s1, u, row ? row : d, width, subsample, chromaord);
+				if (row)
+					memcpy(d, row + cx * dbpp, dstride);
+			}
+			d += dstride;
+		}
+		break;
+
+	case V4L2_PIX_FMT_YYUV420_V32:
+		l = malloc(width * 3);
+		if (!l) {
+			msg = "out of memory";
+			break;
+		}
+
+		for (y = cy & ~1; y < cy + ch; y += 2) {
+			yyuv420_v32_rows(s + y / 2 * stride, l, l + width, l + width * 2, width);
+			for (i = 0; i < 2; i++) {
+				if (y + i < cy || y + i >= cy + ch)
+					continue;
+				d1 = d + (y + i - cy) * dstride;
+				if (o->channels == 1) {
+					memcpy(d1, l + width * i + cx, cw);
+				} else {
+					nv_row(l + width * i, l + width * 2, row ? row : d1, width, 2, 0);
+					if (row)
+						memcpy(d1, row + cx * dbpp, dstride);
+				}
+			}
+		}
+		break;
+
+	case V4L2_PIX_FMT_GREY:
+	case V4L2_PIX_FMT_Y16:
+		bpp = (format == V4L2_PIX_FMT_Y16) ? 2 : 1;
+		for (y = cy; y < cy + ch; y++) {
+			s1 = s + y * stride + cx * bpp;
+			d1 = d;
+			if (CONV_OUTPUT_BPS(o) == 2 && o->channels == 1) {
+				swap16(d, s1, cw);
+				d += dstride;
+				continue;
+			}
+			for (x = 0; x < cw; x++) {
+				int b = s1[0];
+				if (CONV_OUTPUT_BPS(o) == 2) {
+					d1[0] = d1[2] = d1[4] = s1[1];
+					d1[1] = d1[3] = d1[5] = s1[0];
+					s1 += bpp;
+					d1 += dbpp;
+					continue;
+				}
+				if (bpp == 2) {
+					b |= s1[1] << 8;
+					if (b > 1023) {
+						msg = "Y16 image not in range 0..1023";
+						goto out;
+					}
+					b >>= 2;
+				}
+				d1[0] = b;
+				if (o->channels == 3) {
+					d1[1] = b;
+					d1[2] = b;
+				}
+				s1 += bpp;
+				d1 += dbpp;
+			}
+			d += dstride;
+		}
+		break;
+
+	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_RGB24:
+		bpp = 3;
+		for (y = cy; y < cy + ch; y++) {
+			s1 = s + y * stride + cx * bpp;
+			d1 = d;
+			for (x = 0; x < cw; x++) {
+				if (format == V4L2_PIX_FMT_RGB24) {
+					d1[0] = s1[0];
+					d1[2] = s1[2];
+				} else {
+					d1[0] = s1[2];
+					d1[2] = s1[0];
+				}
+				d1[1] = s1[1];
+				s1 += bpp;
+				d1 += dbpp;
+			}
+			d += dstride;
+		}
+		break;
+
+	default:
+		if (o->orient)
+			msg = bayer_convert_oriented(bf, s, stride, cx, cy, cw, ch, o, d);
+		else
+			msg = bayer_convert(bf, s, width, stride, cx, cy, cw, ch, o, d);
+		break;
+	}
+
+out:
+	free(l);
+	free(row);
+	return msg;
+}
+
+/*
+ * Only the rows of the input in the region, and for raw Bayer images
+ * the rows and columns around them, are read. All checks that do not
+ * depend on the pixels are done before any buffer is allocated.
+ */
+int conv_convert(void *in_buffer, int in_size, int width, int height, int stride, __u32 format,
+		 const struct conv_output *o, void *out_buffer)
+{
+	const struct bayer_format *bf;
+	const int cx = o->x, cy = o->y;
+	const int cw = o->width ? o->width : width;
+	const int ch = o->width ? o->height : height;
+	unsigned char *src = NULL;
+	const char *msg;
+	int size;
+
+	size = conv_frame_size(format, width, height, &stride);
+	if (size < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	bf = bayer_format_get(format);
+	if (cx < 0 || cy < 0 || cw <= 0 || ch <= 0 || cx + cw > width || cy + ch > height)
+		error("region %i,%i,%i,%i outside of image", cx, cy, cw, ch);
+	if (o->scale > 1 && (cw < o->scale || ch < o->scale))
+		error("image smaller than scale factor");
+
+	switch (format) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_VYUY:
+		if (o->scale > 1 && (cx & 1))
+			error("region must start from even column");
+		break;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+		if (o->scale > 1 && ((cx | cy) & 1))
+			error("region must start from even column and row");
+		break;
+	case V4L2_PIX_FMT_YYUV420_V32:
+		if (width & 63) warning("width would be better to be multiple of 64");
+		if (height & 1) error("height must be multiple of 2");
+		if (o->scale > 1 && ((cx | cy) & 1))
+			error("region must start from even column and row");
+		break;
+	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_RGB24:
+		if (o->channels != 3) error("format has only RGB output");
+		break;
+	}
+	if (bf && bf->packing && stride < bayer_row_bytes(bf, width))
+		error("stride too small for packed format");
+	if (bf && bf->packing && height % bf->packing->rows)
+		error("height must be multiple of %i", bf->packing->rows);
+
+	msg = convert_image(get_input(in_buffer, in_size, size, &src), width, height, stride,
+			    format, bf, o, out_buffer);
+	free(src);
+	if (msg)
+		error("%s", msg);
+	return 0;
+}
+
+int conv_header(char *b, int size, int type, const struct conv_output *o,
+		int out_width, int out_height)
+{
+	int r;
+
+	switch (type) {
+	case CONV_TYPE_PAM:
+		r = snprintf(b, size, "P7\nWIDTH %i\nHEIGHT %i\nDEPTH %i\nMAXVAL %i\nTUPLTYPE %s\nENDHDR\n",
+			     out_width, out_height, o->channels, o->maxval,
+			     o->channels == 1 ? "GRAYSCALE" : "RGB");
+		break;
+	case CONV_TYPE_Y4M:
+		r = snprintf(b, size, "YUV4MPEG2 W%i H%i F30:1 Ip A1:1 %s\n",
+			     out_width, out_height, o->channels == 1 ? "Cmono" : "C444");
+		break;
+	case CONV_TYPE_RGB:
+		r = snprintf(b, size, "%s", "");
+		break;
+	default:
+		r = snprintf(b, size, "P%i\n%i %i %i\n", o->channels == 1 ? 5 : 6,
+			     out_width, out_height, o->maxval);
+		break;
+	}
+	return r < size ? r : -1;
+}
+
+/* From https://msdn.microsoft.com/en-us/library/aa917087.aspx */
+#define RGB2Y(R,G,B)	(((  66 * (R) + 129 * (G) +  25 * (B) + 128) >> 8) +  16)
+#define RGB2U(R,G,B)	((( -38 * (R) -  74 * (G) + 112 * (B) + 128) >> 8) + 128)
+#define RGB2V(R,G,B)	((( 112 * (R) -  94 * (G) -  18 * (B) + 128) >> 8) + 128)
+
+void conv_rgb_to_yuv444(const unsigned char *rgb, unsigned char *yuv, int pixels)
+{
+	unsigned char *u = yuv + pixels;
+	unsigned char *v = yuv + pixels * 2;
+	int i;
+
+	for (i = 0; i < pixels; i++) {
+		yuv[i] = RGB2Y(rgb[0], rgb[1], rgb[2]);
+		u[i] = RGB2U(rgb[0], rgb[1], rgb[2]);
+		v[i] = RGB2V(rgb[0], rgb[1], rgb[2]);
+		rgb += 3;
+	}
+}
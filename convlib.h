@@ -0,0 +1,99 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef CONVLIB_H
+#define CONVLIB_H
+
+#include <linux/types.h>
+
+/*
+ * Conversion of raw, YUV, and RGB V4L2 pixel formats into RGB or grey
+ * images as used by raw2pnm and v4l2n. The functions may be called from
+ * several threads at once, each converting its own frame.
+ */
+
+/*
+ * Output image layout. Each sample takes one byte if maxval is
+ * at most 255, otherwise two bytes, MSB first as in PNM files.
+ */
+struct conv_output {
+	int channels;			/* 3 for RGB, 1 for grey or raw Bayer */
+	int maxval;
+	int scale;			/* Downscaling factor, 1 or even */
+	int x, y;			/* Region of the input image to convert, */
+	int width, height;		/* zero width for the whole image */
+	int orient;			/* ORIENT_* flags */
+	int threads;			/* Threads used for one frame, 0 for one */
+};
+
+#define CONV_OUTPUT_BPS(o)	((o)->maxval > 255 ? 2 : 1)	/* Bytes per sample */
+#define CONV_MAX_SCALE		64
+#define CONV_MAX_THREADS	64
+
+/* Output file types, y4m and rgb are streams of all frames in one file */
+enum { CONV_TYPE_PPM, CONV_TYPE_PGM, CONV_TYPE_PAM, CONV_TYPE_Y4M, CONV_TYPE_RGB };
+#define CONV_TYPE_STREAM(t)	((t) == CONV_TYPE_Y4M || (t) == CONV_TYPE_RGB)
+#define CONV_Y4M_FRAME		"FRAME\n"	/* Header of each y4m frame */
+
+/*
+ * Set the functions called on errors and warnings with the message.
+ * The program exits if the error function returns, so to go on after
+ * an error it must not return, e.g. it can longjmp. By default the
+ * messages are printed.
+ */
+void conv_set_handlers(void (*error)(const char *msg), void (*warning)(const char *msg));
+
+/* Return output type for file type name or extension, -1 if unknown */
+int conv_type(const char *name);
+const char *conv_type_name(int type);
+
+/*
+ * Return the size of a frame in bytes and set stride to the default value
+ * if it is not given. Return -1 if the format is not supported.
+ */
+int conv_frame_size(__u32 format, int width, int height, int *stride);
+
+/*
+ * Set up output layout of the file type for the format: depth is 8 to
+ * scale samples to 8 bits or 16 to keep the full precision, and the
+ * image is downscaled by the scale factor. Grey formats have only one
+ * channel, except in PPM and RGB files. Return -1 if the type can not
+ * hold the samples.
+ */
+int conv_output_init(struct conv_output *o, __u32 format, int type, int depth, int scale);
+
+/* Return size of the output image in bytes and its width and height */
+int conv_output_size(const struct conv_output *o, int width, int height,
+		     int *out_width, int *out_height);
+
+/*
+ * Return RGB or grey image as described by o, region width / scale x
+ * height / scale pixels, or -1 if the format is not supported.
+ */
+int conv_convert(void *in_buffer, int in_size, int width, int height, int stride, __u32 format,
+		 const struct conv_output *o, void *out_buffer);
+
+/*
+ * Format the header of a file, or of a stream for y4m and rgb, into b.
+ * Return its length, or -1 if it does not fit.
+ */
+int conv_header(char *b, int size, int type, const struct conv_output *o,
+		int out_width, int out_height);
+
+/* Convert 8-bit RGB pixels into planar YUV 4:4:4 */
+void conv_rgb_to_yuv444(const unsigned char *rgb, unsigned char *yuv, int pixels);
+
+#endif
@@ -0,0 +1,1196 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Differential test of the conversion kernels. The original scalar code
+ * of raw2pnm, pnm2yuv, pnm2raw, pnm2txt, txt2raw, and yuv2yuv is kept
+ * here as reference, and frames of random size, stride, and pixel values
+ * are run through it and through the kernels of convlib, rawlib, yuvlib,
+ * and utillib with their threaded, cropped, and oriented variants. The
+ * first differing pixel is reported with the seed to repeat the run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "linux/videodev2.h"
+
+#include "extradefs.h"
+#include "utillib.h"
+#include "convlib.h"
+#include "rawlib.h"
+#include "yuvlib.h"
+#include "cpulib.h"
+
+#define SIZE(x)		(sizeof(x)/sizeof((x)[0]))
+#define MIN(a,b)	((a) <= (b) ? (a) : (b))
+#define CLAMP(a,lo,hi)	((a) < (lo) ? (lo) : (a) > (hi) ? (hi) : (a))
+#define CLAMPB(a)	CLAMP(a, 0, 255)
+
+static unsigned int seed;
+static int verbose;
+static char test_case[256];	/* Description of the case being run */
+
+static void error(char *msg, ...)
+{
+	va_list ap;
+
+	va_start(ap, msg);
+	fprintf(stderr, "convtest: ");
+	vfprintf(stderr, msg, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	exit(1);
+}
+
+static void *xmalloc(long size)
+{
+	void *p = malloc(size ? size : 1);
+
+	if (!p) error("out of memory");
+	return p;
+}
+
+static void set_case(char *msg, ...)
+{
+	va_list ap;
+
+	va_start(ap, msg);
+	vsnprintf(test_case, sizeof(test_case), msg, ap);
+	va_end(ap);
+	if (verbose)
+		printf("%s\n", test_case);
+}
+
+static void mismatch(const char *what, int x, int y, int c, int got, int expected)
+{
+	fprintf(stderr, "convtest: %s: %s (%i,%i) channel %i is %i, expected %i\n",
+		test_case, what, x, y, c, got, expected);
+	error("run with -s %u to repeat", seed);
+}
+
+/* Compare images of width x height pixels of bpp bytes, report the first difference */
+static void compare(const char *what, const unsigned char *got, const unsigned char *expected,
+		    int width, int height, int bpp)
+{
+	long i, n = (long)width * height * bpp;
+
+	for (i = 0; i < n; i++)
+		if (got[i] != expected[i])
+			mismatch(what, i / bpp % width, i / bpp / width, i % bpp,
+				 got[i], expected[i]);
+}
+
+/* Pseudo-random numbers from the seed */
+static unsigned int rnd_state;
+
+static unsigned int rnd32(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+/* Return 0..n-1 */
+static int rnd(int n)
+{
+	return rnd32() % n;
+}
+
+/* Return 1..n, more often small than uniform to hit the edge cases */
+static int rnd_size(int n)
+{
+	return 1 + rnd(rnd(4) ? n : 4);
+}
+
+static void fill_random(unsigned char *p, long n)
+{
+	long i;
+
+	for (i = 0; i < n; i++)
+		p[i] = rnd32() >> 24;
+}
+
+#define FMT(id)		{ V4L2_PIX_FMT_##id, #id }
+#define BAYER(id, bits, unpacked, ref) \
+	{ V4L2_PIX_FMT_SBGGR##id, "SBGGR" #id, bits, "bggr", V4L2_PIX_FMT_SBGGR##unpacked, ref }, \
+	{ V4L2_PIX_FMT_SGBRG##id, "SGBRG" #id, bits, "gbrg", V4L2_PIX_FMT_SGBRG##unpacked, ref }, \
+	{ V4L2_PIX_FMT_SGRBG##id, "SGRBG" #id, bits, "grbg", V4L2_PIX_FMT_SGRBG##unpacked, ref }, \
+	{ V4L2_PIX_FMT_SRGGB##id, "SRGGB" #id, bits, "rggb", V4L2_PIX_FMT_SRGGB##unpacked, ref }
+static const struct format {
+	__u32 format;
+	const char *name;
+	int bits;			/* Bits per raw Bayer pixel */
+	const char *order;		/* Colours of the first two rows, NULL if not Bayer */
+	__u32 unpacked;			/* Same pixels in one or two bytes LSB first */
+	int reference;			/* Packing has a scalar reference */
+} formats[] = {
+	FMT(YUYV), FMT(UYVY), FMT(YVYU), FMT(VYUY),
+	FMT(NV12), FMT(NV21), FMT(NV24), FMT(NV42), FMT(YYUV420_V32),
+	FMT(GREY), FMT(Y16), FMT(RGB24), FMT(BGR24),
+	BAYER(8, 8, 8, 1), BAYER(10, 10, 10, 1), BAYER(12, 12, 12, 1),
+	BAYER(14, 14, 14, 1), BAYER(16, 16, 16, 1),
+	BAYER(10P, 10, 10, 1), BAYER(12P, 12, 12, 1), BAYER(14P, 14, 14, 1),
+	BAYER(10V32, 10, 10, 1), BAYER(12V32, 12, 12, 1),
+	BAYER(10ALAW8, 10, 10, 0), BAYER(10DPCM8, 10, 10, 0),
+};
+
+static const struct format *format_get(__u32 format)
+{
+	int i;
+
+	for (i = 0; i < SIZE(formats); i++)
+		if (formats[i].format == format)
+			return &formats[i];
+	return NULL;
+}
+
+static int is_v32(const struct format *f)
+{
+	return strstr(f->name, "V32") != NULL;
+}
+
+/* Scalar orientation as defined in utillib.h */
+static void ref_orient(const unsigned char *s, int width, int height, int bpp, int orient,
+		       unsigned char *d)
+{
+	const int t = orient & ORIENT_TRANSPOSE;
+	const int ow = t ? height : width, oh = t ? width : height;
+	int x, y, u, v;
+
+	for (y = 0; y < oh; y++) {
+		for (x = 0; x < ow; x++) {
+			u = t ? y : x;
+			v = t ? x : y;
+			if (orient & ORIENT_MIRROR_X) u = width - 1 - u;
+			if (orient & ORIENT_MIRROR_Y) v = height - 1 - v;
+			memcpy(d + ((long)y * ow + x) * bpp, s + ((long)v * width + u) * bpp, bpp);
+		}
+	}
+}
+
+/* Crop region x, y, w, h of image of width pixels of bpp bytes */
+static void crop(const unsigned char *s, int width, int bpp, int x, int y, int w, int h,
+		 unsigned char *d)
+{
+	int i;
+
+	for (i = 0; i < h; i++)
+		memcpy(d + (long)i * w * bpp, s + ((long)(y + i) * width + x) * bpp, w * bpp);
+}
+
+/* Reference implementations, from the original code of the tools */
+
+static inline void write_pixel(unsigned char *p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+/*
+ * uncompress_mipi() of txt2raw extended from RAW10 to RAW12 and RAW14:
+ * the 8 most significant bits of a group of pixels are in consecutive
+ * bytes followed by the remaining bits, first pixel in the lowest bits.
+ * The last group is cut to the bytes of its pixels if tight.
+ */
+static void ref_uncompress_mipi(int bits, const unsigned char *sa, int width, int tight,
+				unsigned char *da)
+{
+	const int n = bits == 12 ? 2 : 4;	/* Pixels per group */
+	const int lsbs = bits - 8;
+	int x, i, b, m, bit;
+
+	for (x = 0; x < width; x += n) {
+		m = tight ? MIN(n, width - x) : n;
+		for (i = 0; i < n && x + i < width; i++) {
+			unsigned int v = sa[i] << lsbs;
+			for (b = 0, bit = i * lsbs; b < lsbs; b++, bit++)
+				v |= ((sa[m + bit / 8] >> (bit % 8)) & 1) << b;
+			write_pixel(da, v);
+			da += 2;
+		}
+		sa += m + (m * lsbs + 7) / 8;
+	}
+}
+
+/* raw2mipi() of pnm2txt extended to RAW12 and RAW14, last group tight */
+static void ref_raw2mipi(int bits, const unsigned short *raw, int width, unsigned char *dst)
+{
+	const int n = bits == 12 ? 2 : 4;
+	const int lsbs = bits - 8;
+	int x, i, b, m, bit;
+
+	for (x = 0; x < width; x += n) {
+		m = MIN(n, width - x);
+		memset(dst + m, 0, (m * lsbs + 7) / 8);
+		for (i = 0; i < m; i++) {
+			unsigned int v = raw[x + i];
+			dst[i] = v >> lsbs;
+			for (b = 0, bit = i * lsbs; b < lsbs; b++, bit++)
+				dst[m + bit / 8] |= ((v >> b) & 1) << (bit % 8);
+		}
+		dst += m + (m * lsbs + 7) / 8;
+	}
+}
+
+/*
+ * Unpack V32 or MIPI packed Bayer image into two bytes per pixel as the
+ * V32 case of convert() in raw2pnm and uncompress_mipi() in txt2raw
+ */
+static unsigned char *ref_unpack(const struct format *f, const unsigned char *s,
+				 int width, int height, int stride)
+{
+	const int dstride = width * 2;
+	unsigned char *dst = xmalloc((long)dstride * height);
+	unsigned char *d = dst;
+	int y, x, b;
+
+	if (!is_v32(f)) {
+		for (y = 0; y < height; y++)
+			ref_uncompress_mipi(f->bits, s + (long)y * stride, width, 0,
+					    d + (long)y * dstride);
+		return dst;
+	}
+
+	for (y = 0; y < height; y += 2) {
+		unsigned char *d0 = d;
+		const unsigned char *s0 = s;
+		for (x = 0; x < width; x += 64) {
+			for (b = 0; b < 32; b++) {
+				if (x + b*2 >= width) break;
+				d0[b*4+0] = s0[b*2+0];			// Gr
+				d0[b*4+1] = s0[b*2+1];
+				d0[b*4+2] = s0[b*2+64];			// R
+				d0[b*4+3] = s0[b*2+65];
+				d0[dstride+b*4+0] = s0[b*2+128];	// B
+				d0[dstride+b*4+1] = s0[b*2+129];
+				d0[dstride+b*4+2] = s0[b*2+192];	// Gb
+				d0[dstride+b*4+3] = s0[b*2+193];
+			}
+			s0 += 4 * 32 * 2;
+			d0 += 64 * 2;
+		}
+		d += 2 * dstride;
+		s += 2 * stride;
+	}
+	return dst;
+}
+
+static void inline yuv_to_rgb(unsigned char rgb[3], int y, int cb, int cr)
+{
+	static const int R = 0;
+	static const int G = 1;
+	static const int B = 2;
+	int u = cb;
+	int v = cr;
+	/* http://en.wikipedia.org/wiki/YUV
+	 * conversion from Y'UV to RGB (NTSC version): */
+	int c = y - 16;
+	int d = u - 128;
+	int e = v - 128;
+	rgb[R] = CLAMPB((298*c + 409*e + 128) >> 8);
+	rgb[G] = CLAMPB((298*c - 100*d - 208*e + 128) >> 8);
+	rgb[B] = CLAMPB((298*c + 516*d + 128) >> 8);
+}
+
+static inline unsigned int get_word(const unsigned char *src, int bpp)
+{
+	unsigned int lo = src[0];
+	if (bpp == 1)
+		return lo;
+	return ((unsigned int)src[1] << 8) | lo;
+}
+
+/*
+ * convert() of raw2pnm: return 24 bits-per-pixel RGB image. The input
+ * buffer must hold the whole frame, it is not copied and zero-padded.
+ * Bayer formats are taken from the table instead of chains of ifs, which
+ * adds the 16-bit orders other than SBGGR16, and packed ones are unpacked
+ * first.
+ */
+static int ref_convert(const unsigned char *in_buffer, int width, int height, int stride,
+		       __u32 format, unsigned char *out_buffer)
+{
+	static const int dbpp = 3;
+	const struct format *f = format_get(format);
+	int y, x, r, g, b, bpp, shift;
+	int oddrow, oddpix, initrow, initpix, lumaofs, chromaord, subsample;
+	unsigned char *dst = NULL;
+	const unsigned char *s, *u;
+	unsigned char *d = out_buffer;
+	unsigned int dstride = width * dbpp;
+
+	switch (format) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_VYUY:
+		if (stride <= 0) stride = width * 2;
+		s = in_buffer;
+		lumaofs = (format==V4L2_PIX_FMT_YUYV || format==V4L2_PIX_FMT_YVYU) ? 0 : 1;
+		chromaord = (format==V4L2_PIX_FMT_YUYV || format==V4L2_PIX_FMT_UYVY) ? 0 : 1;
+		for (y = 0; y < height; y++) {
+			const unsigned char *s1 = s;
+			unsigned char *d1 = d;
+			int cb = 0, cr = 0;
+			for (x = 0; x < width; x++) {
+				int b = s1[lumaofs];
+				if ((x & 1) == chromaord)
+					cb = s1[lumaofs^1];
+				else
+					cr = s1[lumaofs^1];
+				yuv_to_rgb(d1, b, cb, cr);
+				s1 += 2;
+				d1 += dbpp;
+			}
+			s += stride;
+			d += dstride;
+		}
+		break;
+
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_NV24:
+	case V4L2_PIX_FMT_NV42:
+		subsample = (format == V4L2_PIX_FMT_NV12 ||
+			     format == V4L2_PIX_FMT_NV21) ? 2 : 1;
+		chromaord = (format == V4L2_PIX_FMT_NV12 ||
+			     format == V4L2_PIX_FMT_NV24) ? 0 : 1;
+		if (stride <= 0) stride = width;
+		s = in_buffer;
+		u = &s[height * stride];
+		for (y = 0; y < height; y++) {
+			const unsigned char *s1 = s;
+			const unsigned char *u1 = u;
+			unsigned char *d1 = d;
+			for (x = 0; x < width; x++) {
+				int b = *s1;
+				int cb = u1[chromaord];
+				int cr = u1[chromaord ^ 1];
+				yuv_to_rgb(d1, b, cb, cr);
+				s1 += 1;
+				d1 += dbpp;
+				if (subsample == 1 ||
+				   (subsample == 2 && (x & 1)))
+					u1 += 2;
+			}
+			s += stride;
+			if (subsample == 1 ||
+			   (subsample == 2 && (y & 1)))
+				u += 2 * stride / subsample;
+			d += dstride;
+		}
+		break;
+
+	case V4L2_PIX_FMT_YYUV420_V32: {
+		static const int VEC_SIZE = (64 + 2*32 + 64) * 2;	/* In bytes */
+		static const int LUMA_SHIFT = 8;			/* In theory 8, 7 gives brighter image */
+		static const int CHROMA_SHIFT = 6;			/* Should be verified */
+
+		if (height & 1) return -1;
+
+		stride = width;		/*	 Stride on the input buffer is meaningless, so overwrite it */
+		s = in_buffer;
+		d = dst = calloc(1, stride * height * 3/2);
+
+		for (y = 0; y < height; y += 2) {
+			for (x = 0; x < width; x += 64) {
+				int y0, x0, p, c;
+				/* Luma */
+				for (y0 = 0; y0 < 2; y0++) for (x0 = 0; x0 < 64; x0++) {
+					const uint16_t *s0 = (const uint16_t *)s;
+					int x1 = (x0 & 31) | (y0 << 5);
+					int y1 = (x0 & 32) >> 5;
+					p = s0[y1 * 128 + x1] >> LUMA_SHIFT;
+					d[(y+y0)*stride + x+x0] = CLAMPB(p);
+				}
+				/* Chroma */
+				for (x0 = 0; x0 < 32; x0++) for (c = 0; c < 2; c++) {
+					const int16_t *s0 = (const int16_t *)s;
+					p = s0[64 + x0 + 32 * c];
+					d[stride*height + stride*(y/2) + x + x0*2 + c] =
+							CLAMPB((p >> CHROMA_SHIFT) + 128);
+				}
+				s += VEC_SIZE;
+			}
+		}
+		r = ref_convert(dst, width, height, stride, V4L2_PIX_FMT_NV12, out_buffer);
+		free(dst);
+		return r;
+	}
+
+	case V4L2_PIX_FMT_GREY:
+	case V4L2_PIX_FMT_Y16:
+		bpp = (format == V4L2_PIX_FMT_Y16) ? 2 : 1;
+		if (stride <= 0) stride = width * bpp;
+		s = in_buffer;
+		for (y = 0; y < height; y++) {
+			const unsigned char *s1 = s;
+			unsigned char *d1 = d;
+			for (x = 0; x < width; x++) {
+				int b = s1[0];
+				if (bpp == 2) {
+					b |= s1[1] << 8;
+					if (b > 1023) return -1;
+					b >>= 2;
+				}
+				d1[0] = b;
+				d1[1] = b;
+				d1[2] = b;
+				s1 += bpp;
+				d1 += dbpp;
+			}
+			s += stride;
+			d += dstride;
+		}
+		break;
+
+	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_RGB24:
+		bpp = 3;
+		if (stride <= 0) stride = width * bpp;
+		s = in_buffer;
+		for (y = 0; y < height; y++) {
+			const unsigned char *s1 = s;
+			unsigned char *d1 = d;
+			for (x = 0; x < width; x++) {
+				if (format == V4L2_PIX_FMT_RGB24) {
+					d1[0] = s1[0];
+					d1[2] = s1[2];
+				} else {
+					d1[0] = s1[2];
+					d1[2] = s1[0];
+				}
+				d1[1] = s1[1];
+				s1 += bpp;
+				d1 += dbpp;
+			}
+			s += stride;
+			d += dstride;
+		}
+		break;
+
+	default:
+		if (!f || !f->order)
+			return -1;
+		if (f->unpacked != format) {
+			if (!f->reference || (is_v32(f) && ((width | height) & 1)))
+				return -1;
+			dst = ref_unpack(f, in_buffer, width, height, stride);
+			r = ref_convert(dst, width, height, width * 2, f->unpacked, out_buffer);
+			free(dst);
+			return r;
+		}
+
+		initrow = f->order[0] == 'b' || f->order[1] == 'b';
+		initpix = f->order[0] != (initrow ? 'b' : 'g');
+		bpp = f->bits > 8 ? 2 : 1;
+		shift = f->bits - 8;
+
+		if (stride <= 0) stride = width * bpp;
+		s = in_buffer;
+		r = g = b = 0;
+		oddrow = initrow;
+		for (y = 0; y < height; y++) {
+			const unsigned char *s1 = s;
+			unsigned char *d1 = d;
+			oddpix = initpix;
+			for (x = 0; x < width; x++) {
+				if (!oddrow) {
+					if (!oddpix) g = get_word(s1, bpp);
+					if ( oddpix) r = get_word(s1, bpp);
+					if (!oddpix && y > 0) b = get_word(s1 - stride, bpp);
+				} else {
+					if (!oddpix) b = get_word(s1, bpp);
+					if ( oddpix) g = get_word(s1, bpp);
+					if ( oddpix && y > 0) r = get_word(s1 - stride, bpp);
+				}
+				d1[0] = r >> shift;
+				d1[1] = g >> shift;
+				d1[2] = b >> shift;
+				s1 += bpp;
+				d1 += dbpp;
+				oddpix ^= 1;
+			}
+			s += stride;
+			d += dstride;
+			oddrow ^= 1;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+/* Samples of the image MSB first in 16 bits as returned by read_pnm() of the old utillib */
+static unsigned char *ref_read_pnm(const struct pnm_image *img)
+{
+	unsigned char *buf = xmalloc((long)img->width * img->height * 3 * 2);
+	unsigned char *p = buf;
+	int i, c;
+
+	for (i = 0; i < img->width * img->height; i++)
+		for (c = 0; c < 3; c++) {
+			unsigned int v = pnm_sample16(img, i, c);
+			*p++ = (v >> 8) & 0xff;
+			*p++ = v & 0xff;
+		}
+	return buf;
+}
+
+/* From https://msdn.microsoft.com/en-us/library/aa917087.aspx */
+/* Modified so that R, G, B are 16-bit pixel values 0..65535 */
+#define RGB2Y(R,G,B)	(((  66 * (R) + 129 * (G) +  25 * (B) + 32768) >> 16) +  16)
+#define RGB2U(R,G,B)	((( -38 * (R) -  74 * (G) + 112 * (B) + 32768) >> 16) + 128)
+#define RGB2V(R,G,B)	((( 112 * (R) -  94 * (G) -  18 * (B) + 32768) >> 16) + 128)
+
+/*
+ * rgb2nv12() of pnm2yuv, reading the samples MSB first instead of in host
+ * byte order, and stopping at the edges of images of odd size
+ */
+static void ref_rgb2nv12(const unsigned char *rgb16, int size[2], unsigned char *yuv)
+{
+	static const int bpp = 3;
+	unsigned char *uv;
+	int x, y;
+
+#define R	((rgb16[0] << 8) | rgb16[1])
+#define G	((rgb16[2] << 8) | rgb16[3])
+#define B	((rgb16[4] << 8) | rgb16[5])
+	uv = yuv + size[0] * size[1];
+
+	for (y = 0; y < size[1]; y += 2) {
+		/* y is even, convert chrominance */
+		for (x = 0; x < size[0]; x += 2) {
+			/* x is even, convert chrominance */
+			*yuv++ = RGB2Y(R, G, B);
+			*uv++ = RGB2U(R, G, B);
+			*uv++ = RGB2V(R, G, B);
+			rgb16 += bpp * 2;
+			if (x + 1 == size[0])
+				break;
+			/* x is odd, don't convert chrominance */
+			*yuv++ = RGB2Y(R, G, B);
+			rgb16 += bpp * 2;
+		}
+		if (y + 1 == size[1])
+			break;
+		/* y is odd, don't convert chrominance */
+		for (x = 0; x < size[0]; x++) {
+			*yuv++ = RGB2Y(R, G, B);
+			rgb16 += bpp * 2;
+		}
+	}
+#undef R
+#undef G
+#undef B
+}
+
+/* rgb2raw10() of pnm2raw for any Bayer order and 8 to 14 bits */
+static void ref_rgb2raw(const unsigned char *rgb16, int size[2], const struct format *f,
+			unsigned char *p)
+{
+	const int initrow = f->order[0] == 'b' || f->order[1] == 'b';
+	const int initpix = f->order[0] != (initrow ? 'b' : 'g');
+	int oddrow, oddpix;
+	int y, x;
+
+	oddrow = initrow;
+	for (y = 0; y < size[1]; y++) {
+		oddpix = initpix;
+		for (x = 0; x < size[0]; x++) {
+			unsigned int r = ((rgb16[0] << 8) | rgb16[1]) >> (16 - f->bits);
+			unsigned int g = ((rgb16[2] << 8) | rgb16[3]) >> (16 - f->bits);
+			unsigned int b = ((rgb16[4] << 8) | rgb16[5]) >> (16 - f->bits);
+			unsigned int v = 0;
+			if (!oddrow && !oddpix) v = g;
+			if (!oddrow &&  oddpix) v = r;
+			if ( oddrow && !oddpix) v = b;
+			if ( oddrow &&  oddpix) v = g;
+			if (f->bits == 8) {
+				*p++ = v;
+			} else {
+				write_pixel(p, v);
+				p += 2;
+			}
+			rgb16 += 3 * 2;
+			oddpix ^= 1;
+		}
+		oddrow ^= 1;
+	}
+}
+
+/* Conversion routines from Aleksandar Sutic, yuv2yuv */
+static int yuv420_to_nv12(void *image, int width, int height)
+{
+	unsigned char *u, *v, *uv, *uv_head;
+	int w, h, len = width * height / 2;
+
+	uv_head = uv = xmalloc(len);
+	u = (unsigned char *) image + 4 * width * height / 4;
+	v = (unsigned char *) image + 5 * width * height / 4;
+
+	for (h=0; h<height/2; h++) {
+		for (w=0; w<width; w+=2) {
+			*(uv + w) = *(u++);
+			*(uv + w + 1) = *(v++);
+		}
+		uv += width;
+	}
+
+	memcpy(((unsigned char *) image) + width * height, uv_head, len);
+	free(uv_head);
+
+	return 0;
+}
+
+static int nv12_to_yuv420(void *image, int width, int height)
+{
+	unsigned char *u, *v, *uv, *u_head, *v_head;
+	int w, h, len = width * height / 2;
+
+	u_head = u = xmalloc(len / 2);
+	v_head = v = xmalloc(len / 2);
+	uv = (unsigned char *) image + width * height;
+
+	for (h=0; h<height/2; h++) {
+		for (w=0; w<width; w+=2) {
+			*(u++) = *(uv + w);
+			*(v++) = *(uv + w + 1);
+		}
+		uv += width;
+	}
+
+	memcpy(((unsigned char *) image) + 4 * width * height / 4, u_head, len / 2);
+	memcpy(((unsigned char *) image) + 5 * width * height / 4, v_head, len / 2);
+
+	free(u_head);
+	free(v_head);
+
+	return 0;
+}
+
+/* Tests */
+
+/* Return unpacked raw pixels of Bayer image, one or two bytes LSB first */
+static unsigned char *raw_pixels(const struct format *f, unsigned char *in, int in_size,
+				 int width, int height, int stride)
+{
+	const int bpp = f->bits > 8 ? 2 : 1;
+	struct conv_output o;
+	unsigned char *raw;
+	int y, i;
+
+	if (f->unpacked != f->format && f->reference)
+		return ref_unpack(f, in, width, height, stride);
+
+	raw = xmalloc((long)width * height * bpp);
+	if (f->unpacked == f->format) {
+		for (y = 0; y < height; y++)
+			memcpy(raw + (long)y * width * bpp, in + (long)y * stride, width * bpp);
+		return raw;
+	}
+
+	/* No reference for the packing, take pixels from convlib grey output */
+	conv_output_init(&o, f->format, CONV_TYPE_PGM, 16, 1);
+	if (conv_convert(in, in_size, width, height, stride, f->format, &o, raw) < 0)
+		error("%s: grey conversion failed", test_case);
+	for (i = 0; i < width * height; i++) {
+		unsigned char hi = raw[i * 2];
+		raw[i * 2] = raw[i * 2 + 1];
+		raw[i * 2 + 1] = hi;
+	}
+	return raw;
+}
+
+/* Expected RGB image of oriented region x, y, w, h of raw Bayer image */
+static void bayer_oriented(const struct format *f, const unsigned char *raw, int width,
+			   int x, int y, int w, int h, int orient, unsigned char *d)
+{
+	const int bpp = f->bits > 8 ? 2 : 1;
+	const int t = orient & ORIENT_TRANSPOSE;
+	unsigned char *region = xmalloc((long)w * h * bpp * 2);
+	unsigned char *oriented = region + (long)w * h * bpp;
+	char order[5];
+	int i, u, v;
+
+	/* Colour of the oriented pixel (i & 1, i >> 1) */
+	for (i = 0; i < 4; i++) {
+		u = t ? i >> 1 : i & 1;
+		v = t ? i & 1 : i >> 1;
+		u = x + (orient & ORIENT_MIRROR_X ? w - 1 - u : u);
+		v = y + (orient & ORIENT_MIRROR_Y ? h - 1 - v : v);
+		order[i] = f->order[(v & 1) * 2 + (u & 1)];
+	}
+	order[4] = 0;
+	for (i = 0; i < SIZE(formats); i++)
+		if (formats[i].order && formats[i].bits == f->bits &&
+		    formats[i].unpacked == formats[i].format && !strcmp(formats[i].order, order))
+			break;
+
+	crop(raw, width, bpp, x, y, w, h, region);
+	ref_orient(region, w, h, bpp, orient, oriented);
+	if (ref_convert(oriented, t ? h : w, t ? w : h, (t ? h : w) * bpp,
+			formats[i].format, d) < 0)
+		error("%s: reference conversion failed", test_case);
+	free(region);
+}
+
+static void test_convert(const struct format *f)
+{
+	const int two_bytes = f->format == V4L2_PIX_FMT_Y16 ||
+			      (f->bits > 8 && (f->unpacked == f->format || is_v32(f)));
+	int width = rnd_size(rnd(8) ? 100 : 300);
+	int height = rnd_size(rnd(8) ? 40 : 100);
+	int stride = 0, size, in_size, i, n, ow, oh, x, y, w, h, orient;
+	unsigned char *in, *ref, *raw = NULL, *expected, *region, *out;
+	struct conv_output o;
+
+	if (f->format == V4L2_PIX_FMT_YYUV420_V32) {
+		width = 64 * (1 + rnd(3));
+		height = (height + 1) & ~1;
+	} else if (is_v32(f)) {
+		width = (width + 1) & ~1;
+		height = (height + 1) & ~1;
+	}
+	/* Padding keeps rows of two-byte samples aligned to samples */
+	conv_frame_size(f->format, width, height, &stride);
+	if (rnd(2))
+		stride += two_bytes ? 2 + rnd(8) * 2 : 1 + rnd(16);
+	size = conv_frame_size(f->format, width, height, &stride);
+	if (size < 0)
+		error("%s not supported", f->name);
+
+	/* Chroma of the last odd row of NV12 and NV21 is past the frame size */
+	in_size = size + stride + 16;
+	in = xmalloc(in_size);
+	fill_random(in, in_size);
+	if (f->format == V4L2_PIX_FMT_Y16)
+		for (i = 1; i < in_size; i += 2)
+			in[i] &= 3;
+	else if (two_bytes && f->bits < 16)
+		for (i = 1; i < in_size; i += 2)
+			in[i] &= (1 << (f->bits - 8)) - 1;
+
+	set_case("convert %s %ix%i stride %i", f->name, width, height, stride);
+	ref = xmalloc((long)width * height * 3);
+	out = xmalloc((long)width * height * 6);
+	conv_output_init(&o, f->format, CONV_TYPE_PPM, 8, 1);
+	if (conv_convert(in, in_size, width, height, stride, f->format, &o, out) < 0)
+		error("%s: conversion failed", test_case);
+	if (f->order && f->unpacked != f->format && !f->reference) {
+		/* No reference for the packing, check the variants against the plain conversion */
+		memcpy(ref, out, (long)width * height * 3);
+	} else {
+		if (ref_convert(in, width, height, stride, f->format, ref) < 0)
+			error("%s: reference conversion failed", test_case);
+		compare("pixel", out, ref, width, height, 3);
+	}
+	if (f->order)
+		raw = raw_pixels(f, in, in_size, width, height, stride);
+
+	expected = xmalloc((long)width * height * 3);
+	region = xmalloc((long)width * height * 3);
+	for (n = 0; n < 4; n++) {
+		conv_output_init(&o, f->format, CONV_TYPE_PPM, 8, 1);
+		o.threads = rnd(2) ? 1 + rnd(8) : 0;
+		x = 0, y = 0, w = width, h = height;
+		if (rnd(2)) {
+			x = rnd(width);
+			y = rnd(height);
+			w = 1 + rnd(width - x);
+			h = 1 + rnd(height - y);
+			if (w != width || h != height) {
+				o.x = x, o.y = y;
+				o.width = w, o.height = h;
+			}
+		}
+		orient = rnd(2) ? rnd(8) : 0;
+		o.orient = orient;
+		set_case("convert %s %ix%i stride %i threads %i region %i,%i %ix%i orient %i",
+			 f->name, width, height, stride, o.threads, x, y, w, h, orient);
+
+		conv_output_size(&o, width, height, &ow, &oh);
+		if (conv_convert(in, in_size, width, height, stride, f->format, &o, out) < 0)
+			error("%s: conversion failed", test_case);
+		if (orient && f->order) {
+			bayer_oriented(f, raw, width, x, y, w, h, orient, expected);
+		} else {
+			crop(ref, width, 3, x, y, w, h, region);
+			ref_orient(region, w, h, 3, orient, expected);
+		}
+		compare("pixel", out, expected, ow, oh, 3);
+
+		/* Bayer pixels of more than 8 bits in 16-bit output are shifted for 8 bits */
+		if (!f->order || f->bits == 8 || orient)
+			continue;
+		conv_output_init(&o, f->format, CONV_TYPE_PPM, 16, 1);
+		o.threads = rnd(2) ? 1 + rnd(8) : 0;
+		o.x = x, o.y = y;
+		o.width = w, o.height = h;
+		set_case("convert %s %ix%i stride %i threads %i region %i,%i %ix%i 16 bits",
+			 f->name, width, height, stride, o.threads, x, y, w, h);
+		if (conv_convert(in, in_size, width, height, stride, f->format, &o, out) < 0)
+			error("%s: conversion failed", test_case);
+		for (i = 0; i < w * h * 3; i++)
+			out[i] = ((out[i * 2] << 8) | out[i * 2 + 1]) >> (f->bits - 8);
+		compare("pixel", out, region, w, h, 3);
+	}
+
+	free(in);
+	free(ref);
+	free(raw);
+	free(out);
+	free(expected);
+	free(region);
+}
+
+/* Random image for pnm2yuv and pnm2raw, RGB or grey of 8 or 16 bits */
+static void random_image(struct pnm_image *img)
+{
+	memset(img, 0, sizeof(*img));
+	img->width = rnd_size(150);
+	img->height = rnd_size(40);
+	img->channels = rnd(4) ? 3 : 1;
+	img->bps = 1 + rnd(2);
+	img->maxval = img->bps == 1 ? 255 : 65535;
+	img->size = img->width * img->height * img->channels * img->bps;
+	img->data = xmalloc(img->size);
+	img->alloc = img->size;
+	fill_random(img->data, img->size);
+}
+
+static void test_rgb_to_yuv(void)
+{
+	struct pnm_image img;
+	unsigned char *rgb16, *ref, *out;
+	int size[2], pixels, chroma;
+
+	random_image(&img);
+	size[0] = img.width;
+	size[1] = img.height;
+	pixels = img.width * img.height;
+	chroma = (img.width + 1) / 2 * ((img.height + 1) / 2);
+	rgb16 = ref_read_pnm(&img);
+	ref = xmalloc(pixels + chroma * 2);
+	out = xmalloc(pixels + chroma * 2);
+	ref_rgb2nv12(rgb16, size, ref);
+
+	set_case("pnm2yuv %ix%i channels %i maxval %i NV12", img.width, img.height,
+		 img.channels, img.maxval);
+	yuv_rgb_to_420(&img, out, out + pixels, out + pixels + 1, 2);
+	compare("luma", out, ref, img.width, img.height, 1);
+	compare("chroma", out + pixels, ref + pixels, (img.width + 1) / 2, (img.height + 1) / 2, 2);
+
+	/* Planar chroma of even sizes as nv12_to_yuv420() of yuv2yuv */
+	if (!((img.width | img.height) & 1)) {
+		set_case("pnm2yuv %ix%i channels %i maxval %i YUV420", img.width, img.height,
+			 img.channels, img.maxval);
+		nv12_to_yuv420(ref, img.width, img.height);
+		yuv_rgb_to_420(&img, out, out + pixels, out + pixels + chroma, 1);
+		compare("luma", out, ref, img.width, img.height, 1);
+		compare("U", out + pixels, ref + pixels, img.width / 2, img.height / 2, 1);
+		compare("V", out + pixels + chroma, ref + pixels + chroma,
+			img.width / 2, img.height / 2, 1);
+	}
+
+	free(rgb16);
+	free(ref);
+	free(out);
+	pnm_free(&img);
+}
+
+static const char *const raw_names[] = {
+	"SBGGR8", "SGBRG10", "SGRBG12", "SRGGB14",
+	"SBGGR10P", "SGBRG12P", "SGRBG14P", "SRGGB10P",
+};
+
+static void test_pnm2raw(void)
+{
+	const char *name = raw_names[rnd(SIZE(raw_names))];
+	const struct format *f = NULL;
+	struct raw_format rf;
+	struct pnm_image img;
+	unsigned char *rgb16, *ref, *out, *packed;
+	unsigned short *row;
+	int size[2], line, y, i;
+
+	/* Order and bits of the unpacked format */
+	for (i = 0; i < SIZE(formats); i++)
+		if (!strncmp(formats[i].name, name, strlen(formats[i].name)) &&
+		    formats[i].unpacked == formats[i].format)
+			f = &formats[i];
+	if (!f || raw_format_parse(&rf, name) < 0)
+		error("%s not supported", name);
+
+	random_image(&img);
+	size[0] = img.width;
+	size[1] = img.height;
+	line = raw_line_size(&rf, img.width);
+	rgb16 = ref_read_pnm(&img);
+	ref = xmalloc((long)img.width * img.height * 2);
+	ref_rgb2raw(rgb16, size, f, ref);
+	packed = xmalloc(line);
+	out = xmalloc(line);
+	row = xmalloc(img.width * sizeof(*row));
+
+	set_case("pnm2raw %s %ix%i channels %i maxval %i", name, img.width, img.height,
+		 img.channels, img.maxval);
+	for (y = 0; y < img.height; y++) {
+		unsigned char *r = ref + (long)y * img.width * (f->bits > 8 ? 2 : 1);
+		raw_mosaic_row(&img, y, &rf, row);
+		raw_pack_row(&rf, row, img.width, out);
+		if (rf.packed) {
+			for (i = 0; i < img.width; i++)
+				row[i] = r[i * 2] | (r[i * 2 + 1] << 8);
+			ref_raw2mipi(rf.bits, row, img.width, packed);
+			r = packed;
+		}
+		compare("byte", out, r, line, 1, 1);
+	}
+
+	free(rgb16);
+	free(ref);
+	free(packed);
+	free(out);
+	free(row);
+	pnm_free(&img);
+}
+
+static void test_unpack(int bits)
+{
+	const int n = bits == 12 ? 2 : 4;
+	const int width = rnd_size(300);
+	const int tight = bits == 8 || rnd(2);
+	const int bytes = tight ? (width * bits + 7) / 8 : (width + n - 1) / n * n * bits / 8;
+	unsigned char *in = xmalloc(bytes);
+	unsigned char *ref = xmalloc(width * 2);
+	unsigned char *out = xmalloc(width * 2);
+
+	fill_random(in, bytes);
+	set_case("txt2raw unpack%i width %i bytes %i", bits, width, bytes);
+	raw_unpack_mipi(bits, in, bytes, width, out);
+	if (bits == 8) {
+		compare("byte", out, in, width, 1, 1);
+	} else {
+		ref_uncompress_mipi(bits, in, width, tight, ref);
+		compare("pixel", out, ref, width, 1, 2);
+	}
+	free(in);
+	free(ref);
+	free(out);
+}
+
+static void test_unpack10(void) { test_unpack(10); }
+static void test_unpack12(void) { test_unpack(12); }
+static void test_unpack14(void) { test_unpack(14); }
+static void test_unpack8(void) { test_unpack(8); }
+
+/* Lines of text as write_txt() of pnm2txt, read back as txt2buf() of txt2raw */
+static void test_hex(void)
+{
+	const int lines = rnd_size(8);
+	int size[8];
+	unsigned char *data[8], *line;
+	char *text, *ref, *p;
+	struct hex_reader r;
+	FILE *f;
+	int i, x, n, len = 0;
+
+	for (i = 0; i < lines; i++) {
+		size[i] = rnd_size(200);
+		data[i] = xmalloc(size[i]);
+		fill_random(data[i], size[i]);
+		len += size[i] * 3;
+	}
+	text = xmalloc(len);
+	ref = xmalloc(len + 1);
+
+	set_case("hex %i lines", lines);
+	for (i = 0, p = ref; i < lines; i++)
+		for (x = 0; x < size[i]; x++) {
+			p += sprintf(p, "%02x", data[i][x]);
+			*p++ = x < size[i] - 1 ? ' ' : '\n';
+		}
+	for (i = 0, p = text; i < lines; i++)
+		p += hex_encode_line(data[i], size[i], p);
+	compare("character", (unsigned char *)text, (unsigned char *)ref, len, 1, 1);
+
+	f = fmemopen(text, len, "r");
+	if (!f)
+		error("fmemopen failed");
+	hex_reader_init(&r, f);
+	for (i = 0; i < lines; i++) {
+		n = hex_read_line(&r, &line);
+		if (n != size[i])
+			mismatch("length of line", 0, i, 0, n, size[i]);
+		compare("byte", line, data[i], size[i], 1, 1);
+	}
+	if (hex_read_line(&r, &line))
+		mismatch("lines", 0, 0, 0, lines + 1, lines);
+	hex_reader_free(&r);
+	fclose(f);
+
+	for (i = 0; i < lines; i++)
+		free(data[i]);
+	free(text);
+	free(ref);
+}
+
+static void test_yuv(void)
+{
+	const struct yuv_layout *nv12 = yuv_layout_get("NV12");
+	const struct yuv_layout *yuv420 = yuv_layout_get("YUV420");
+	const int width = rnd_size(100) * 2;
+	const int height = rnd_size(30) * 2;
+	const int size = width * height * 3 / 2;
+	unsigned char *in = xmalloc(size);
+	unsigned char *ref = xmalloc(size);
+	unsigned char *out = xmalloc(size);
+	struct yuv_frame s, d;
+
+	fill_random(in, size);
+
+	set_case("yuv2yuv %ix%i YUV420 to NV12", width, height);
+	memcpy(ref, in, size);
+	yuv420_to_nv12(ref, width, height);
+	yuv_frame_init(&s, yuv420, width, height, 0, in);
+	yuv_frame_init(&d, nv12, width, height, 0, out);
+	if (yuv_convert(&s, &d, YUV_SITING_CENTER) < 0)
+		error("out of memory");
+	compare("byte", out, ref, width, height * 3 / 2, 1);
+
+	set_case("yuv2yuv %ix%i NV12 to YUV420", width, height);
+	memcpy(ref, in, size);
+	nv12_to_yuv420(ref, width, height);
+	yuv_frame_init(&s, nv12, width, height, 0, in);
+	yuv_frame_init(&d, yuv420, width, height, 0, out);
+	if (yuv_convert(&s, &d, YUV_SITING_CENTER) < 0)
+		error("out of memory");
+	compare("byte", out, ref, width, height * 3 / 2, 1);
+
+	free(in);
+	free(ref);
+	free(out);
+}
+
+static void test_orient(void)
+{
+	static const int bpps[] = { 1, 2, 3, 4, 6 };
+	const int bpp = bpps[rnd(SIZE(bpps))];
+	const int width = rnd_size(100);
+	const int height = rnd_size(100);
+	const int orient = rnd(8);
+	const long size = (long)width * height * bpp;
+	unsigned char *in = xmalloc(size);
+	unsigned char *ref = xmalloc(size);
+	unsigned char *out = xmalloc(size);
+	const int t = orient & ORIENT_TRANSPOSE;
+
+	fill_random(in, size);
+	set_case("orient %ix%i bpp %i orient %i", width, height, bpp, orient);
+	ref_orient(in, width, height, bpp, orient, ref);
+	orient_image(in, width, height, bpp, orient, out);
+	compare("pixel", out, ref, t ? height : width, t ? width : height, bpp);
+	free(in);
+	free(ref);
+	free(out);
+}
+
+static const struct test {
+	const char *name;
+	void (*run)(void);
+} tests[] = {
+	{ "pnm2yuv",		test_rgb_to_yuv },
+	{ "pnm2raw",		test_pnm2raw },
+	{ "txt2raw/unpack8",	test_unpack8 },
+	{ "txt2raw/unpack10",	test_unpack10 },
+	{ "txt2raw/unpack12",	test_unpack12 },
+	{ "txt2raw/unpack14",	test_unpack14 },
+	{ "hex",		test_hex },
+	{ "yuv2yuv",		test_yuv },
+	{ "orient",		test_orient },
+};
+
+static void usage(void)
+{
+	printf("Usage: convtest [-n iterations] [-s seed] [-k kernel] [-v]\n");
+	printf("-n: Random cases of each kernel, default 100\n");
+	printf("-s: Seed of the random cases, default from the time\n");
+	printf("-k: Test only kernels whose name contains the string, convert/FORMAT for raw2pnm\n");
+	printf("-v: Print each case\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filter = NULL;
+	int iterations = 100;
+	char name[64];
+	int opt, i, j, n = 0;
+
+	seed = time(NULL);
+	while ((opt = getopt(argc, argv, "n:s:k:vh")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			filter = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+			exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if (optind < argc) {
+		usage();
+		exit(1);
+	}
+
+	printf("Testing %s kernels with seed %u\n", cpu_level_name(cpu_level()), seed);
+	fflush(stdout);
+	rnd_state = seed ? seed : 1;
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < SIZE(formats); j++) {
+			snprintf(name, sizeof(name), "convert/%s", formats[j].name);
+			if (filter && !strstr(name, filter))
+				continue;
+			test_convert(&formats[j]);
+			n++;
+		}
+		for (j = 0; j < SIZE(tests); j++) {
+			if (filter && !strstr(tests[j].name, filter))
+				continue;
+			tests[j].run();
+			n++;
+		}
+	}
+	if (!n)
+		error("no kernel matches %s", filter);
+	printf("%i cases passed\n", n);
+	return 0;
+}
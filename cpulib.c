@@ -0,0 +1,65 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "cpulib.h"
+
+static const char *const level_names[CPU_LEVELS] = { "baseline", "sse4.2", "avx2" };
+
+static int level;
+
+/* Detect the level before main() so that threads only read it */
+static void __attribute__((constructor)) cpu_init(void)
+{
+	const char *name = getenv("NVT_CPU");
+	int i;
+
+#ifdef CPU_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		level = CPU_AVX2;
+	else if (__builtin_cpu_supports("sse4.2"))
+		level = CPU_SSE42;
+#endif
+	if (!name)
+		return;
+
+#ifdef __SSE2__
+	/* The baseline is SSE2, as in 64-bit builds but not in plain i386 ones */
+	if (!strcasecmp(name, "sse2"))
+		name = level_names[CPU_BASELINE];
+#endif
+	for (i = 0; i < CPU_LEVELS; i++)
+		if (!strcasecmp(name, level_names[i]))
+			break;
+	if (i == CPU_LEVELS)
+		fprintf(stderr, "warning: unknown NVT_CPU=%s, use baseline, sse4.2, or avx2\n",
+			name);
+	else if (i < level)
+		level = i;
+}
+
+int cpu_level(void)
+{
+	return level;
+}
+
+const char *cpu_level_name(int level)
+{
+	return level >= 0 && level < CPU_LEVELS ? level_names[level] : NULL;
+}
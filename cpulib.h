@@ -0,0 +1,80 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef CPULIB_H
+#define CPULIB_H
+
+/*
+ * Hot kernels are compiled for several instruction set levels and the
+ * one for the CPU is picked at run time, so that one static binary uses
+ * the newest instructions of any CPU it runs on. The baseline level is
+ * given by the compiler flags, SSE2 for 64-bit x86 and plain x86 for i386.
+ * NVT_CPU set to the name of a level in the environment lowers the level
+ * for testing, for example NVT_CPU=baseline to run the baseline kernels.
+ * If the baseline includes SSE2, it can also be named sse2.
+ */
+enum { CPU_BASELINE, CPU_SSE42, CPU_AVX2, CPU_LEVELS };
+
+/* Return the level of the CPU, or the one given by NVT_CPU if lower */
+int cpu_level(void);
+const char *cpu_level_name(int level);
+
+#if defined(__i386__) || defined(__x86_64__)
+#define CPU_X86
+#define CPU_TARGET(isa)	__attribute__((target(isa)))
+
+/* -O2 of GCC 12 only vectorizes loops that need no scalar epilogue */
+#ifdef __clang__
+#define CPU_CLONE(isa)	__attribute__((target(isa)))
+#else
+#define CPU_CLONE(isa)	__attribute__((target(isa), optimize("vect-cost-model=dynamic")))
+#endif
+
+/*
+ * Define kernel void name(params) which calls name##_body(level, args)
+ * compiled for each level. The body must be always inline so that it is
+ * compiled with the instructions of the level, and it gets the level as
+ * a constant to pick paths written with intrinsics.
+ */
+#define CPU_KERNEL(name, params, ...)						\
+static void name##_baseline params						\
+{										\
+	name##_body(CPU_BASELINE, __VA_ARGS__);					\
+}										\
+static void CPU_CLONE("sse4.2") name##_sse42 params				\
+{										\
+	name##_body(CPU_SSE42, __VA_ARGS__);					\
+}										\
+static void CPU_CLONE("avx2") name##_avx2 params				\
+{										\
+	name##_body(CPU_AVX2, __VA_ARGS__);					\
+}										\
+static void name params								\
+{										\
+	static void (* const fn[CPU_LEVELS]) params =				\
+		{ name##_baseline, name##_sse42, name##_avx2 };			\
+	fn[cpu_level()](__VA_ARGS__);						\
+}
+#else
+#define CPU_TARGET(isa)
+#define CPU_KERNEL(name, params, ...)						\
+static void name params								\
+{										\
+	name##_body(CPU_BASELINE, __VA_ARGS__);					\
+}
+#endif
+
+#endif
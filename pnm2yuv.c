@@ -16,67 +16,171 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 #include "utillib.h"
+#include "streamlib.h"
+#include "yuvlib.h"
 
-/* From https://msdn.microsoft.com/en-us/library/aa917087.aspx */
-/* Modified so that R, G, B are 16-bit pixel values 0..65535 */
-#define RGB2Y(R,G,B)	(((  66 * (R) + 129 * (G) +  25 * (B) + 32768) >> 16) +  16)
-#define RGB2U(R,G,B)	((( -38 * (R) -  74 * (G) + 112 * (B) + 32768) >> 16) + 128)
-#define RGB2V(R,G,B)	((( 112 * (R) -  94 * (G) -  18 * (B) + 32768) >> 16) + 128)
+/*
+ * Images of all input files, each file may have several images. Each
+ * slot of the stream ring has its own image and output buffer.
+ */
+struct clip {
+	char **in_names;
+	int in_files;
+	int file;			/* Current input file */
+	FILE *in, *out;
+	int y4m;
+	int orient;
+	struct pnm_image img[STREAM_SLOTS];
+	unsigned char *yuv[STREAM_SLOTS];
+	int yuv_size;
+	int out_size[2];		/* Size of the first image, 0 before it */
+	unsigned char *oriented;
+	int oriented_size;
+};
+
+static void error(const char *msg)
+{
+	printf("%s\n", msg);
+	exit(1);
+}
+
+static int read_image(void *priv, int slot)
+{
+	struct clip *c = priv;
 
-static void *rgb2nv12(uint16_t *rgb, int size[2])
+	while (c->file < c->in_files) {
+		if (!c->in) {
+			c->in = fopen(c->in_names[c->file], "rb");
+			if (!c->in) error("failed to open input file");
+		}
+		if (pnm_read(c->in, &c->img[slot]))
+			return 1;
+		fclose(c->in);
+		c->in = NULL;
+		c->file++;
+	}
+	return 0;
+}
+
+static void convert_image(void *priv, int slot)
 {
-	static const int bpp = 3;
-	unsigned char *yuv, *uv, *r;
-	int x, y;
-
-	r = yuv = malloc(size[0] * size[1] * 3/2);
-	uv = yuv + size[0] * size[1];
-
-	for (y = 0; y < size[1]; y += 2) {
-		/* y is even, convert chrominance */
-		for (x = 0; x < size[0]; x += 2) {
-			/* x is even, convert chrominance */
-			*yuv++ = RGB2Y(rgb[0], rgb[1], rgb[2]);
-			*uv++ = RGB2U(rgb[0], rgb[1], rgb[2]);
-			*uv++ = RGB2V(rgb[0], rgb[1], rgb[2]);
-			rgb += bpp;
-			/* x is odd, don't convert chrominance */
-			*yuv++ = RGB2Y(rgb[0], rgb[1], rgb[2]);
-			rgb += bpp;
+	struct clip *c = priv;
+	struct pnm_image img = c->img[slot];
+	int pixels = img.width * img.height;
+	int chroma = (img.width + 1) / 2 * ((img.height + 1) / 2);
+	int size[2];
+
+	if (!c->out_size[0])
+		printf("Read file %ix%i pixels\n", img.width, img.height);
+	if (c->orient) {
+		if (c->oriented_size < img.size) {
+			free(c->oriented);
+			c->oriented_size = img.size;
+			c->oriented = malloc(c->oriented_size);
+			if (!c->oriented) error("Out of memory");
 		}
-		/* y is odd, don't convert chrominance */
-		for (x = 0; x < size[0]; x++) {
-			*yuv++ = RGB2Y(rgb[0], rgb[1], rgb[2]);
-			rgb += bpp;
+		orient_image(img.data, img.width, img.height, img.channels * img.bps,
+			     c->orient, c->oriented);
+		img.data = c->oriented;
+		if (c->orient & ORIENT_TRANSPOSE) {
+			img.width = c->img[slot].height;
+			img.height = c->img[slot].width;
 		}
 	}
+	size[0] = img.width;
+	size[1] = img.height;
 
-	return r;
+	/* Frames of a stream must all have the same size */
+	if (!c->out_size[0]) {
+		c->out_size[0] = size[0];
+		c->out_size[1] = size[1];
+		c->yuv_size = pixels + chroma * 2;
+		/* Chroma is taken from the top left pixel of each 2x2 block */
+		if (c->y4m && fprintf(c->out, "YUV4MPEG2 W%i H%i F30:1 Ip A1:1 C420paldv\n",
+				      size[0], size[1]) < 0)
+			error("failed to write data to file");
+	} else if (size[0] != c->out_size[0] || size[1] != c->out_size[1]) {
+		error("all images must have the same size");
+	}
+
+	if (!c->yuv[slot]) {
+		c->yuv[slot] = malloc(c->yuv_size);
+		if (!c->yuv[slot]) error("Out of memory");
+	}
+	if (c->y4m)
+		yuv_rgb_to_420(&img, c->yuv[slot], c->yuv[slot] + pixels,
+			   c->yuv[slot] + pixels + chroma, 1);
+	else
+		yuv_rgb_to_420(&img, c->yuv[slot], c->yuv[slot] + pixels,
+			   c->yuv[slot] + pixels + 1, 2);
+}
+
+static void write_image(void *priv, int slot)
+{
+	struct clip *c = priv;
+
+	if (c->y4m && fputs("FRAME\n", c->out) < 0)
+		error("failed to write data to file");
+	if (fwrite(c->yuv[slot], c->yuv_size, 1, c->out) != 1)
+		error("failed to write data to file");
 }
 
 int main(int argc, char *argv[])
 {
-	char *in_name;
+	static const struct stream_ops ops = { read_image, convert_image, write_image };
+	struct clip c = { 0 };
 	char *out_name;
-	void *rgb, *yuv;
-	int size[2];
+	int orient = 0;
+	char *flip = "";
+	int opt;
+	int i, n;
 
-	if (argc < 3) {
-		printf("Usage: %s [input.pnm] [output.yuv]\n", argv[0]);
-		exit(1);
+	while ((opt = getopt(argc, argv, "R:M:t:")) != -1) {
+		switch (opt) {
+		case 'R':
+			orient = orient_rotate(atoi(optarg));
+			break;
+		case 'M':
+			flip = optarg;
+			break;
+		case 't':
+			c.y4m = !strcmp(optarg, "y4m");
+			if (!c.y4m && strcmp(optarg, "nv12"))
+				orient = -1;
+			break;
+		default:
+			orient = -1;
+			break;
+		}
 	}
-	in_name = argv[1];
-	out_name = argv[2];
+	for (; *flip && orient >= 0; flip++)
+		orient = orient_flip(orient, *flip);
 
-	rgb = read_pnm(in_name, size);
-	printf("Read file %ix%i pixels\n", size[0], size[1]);
-	yuv = rgb2nv12(rgb, size);
-	write_file(out_name, yuv, size[0]*size[1]*3/2);
+	if (argc - optind < 2 || orient < 0) {
+		printf("Usage: %s [-R 90|180|270] [-M h|v] [-t nv12|y4m] [input.pnm...] [output.yuv]\n", argv[0]);
+		printf("Each input file may contain several images, all are converted into the output\n"
+		       "file, either raw NV12 frames or YUV4MPEG2 stream of planar 4:2:0 frames\n");
+		exit(1);
+	}
+	c.in_names = &argv[optind];
+	c.in_files = argc - optind - 1;
+	out_name = argv[argc - 1];
+	c.orient = orient;
 
-	free(rgb);
-	free(yuv);
+	c.out = fopen(out_name, "wb");
+	if (!c.out) error("can not open file");
+	n = stream_run(&ops, &c);
+	if (fclose(c.out) != 0)
+		error("failed to close file");
+	printf("Converted %i images\n", n);
 
+	for (i = 0; i < STREAM_SLOTS; i++) {
+		pnm_free(&c.img[i]);
+		free(c.yuv[i]);
+	}
+	free(c.oriented);
 	return 0;
 }
@@ -22,197 +22,31 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glob.h>
 #include "linux/videodev2.h"
 
 #include "extradefs.h"
+#include "utillib.h"
+#include "convlib.h"
+#include "symlib.h"
 
 #define MIN(a,b)	((a) <= (b) ? (a) : (b))
 #define MAX(a,b)	((a) >= (b) ? (a) : (b))
 #define CLAMP(a,lo,hi)	((a) < (lo) ? (lo) : (a) > (hi) ? (hi) : (a))
-#define CLAMPB(a)	CLAMP(a, 0, 255)
+
+#define MAX_THREADS	CONV_MAX_THREADS
 
 static char *name = "raw2pnm";
 
 static int verbosity = 2;
 
-struct symbol_list {
-	int id;
-	const char *symbol;
-};
-#define SYMBOL_END	{ -1, NULL }
-
-#ifndef V4L2_PIX_FMT_YYUV420_V32
-#define V4L2_PIX_FMT_YYUV420_V32 v4l2_fourcc('y', 'V', '0', 'A') /* Vectorized NV12 */
-#endif
-
-#define V4L2_PIX_FMT	"V4L2_PIX_FMT_"
-#define PIXFMT(id)	{ V4L2_PIX_FMT_##id, (#id) }
-static const struct symbol_list pixelformats[] = {
-	PIXFMT(RGB332),
-	PIXFMT(RGB444),
-	PIXFMT(ARGB444),
-	PIXFMT(XRGB444),
-	PIXFMT(RGB555),
-	PIXFMT(ARGB555),
-	PIXFMT(XRGB555),
-	PIXFMT(RGB565),
-	PIXFMT(RGB555X),
-	PIXFMT(ARGB555X),
-	PIXFMT(XRGB555X),
-	PIXFMT(RGB565X),
-	PIXFMT(BGR666),
-	PIXFMT(BGR24),
-	PIXFMT(RGB24),
-	PIXFMT(BGR32),
-	PIXFMT(ABGR32),
-	PIXFMT(XBGR32),
-	PIXFMT(RGB32),
-	PIXFMT(ARGB32),
-	PIXFMT(XRGB32),
-	PIXFMT(GREY),
-	PIXFMT(Y4),
-	PIXFMT(Y6),
-	PIXFMT(Y10),
-	PIXFMT(Y12),
-	PIXFMT(Y16),
-	PIXFMT(Y10BPACK),
-	PIXFMT(PAL8),
-	PIXFMT(UV8),
-	PIXFMT(YVU410),
-	PIXFMT(YVU420),
-	PIXFMT(YUYV),
-	PIXFMT(YYUV),
-	PIXFMT(YVYU),
-	PIXFMT(UYVY),
-	PIXFMT(VYUY),
-	PIXFMT(YUV422P),
-	PIXFMT(YUV411P),
-	PIXFMT(Y41P),
-	PIXFMT(YUV444),
-	PIXFMT(YUV555),
-	PIXFMT(YUV565),
-	PIXFMT(YUV32),
-	PIXFMT(YUV410),
-	PIXFMT(YUV420),
-	PIXFMT(HI240),
-	PIXFMT(HM12),
-	PIXFMT(M420),
-	PIXFMT(NV12),
-	PIXFMT(NV21),
-	PIXFMT(NV16),
-	PIXFMT(NV61),
-	PIXFMT(NV24),
-	PIXFMT(NV42),
-	PIXFMT(NV12M),
-	PIXFMT(NV21M),
-	PIXFMT(NV16M),
-	PIXFMT(NV61M),
-	PIXFMT(NV12MT),
-	PIXFMT(NV12MT_16X16),
-	PIXFMT(YUV420M),
-	PIXFMT(YVU420M),
-	PIXFMT(SBGGR8),
-	PIXFMT(SGBRG8),
-	PIXFMT(SGRBG8),
-	PIXFMT(SRGGB8),
-	PIXFMT(SBGGR10),
-	PIXFMT(SGBRG10),
-	PIXFMT(SGRBG10),
-	PIXFMT(SRGGB10),
-	PIXFMT(SBGGR10P),
-	PIXFMT(SGBRG10P),
-	PIXFMT(SGRBG10P),
-	PIXFMT(SRGGB10P),
-	PIXFMT(SBGGR10ALAW8),
-	PIXFMT(SGBRG10ALAW8),
-	PIXFMT(SGRBG10ALAW8),
-	PIXFMT(SRGGB10ALAW8),
-	PIXFMT(SBGGR10DPCM8),
-	PIXFMT(SGBRG10DPCM8),
-	PIXFMT(SGRBG10DPCM8),
-	PIXFMT(SRGGB10DPCM8),
-	PIXFMT(SBGGR12),
-	PIXFMT(SGBRG12),
-	PIXFMT(SGRBG12),
-	PIXFMT(SRGGB12),
-	PIXFMT(SBGGR12P),
-	PIXFMT(SGBRG12P),
-	PIXFMT(SGRBG12P),
-	PIXFMT(SRGGB12P),
-	PIXFMT(SBGGR14),
-	PIXFMT(SGBRG14),
-	PIXFMT(SGRBG14),
-	PIXFMT(SRGGB14),
-	PIXFMT(SBGGR14P),
-	PIXFMT(SGBRG14P),
-	PIXFMT(SGRBG14P),
-	PIXFMT(SRGGB14P),
-	PIXFMT(SBGGR16),
-	PIXFMT(SBGGR8_16V32),
-	PIXFMT(SGBRG8_16V32),
-	PIXFMT(SGRBG8_16V32),
-	PIXFMT(SRGGB8_16V32),
-	PIXFMT(SBGGR10V32),
-	PIXFMT(SGBRG10V32),
-	PIXFMT(SGRBG10V32),
-	PIXFMT(SRGGB10V32),
-	PIXFMT(SBGGR12V32),
-	PIXFMT(SGBRG12V32),
-	PIXFMT(SGRBG12V32),
-	PIXFMT(SRGGB12V32),
-	PIXFMT(SBGGR8V32),
-	PIXFMT(SGBRG8V32),
-	PIXFMT(SGRBG8V32),
-	PIXFMT(SRGGB8V32),
-	PIXFMT(UYVY_V32),
-	PIXFMT(YUYV420_V32),
-	PIXFMT(MJPEG),
-	PIXFMT(JPEG),
-	PIXFMT(DV),
-	PIXFMT(MPEG),
-	PIXFMT(H264),
-	PIXFMT(H264_NO_SC),
-	PIXFMT(H264_MVC),
-	PIXFMT(H263),
-	PIXFMT(MPEG1),
-	PIXFMT(MPEG2),
-	PIXFMT(MPEG4),
-	PIXFMT(XVID),
-	PIXFMT(VC1_ANNEX_G),
-	PIXFMT(VC1_ANNEX_L),
-	PIXFMT(VP8),
-	PIXFMT(CPIA1),
-	PIXFMT(WNVA),
-	PIXFMT(SN9C10X),
-	PIXFMT(SN9C20X_I420),
-	PIXFMT(PWC1),
-	PIXFMT(PWC2),
-	PIXFMT(ET61X251),
-	PIXFMT(SPCA501),
-	PIXFMT(SPCA505),
-	PIXFMT(SPCA508),
-	PIXFMT(SPCA561),
-	PIXFMT(PAC207),
-	PIXFMT(MR97310A),
-	PIXFMT(JL2005BCD),
-	PIXFMT(SN9C2028),
-	PIXFMT(SQ905C),
-	PIXFMT(PJPG),
-	PIXFMT(OV511),
-	PIXFMT(OV518),
-	PIXFMT(STV0680),
-	PIXFMT(TM6000),
-	PIXFMT(CIT_YYVYUY),
-	PIXFMT(KONICA420),
-	PIXFMT(JPGL),
-	PIXFMT(SE401),
-	PIXFMT(S5C_UYVY_JPG),
-	PIXFMT(SMIAPP_META_8),
-	PIXFMT(YYUV420_V32),
-	PIXFMT(PRIV_MAGIC),
-	PIXFMT(FLAG_PREMUL_ALPHA),
-	SYMBOL_END
-};
+static int threads = 1;
+static int frame_threads = 1;		/* Threads converting separate frames */
+
 
 static void print(int lvl, char *msg, ...)
 {
@@ -242,9 +76,37 @@ static void error(char *msg, ...)
 	exit(1);
 }
 
+static void conv_error(const char *msg)
+{
+	error("%s", msg);
+}
+
+static void conv_warning(const char *msg)
+{
+	print(1, "warning: %s\n", msg);
+}
+
 static void usage(void)
 {
-	print(1,"Usage: %s [-x width] [-y height] [-s stride] [-f format] [-b skip bytes] [inputfile] [outputfile]\n", name);
+	print(1,"Usage: %s [-x width] [-y height] [-s stride] [-f format] [-b skip bytes] [-j threads]\n"
+		"\t[-t ppm|pgm|pam|y4m|rgb] [-d 8|16] [-S 1/scale] [-c x,y,width,height] [-R 90|180|270] [-M h|v]\n"
+		"\t[-n frames] [-F frame stride] [-H frame header bytes] [inputfile] [outputfile]\n", name);
+	print(1,"-t: Output file type, pgm for luma or raw Bayer samples only (default ppm).\n"
+		"    y4m and rgb write all frames into a single YUV4MPEG2 or raw RGB stream\n");
+	print(1,"-d: Output bits per sample, 16 keeps the full precision of the input (default 8)\n");
+	print(1,"-S: Downscale by averaging blocks of scale x scale pixels, scale is 1 or even,\n"
+		"    eg. 1/2, 1/4, or 1/8. Raw Bayer images are binned without demosaicing\n");
+	print(1,"-c: Convert only the given region of the image\n");
+	print(1,"-R: Rotate output image clockwise by 90, 180, or 270 degrees\n");
+	print(1,"-M: Flip output image horizontally (h) or vertically (v), after rotation\n");
+	print(1,"-n: Number of frames to convert, 0 for all frames in the file (default 1).\n"
+		"    Character @ in output file name is replaced with the frame number,\n"
+		"    without @ _number is added before the extension of several frames\n");
+	print(1,"-F: Bytes from the beginning of a frame to the next (default frame size)\n");
+	print(1,"-H: Bytes to skip at the beginning of each frame\n");
+	print(1,"If inputfile contains @ or wildcards and no such file exists, all matching\n"
+		"files are converted. Character @ in outputfile is then replaced with the part\n"
+		"of the input file name matching @ or the wildcards.\n");
 }
 
 static const char *symbol_str(int id, const struct symbol_list list[])
@@ -252,11 +114,8 @@ static const char *symbol_str(int id, const struct symbol_list list[])
 	static char buffer[200];
 	int i;
 
-	for (i=0; list[i].symbol; i++)
-		if (list[i].id == id)
-			break;
-
-	if (list[i].symbol) {
+	i = symbol_find_id(list, id);
+	if (i >= 0) {
 		if (id < 1000)
 			sprintf(buffer, "%s [%i]", list[i].symbol, id);
 		else
@@ -296,11 +155,8 @@ static int symbol_get(const struct symbol_list *list, const char **symbol)
 			error("zero-length symbol");
 		if (!list)
 			error("only numeric value allowed");
-		for (i=0; list[i].symbol!=NULL; i++) {
-			if (strncasecmp(start, list[i].symbol, end-start) == 0)
-				break;
-		}
-		if (list[i].symbol == NULL)
+		i = symbol_find(list, start, end - start);
+		if (i < 0)
 			error("symbol `%s' not found", start);
 		r = list[i].id;
 	}
@@ -309,401 +165,317 @@ static int symbol_get(const struct symbol_list *list, const char **symbol)
 	return r;
 }
 
-static long fsize(FILE *f)
+struct clip {
+	const unsigned char *data;	/* Input data after skipped bytes */
+	long size;			/* Bytes of input data */
+	int width, height, stride;
+	int out_width, out_height;	/* Size of output image */
+	__u32 format;
+	struct conv_output o;
+	int type;
+	int frames;
+	int frame_size;			/* Bytes of frame data */
+	long frame_stride;		/* Bytes from a frame to the next */
+	int header;			/* Bytes before data of each frame */
+	int skip;			/* Bytes before the first frame */
+	const char *out_name;
+	int out_fd;			/* Output file of streams */
+	int stream_header;		/* Bytes of stream header */
+	int next;			/* Next frame to convert */
+};
+
+struct batch {
+	const struct clip *c;		/* Parameters for all clips */
+	glob_t files;
+	const char *in_pattern;
+	int next;			/* Next file to convert */
+};
+
+
+static void pwrite_all(int fd, const void *data, size_t size, off_t offset)
 {
-	int i;
-	long p, s, r = 0;
-
-	p = ftell(f);
-	if (p == -1)
-		return -1;
-	i = fseek(f, 0, SEEK_END);
-	if (i == -1)
-		r = -1;
-	s = ftell(f);
-	if (s == -1)
-		r = -1;
-	i = fseek(f, p, SEEK_SET);
-	if (i != p)
-		r = -1;
-
-	return r == 0 ? s : r;
+	ssize_t r;
+
+	while (size > 0) {
+		r = pwrite(fd, data, size, offset);
+		if (r <= 0)
+			error("failed writing file");
+		data = (const char *)data + r;
+		size -= r;
+		offset += r;
+	}
 }
 
-static void *duplicate_buffer(void *buffer, int size, int new_size)
+/*
+ * Return output file name for the frame. @ in the output name is replaced
+ * with the frame number. Without @ the name of a single frame is used as is,
+ * else the number is added before the extension.
+ */
+static char *frame_name(const struct clip *c, int frame, char *b, int size)
 {
-	void *b = calloc(1, new_size);
-	if (!b)
-		error("out of memory, can not allocate %i bytes", new_size);
-	memcpy(b, buffer, MIN(size, new_size));
-	if (new_size > size)
-		print(1, "warning: input buffer too small by %i bytes, setting the rest to zero\n",
-			new_size - size);
+	static const char number_mark = '@';
+	const char *base, *m;
+	int r;
+
+	base = strrchr(c->out_name, '/');
+	base = base ? base + 1 : c->out_name;
+	if ((m = strrchr(c->out_name, number_mark))) {
+		r = snprintf(b, size, "%.*s%03i%s", (int)(m - c->out_name), c->out_name, frame, m + 1);
+	} else if (c->frames == 1) {
+		r = snprintf(b, size, "%s", c->out_name);
+	} else {
+		m = strrchr(base, '.');
+		if (!m || m == base)
+			m = base + strlen(base);
+		r = snprintf(b, size, "%.*s_%03i%s", (int)(m - c->out_name), c->out_name, frame, m);
+	}
+	if (r >= size)
+		error("too long filename");
 	return b;
 }
 
-static void inline yuv_to_rgb(unsigned char rgb[3], int y, int cb, int cr)
+static void write_pnm(const struct clip *c, const char *name, const void *data, int size)
 {
-	static const int R = 0;
-	static const int G = 1;
-	static const int B = 2;
-	int u = cb;
-	int v = cr;
-#if 0
-	/* http://www.fourcc.org/fccyvrgb.php */
-	rgb[B] = CLAMPB(1.164*(y - 16)                   + 2.018*(u - 128));
-	rgb[G] = CLAMPB(1.164*(y - 16) - 0.813*(v - 128) - 0.391*(u - 128));
-	rgb[R] = CLAMPB(1.164*(y - 16) + 1.596*(v - 128));
-#else
-	/* http://en.wikipedia.org/wiki/YUV
-	 * conversion from Y'UV to RGB (NTSC version): */
-	int c = y - 16;
-	int d = u - 128;
-	int e = v - 128;
-	rgb[R] = CLAMPB((298*c + 409*e + 128) >> 8);
-	rgb[G] = CLAMPB((298*c - 100*d - 208*e + 128) >> 8);
-	rgb[B] = CLAMPB((298*c + 516*d + 128) >> 8);
-#endif
+	char h[128];
+	FILE *f;
+	int i;
+
+	print(1, "Writing file `%s', %i bytes\n", name, size);
+	f = fopen(name, "wb");
+	if (!f) error("failed opening file");
+	i = conv_header(h, sizeof(h), c->type, &c->o, c->out_width, c->out_height);
+	if (i < 0 || fwrite(h, i, 1, f) != 1) error("can not write file header");
+	i = fwrite(data, size, 1, f);
+	if (i != 1) error("failed writing file");
+	fclose(f);
 }
 
-static inline unsigned int get_word(unsigned char *src, int bpp)
+/*
+ * Convert frames until all are done. Frames of streams are written
+ * into their own positions in the output file, so they can be
+ * converted in any order.
+ */
+static void *convert_frames(void *arg)
 {
-	unsigned int lo = src[0];
-	if (bpp == 1) {
-		return lo;
-	} else if (bpp == 2) {
-		unsigned int hi = src[1];
-		unsigned int w = (hi << 8) | lo;
-		return w;
-	} else error("bad bpp");
-	return 0;
+	static const char y4m_frame[] = CONV_Y4M_FRAME;
+	struct clip *c = arg;
+	const int out_size = c->out_width * c->out_height * c->o.channels * CONV_OUTPUT_BPS(&c->o);
+	unsigned char *out, *yuv = NULL;
+	char name[256];
+	long ofs;
+	int i, r;
+
+	out = malloc(out_size);
+	if (!out) error("can not allocate output buffer");
+	if (c->type == CONV_TYPE_Y4M && c->o.channels == 3) {
+		yuv = malloc(out_size);
+		if (!yuv) error("can not allocate output buffer");
+	}
+
+	while ((i = __sync_fetch_and_add(&c->next, 1)) < c->frames) {
+		ofs = c->header + i * c->frame_stride;
+		r = conv_convert((void *)(c->data + ofs), MIN(c->frame_size, c->size - ofs),
+				 c->width, c->height, c->stride, c->format, &c->o, out);
+		if (r < 0) error("failed to convert image");
+
+		switch (c->type) {
+		case CONV_TYPE_RGB:
+			pwrite_all(c->out_fd, out, out_size,
+				   c->stream_header + (off_t)i * out_size);
+			break;
+		case CONV_TYPE_Y4M:
+			ofs = c->stream_header + (off_t)i * (out_size + strlen(y4m_frame));
+			pwrite_all(c->out_fd, y4m_frame, strlen(y4m_frame), ofs);
+			if (yuv)
+				conv_rgb_to_yuv444(out, yuv, c->out_width * c->out_height);
+			pwrite_all(c->out_fd, yuv ? yuv : out, out_size, ofs + strlen(y4m_frame));
+			break;
+		default:
+			write_pnm(c, frame_name(c, i, name, sizeof(name)), out, out_size);
+			break;
+		}
+	}
+
+	free(out);
+	free(yuv);
+	return NULL;
 }
 
-/* Return 24 bits-per-pixel RGB image */
-static int convert(void *in_buffer, int in_size, int width, int height, int stride, __u32 format, void *out_buffer)
+/*
+ * Map the input file and convert the requested number of frames
+ * (0 for all) with the given number of worker threads.
+ */
+static void convert_clip(struct clip *c, const char *in_name, int workers)
 {
-	static const int dbpp = 3;
-	int y, x, r, g, b, bpp, shift;
-	int oddrow, oddpix, initrow, initpix, lumaofs, chromaord, subsample;
-	unsigned char *src = NULL, *dst = NULL;
-	unsigned char *s, *u;
-	unsigned char *d = out_buffer;
-	unsigned int dstride = width * dbpp;
-
-	switch (format) {
-	case V4L2_PIX_FMT_YUYV:
-	case V4L2_PIX_FMT_UYVY:
-	case V4L2_PIX_FMT_YVYU:
-	case V4L2_PIX_FMT_VYUY:
-		if (stride <= 0) stride = width * 2;
-		s = src = duplicate_buffer(in_buffer, in_size, stride * height);
-		lumaofs = (format==V4L2_PIX_FMT_YUYV || format==V4L2_PIX_FMT_YVYU) ? 0 : 1;
-		chromaord = (format==V4L2_PIX_FMT_YUYV || format==V4L2_PIX_FMT_UYVY) ? 0 : 1;
-		for (y = 0; y < height; y++) {
-			unsigned char *s1 = s;
-			unsigned char *d1 = d;
-			int cb = 0, cr = 0;
-			for (x = 0; x < width; x++) {
-				int b = s1[lumaofs];
-				if ((x & 1) == chromaord)
-					cb = s1[lumaofs^1];
-				else
-					cr = s1[lumaofs^1];
-				yuv_to_rgb(d1, b, cb, cr);
-				s1 += 2;
-				d1 += dbpp;
-			}
-			s += stride;
-			d += dstride;
-		}
-		break;
-
-	case V4L2_PIX_FMT_NV12:
-	case V4L2_PIX_FMT_NV21:
-	case V4L2_PIX_FMT_NV24:
-	case V4L2_PIX_FMT_NV42:
-		subsample = (format == V4L2_PIX_FMT_NV12 ||
-			     format == V4L2_PIX_FMT_NV21) ? 2 : 1;
-		chromaord = (format == V4L2_PIX_FMT_NV12 ||
-			     format == V4L2_PIX_FMT_NV24) ? 0 : 1;
-		if (stride <= 0) stride = width;
-		s = src = duplicate_buffer(in_buffer, in_size, stride * height*3/subsample);
-		u = &s[height * stride];
-		for (y = 0; y < height; y++) {
-			unsigned char *s1 = s;
-			unsigned char *u1 = u;
-			unsigned char *d1 = d;
-			for (x = 0; x < width; x++) {
-				int b = *s1;
-				int cb = u1[chromaord];
-				int cr = u1[chromaord ^ 1];
-				yuv_to_rgb(d1, b, cb, cr);
-				s1 += 1;
-				d1 += dbpp;
-				if (subsample == 1 ||
-				   (subsample == 2 && (x & 1)))
-					u1 += 2;
-			}
-			s += stride;
-			if (subsample == 1 ||
-			   (subsample == 2 && (y & 1)))
-				u += 2 * stride / subsample;
-			d += dstride;
-		}
-		break;
-
-	case V4L2_PIX_FMT_YYUV420_V32: {
-		static const int VEC_SIZE = (64 + 2*32 + 64) * 2;	/* In bytes */
-		static const int LUMA_SHIFT = 8;			/* In theory 8, 7 gives brighter image */
-		static const int CHROMA_SHIFT = 6;			/* Should be verified */
-
-		if (width & 63) print(0, "WARNING: width would be better to be multiple of 64\n");
-		if (height & 1) error("height must be multiple of 2");
-
-		stride = width;		/*	 Stride on the input buffer is meaningless, so overwrite it */
-		s = src = duplicate_buffer(in_buffer, in_size, 2 * width * height * 3/2);
-		d = dst = calloc(1, stride * height * 3/2);
-
-		for (y = 0; y < height; y += 2) {
-			for (x = 0; x < width; x += 64) {
-				int y0, x0, p, c;
-				/* Luma */
-				for (y0 = 0; y0 < 2; y0++) for (x0 = 0; x0 < 64; x0++) {
-					uint16_t *s0 = (uint16_t *)s;
-					int x1 = (x0 & 31) | (y0 << 5);
-					int y1 = (x0 & 32) >> 5;
-					p = s0[y1 * 128 + x1] >> LUMA_SHIFT;
-					d[(y+y0)*stride + x+x0] = CLAMPB(p);
-				}
-				/* Chroma */
-				for (x0 = 0; x0 < 32; x0++) for (c = 0; c < 2; c++) {
-					int16_t *s0 = (int16_t *)s;
-					p = s0[64 + x0 + 32 * c];
-					d[stride*height + stride*(y/2) + x + x0*2 + c] =
-							CLAMPB((p >> CHROMA_SHIFT) + 128);
-				}
-				s += VEC_SIZE;
-			}
-		}
-		r = convert(dst, stride * height * 3/2, width, height, stride, V4L2_PIX_FMT_NV12, out_buffer);
-		if (r) error("conversion failed");
-		break;
+	const int skip = c->skip;
+	int frames = c->frames;
+	pthread_t tid[MAX_THREADS];
+	struct stat st;
+	void *map;
+	int fd;
+	int i, e;
+
+	print(1, "Reading file `%s', %ix%i stride %i format %s, skip %i\n",
+		in_name, c->width, c->height, c->stride, symbol_str(c->format, symbol_pixelformats), skip);
+	fd = open(in_name, O_RDONLY);
+	if (fd < 0) error("failed opening file");
+	if (fstat(fd, &st) < 0) error("error checking file size");
+	print(2, "File size %li bytes, data size %li bytes\n", (long)st.st_size, (long)st.st_size - skip);
+	if (skip >= st.st_size) error("no data left to read");
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) error("failed to map file");
+	close(fd);
+
+	c->data = (const unsigned char *)map + skip;
+	c->size = st.st_size - skip;
+	if (frames == 0)
+		frames = c->size >= c->header + c->frame_size ?
+			 (c->size - c->header - c->frame_size) / c->frame_stride + 1 : 1;
+	if (c->header + (frames - 1) * c->frame_stride >= c->size)
+		error("file has data for only %li frames",
+		      (c->size - c->header + c->frame_stride - 1) / c->frame_stride);
+	c->frames = frames;
+	c->next = 0;
+
+	if (CONV_TYPE_STREAM(c->type)) {
+		char h[128];
+		conv_header(h, sizeof(h), c->type, &c->o, c->out_width, c->out_height);
+		print(1, "Writing %i frames to `%s'\n", frames, c->out_name);
+		c->out_fd = open(c->out_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (c->out_fd < 0) error("failed opening file");
+		c->stream_header = strlen(h);
+		pwrite_all(c->out_fd, h, c->stream_header, 0);
 	}
 
-	case V4L2_PIX_FMT_GREY:
-	case V4L2_PIX_FMT_Y16:
-		bpp = (format == V4L2_PIX_FMT_Y16) ? 2 : 1;
-		if (stride <= 0) stride = width * bpp;
-		s = src = duplicate_buffer(in_buffer, in_size, stride * height);
-		for (y = 0; y < height; y++) {
-			unsigned char *s1 = s;
-			unsigned char *d1 = d;
-			for (x = 0; x < width; x++) {
-				int b = s1[0];
-				if (bpp == 2) {
-					b |= s1[1] << 8;
-					if (b > 1023) error("Y16 image not in range 0..1023");
-					b >>= 2;
-				}
-				d1[0] = b;
-				d1[1] = b;
-				d1[2] = b;
-				s1 += bpp;
-				d1 += dbpp;
-			}
-			s += stride;
-			d += dstride;
-		}
-		break;
-
-	case V4L2_PIX_FMT_BGR24:
-	case V4L2_PIX_FMT_RGB24:
-		bpp = 3;
-		if (stride <= 0) stride = width * bpp;
-		s = src = duplicate_buffer(in_buffer, in_size, stride * height);
-		for (y = 0; y < height; y++) {
-			unsigned char *s1 = s;
-			unsigned char *d1 = d;
-			for (x = 0; x < width; x++) {
-				if (format == V4L2_PIX_FMT_RGB24) {
-					d1[0] = s1[0];
-					d1[2] = s1[2];
-				} else {
-					d1[0] = s1[2];
-					d1[2] = s1[0];
-				}
-				d1[1] = s1[1];
-				s1 += bpp;
-				d1 += dbpp;
-			}
-			s += stride;
-			d += dstride;
-		}
-		break;
-
-	case V4L2_PIX_FMT_SBGGR10V32:
-	case V4L2_PIX_FMT_SGBRG10V32:
-	case V4L2_PIX_FMT_SGRBG10V32:
-	case V4L2_PIX_FMT_SRGGB10V32:
-	case V4L2_PIX_FMT_SBGGR12V32:
-	case V4L2_PIX_FMT_SGBRG12V32:
-	case V4L2_PIX_FMT_SGRBG12V32:
-	case V4L2_PIX_FMT_SRGGB12V32:
-		if (format == V4L2_PIX_FMT_SBGGR10V32) format = V4L2_PIX_FMT_SBGGR10;
-		if (format == V4L2_PIX_FMT_SGBRG10V32) format = V4L2_PIX_FMT_SGBRG10;
-		if (format == V4L2_PIX_FMT_SGRBG10V32) format = V4L2_PIX_FMT_SGRBG10;
-		if (format == V4L2_PIX_FMT_SRGGB10V32) format = V4L2_PIX_FMT_SRGGB10;
-		if (format == V4L2_PIX_FMT_SBGGR12V32) format = V4L2_PIX_FMT_SBGGR12;
-		if (format == V4L2_PIX_FMT_SGBRG12V32) format = V4L2_PIX_FMT_SGBRG12;
-		if (format == V4L2_PIX_FMT_SGRBG12V32) format = V4L2_PIX_FMT_SGRBG12;
-		if (format == V4L2_PIX_FMT_SRGGB12V32) format = V4L2_PIX_FMT_SRGGB12;
-
-		if (width & 1) error("must be even image width");
-		if (height & 1) error("must be even image height");
-
-		bpp = 2;
-		if (stride <= 0) stride = width * bpp;
-		s = src = duplicate_buffer(in_buffer, in_size, stride * height);
-		d = dst = calloc(1, stride * height);
-
-		for (y = 0; y < height; y += 2) {
-			unsigned char *d0 = d;
-			unsigned char *s0 = s;
-			for (x = 0; x < width; x += 64) {
-				for (b = 0; b < 32; b++) {
-					if (x + b*2 >= width) break;
-					d0[b*4+0] = s0[b*2+0];			// Gr
-					d0[b*4+1] = s0[b*2+1];
-					d0[b*4+2] = s0[b*2+64];			// R
-					d0[b*4+3] = s0[b*2+65];
-					d0[stride+b*4+0] = s0[b*2+128];		// B
-					d0[stride+b*4+1] = s0[b*2+129];
-					d0[stride+b*4+2] = s0[b*2+192];		// Gb
-					d0[stride+b*4+3] = s0[b*2+193];
-				}
-				s0 += 4 * 32 * 2;
-				d0 += 64 * bpp;
-			}
-			d += 2 * stride;
-			s += 2 * stride;
+	workers = MIN(workers, frames);
+	if (workers > 1)
+		frame_threads = workers;
+	c->o.threads = threads / frame_threads;
+	for (i = 1; i < workers; i++) {
+		e = pthread_create(&tid[i], NULL, convert_frames, c);
+		if (e) {
+			errno = e;
+			error("failed to create thread");
 		}
+	}
+	convert_frames(c);
+	for (i = 1; i < workers; i++)
+		pthread_join(tid[i], NULL);
+
+	if (c->out_fd >= 0 && close(c->out_fd) < 0)
+		error("failed writing file");
+	c->out_fd = -1;
+	munmap(map, st.st_size);
+}
 
-		r = convert(dst, stride * height, width, height, stride, format, out_buffer);
-		if (r) error("conversion failed");
-		break;
-
-	case V4L2_PIX_FMT_SBGGR8:		/* 1 byte per pixel, little endian */
-	case V4L2_PIX_FMT_SGBRG8:
-	case V4L2_PIX_FMT_SRGGB8:
-	case V4L2_PIX_FMT_SGRBG8:
-	case V4L2_PIX_FMT_SBGGR10:		/* 2 bytes per pixel, little endian */
-	case V4L2_PIX_FMT_SGBRG10:
-	case V4L2_PIX_FMT_SRGGB10:
-	case V4L2_PIX_FMT_SGRBG10:
-	case V4L2_PIX_FMT_SBGGR12:		/* 2 bytes per pixel, little endian */
-	case V4L2_PIX_FMT_SGBRG12:
-	case V4L2_PIX_FMT_SRGGB12:
-	case V4L2_PIX_FMT_SGRBG12:
-	case V4L2_PIX_FMT_SBGGR14:		/* 2 bytes per pixel, little endian */
-	case V4L2_PIX_FMT_SGBRG14:
-	case V4L2_PIX_FMT_SRGGB14:
-	case V4L2_PIX_FMT_SGRBG14:
-	case V4L2_PIX_FMT_SBGGR16:
-		if (format == V4L2_PIX_FMT_SBGGR8 ||
-		    format == V4L2_PIX_FMT_SBGGR10 ||
-		    format == V4L2_PIX_FMT_SBGGR12 ||
-		    format == V4L2_PIX_FMT_SBGGR14 ||
-		    format == V4L2_PIX_FMT_SBGGR16) { initrow = 1; initpix = 0; } else
-		if (format == V4L2_PIX_FMT_SGBRG8 ||
-		    format == V4L2_PIX_FMT_SGBRG10 ||
-		    format == V4L2_PIX_FMT_SGBRG12 ||
-		    format == V4L2_PIX_FMT_SGBRG14) { initrow = 1; initpix = 1; } else
-		if (format == V4L2_PIX_FMT_SRGGB8 ||
-		    format == V4L2_PIX_FMT_SRGGB10 ||
-		    format == V4L2_PIX_FMT_SRGGB12 ||
-		    format == V4L2_PIX_FMT_SRGGB14) { initrow = 0; initpix = 1; } else
-		if (format == V4L2_PIX_FMT_SGRBG8 ||
-		    format == V4L2_PIX_FMT_SGRBG10 ||
-		    format == V4L2_PIX_FMT_SGRBG12 ||
-		    format == V4L2_PIX_FMT_SGRBG14) { initrow = 0; initpix = 0; }
-		if (format == V4L2_PIX_FMT_SBGGR8 ||
-	 	    format == V4L2_PIX_FMT_SGBRG8 ||
-		    format == V4L2_PIX_FMT_SRGGB8 ||
-		    format == V4L2_PIX_FMT_SGRBG8) {
-			bpp = 1;	/* 8 bits per pixel */
-			shift = 0;
-		} else if (format == V4L2_PIX_FMT_SBGGR10 ||
-			   format == V4L2_PIX_FMT_SGBRG10 ||
-		 	   format == V4L2_PIX_FMT_SRGGB10 ||
-			   format == V4L2_PIX_FMT_SGRBG10) {
-			bpp = 2;	/* 10 bits per pixel */
-			shift = 2;
-		} else if (format == V4L2_PIX_FMT_SBGGR12 ||
-			   format == V4L2_PIX_FMT_SGBRG12 ||
-		 	   format == V4L2_PIX_FMT_SRGGB12 ||
-			   format == V4L2_PIX_FMT_SGRBG12) {
-			bpp = 2;
-			shift = 4;	/* 12 bits per pixel */
-		} else if (format == V4L2_PIX_FMT_SBGGR14 ||
-			   format == V4L2_PIX_FMT_SGBRG14 ||
-		 	   format == V4L2_PIX_FMT_SRGGB14 ||
-			   format == V4L2_PIX_FMT_SGRBG14) {
-			bpp = 2;
-			shift = 6;	/* 14 bits per pixel */
-		} else {
-			bpp = 2;
-			shift = 8;	/* 16 bits per pixel */
-		}
+/* Return glob pattern for the name, where @ matches a frame number */
+static char *batch_pattern(const char *name)
+{
+	static const char number[] = "[0-9][0-9][0-9]*";
+	const char *m = strchr(name, '@');
+	char *p;
+
+	p = malloc(strlen(name) + sizeof(number));
+	if (!p) error("out of memory");
+	if (m)
+		sprintf(p, "%.*s%s%s", (int)(m - name), name, number, m + 1);
+	else
+		strcpy(p, name);
+	return p;
+}
 
-		if (stride <= 0) stride = width * bpp;
-		s = src = duplicate_buffer(in_buffer, in_size, stride * height);
-		r = g = b = 0;
-		oddrow = initrow;
-		for (y = 0; y < height; y++) {
-			unsigned char *s1 = s;
-			unsigned char *d1 = d;
-			oddpix = initpix;
-			for (x = 0; x < width; x++) {
-				if (!oddrow) {
-					if (!oddpix) g = get_word(s1, bpp);
-					if ( oddpix) r = get_word(s1, bpp);
-					if (!oddpix && y > 0) b = get_word(s1 - stride, bpp);
-				} else {
-					if (!oddpix) b = get_word(s1, bpp);
-					if ( oddpix) g = get_word(s1, bpp);
-					if ( oddpix && y > 0) r = get_word(s1 - stride, bpp);
-				}
-				d1[0] = r >> shift;
-				d1[1] = g >> shift;
-				d1[2] = b >> shift;
-				s1 += bpp;
-				d1 += dbpp;
-				oddpix ^= 1;
-			}
-			s += stride;
-			d += dstride;
-			oddrow ^= 1;
-		}
-		break;
+/*
+ * Return output file name for an input file matching the pattern:
+ * @ in output name is replaced with the part of the input file name
+ * between the fixed beginning and end of the pattern.
+ */
+static char *batch_name(const char *pattern, const char *in_name, const char *out_name)
+{
+	static const char wildcards[] = "@*?[";
+	const char *first = strpbrk(pattern, wildcards);
+	const char *last = first;
+	const char *m = strchr(out_name, '@');
+	int prefix, suffix;
+	char *p;
+
+	while (strpbrk(last + 1, wildcards))
+		last = strpbrk(last + 1, wildcards);
+	if (*last == '[' && strchr(last, ']'))
+		last = strchr(last, ']');
+	prefix = first - pattern;
+	suffix = strlen(last + 1);
+	if (prefix + suffix > strlen(in_name))
+		prefix = suffix = 0;
+
+	p = malloc(strlen(in_name) + strlen(out_name));
+	if (!p) error("out of memory");
+	sprintf(p, "%.*s%.*s%s", (int)(m - out_name), out_name,
+		(int)(strlen(in_name) - prefix - suffix), in_name + prefix, m + 1);
+	return p;
+}
 
-	default:
-		errno = EINVAL;
-		return -1;
+/*
+ * Convert files until all are done. Each worker has one input file
+ * mapped and one output buffer at a time, so the memory in use does
+ * not depend on the number of files.
+ */
+static void *convert_files(void *arg)
+{
+	struct batch *b = arg;
+	struct clip c;
+	char *out_name;
+	int i;
+
+	while ((i = __sync_fetch_and_add(&b->next, 1)) < b->files.gl_pathc) {
+		const char *in_name = b->files.gl_pathv[i];
+		c = *b->c;
+		out_name = batch_name(b->in_pattern, in_name, c.out_name);
+		c.out_name = out_name;
+		convert_clip(&c, in_name, 1);
+		free(out_name);
 	}
 
-	free(src);
-	free(dst);
-	return 0;
+	return NULL;
+}
+
+static void convert_batch(const struct clip *c, const char *in_name)
+{
+	pthread_t workers[MAX_THREADS];
+	struct batch b = { .c = c };
+	int i, e;
+
+	if (!strchr(c->out_name, '@'))
+		error("output file name must contain @ when converting multiple files");
+
+	b.in_pattern = batch_pattern(in_name);
+	e = glob(b.in_pattern, 0, NULL, &b.files);
+	if (e == GLOB_NOMATCH)
+		error("no files matching `%s'", b.in_pattern);
+	if (e)
+		error("failed to list files");
+	print(1, "Converting %i files using %i threads\n", (int)b.files.gl_pathc, threads);
+
+	/* Convert one file per thread, frames of each file serially */
+	frame_threads = MIN(threads, b.files.gl_pathc);
+	for (i = 1; i < frame_threads; i++) {
+		e = pthread_create(&workers[i], NULL, convert_files, &b);
+		if (e) {
+			errno = e;
+			error("failed to create thread");
+		}
+	}
+	convert_files(&b);
+	for (i = 1; i < frame_threads; i++)
+		pthread_join(workers[i], NULL);
+
+	globfree(&b.files);
+	free((char *)b.in_pattern);
 }
 
 int main(int argc, char *argv[])
 {
+	struct clip c = { .out_fd = -1 };
 	char *in_name = NULL;
-	char *out_name = NULL;
-	void *in_buffer;
-	void *out_buffer;
-	int in_size, out_size;
-	FILE *f;
 	int i;
 
 	int opt;
@@ -712,12 +484,25 @@ int main(int argc, char *argv[])
 	int stride = -1;
 	int skip = 0;
 	__u32 format = 0;
-
-	while ((opt = getopt(argc, argv, "hf:x:y:s:b:")) != -1) {
+	int type = CONV_TYPE_PPM;
+	int depth = 8;
+	int frames = 1;
+	long frame_stride = 0;
+	int header = 0;
+	int scale = 1;
+	int crop[4] = { 0, 0, 0, 0 };
+	int rotate = 0;
+	char flip[3] = "";
+	int orient;
+
+	conv_set_handlers(conv_error, conv_warning);
+	threads = CLAMP(sysconf(_SC_NPROCESSORS_ONLN), 1, MAX_THREADS);
+
+	while ((opt = getopt(argc, argv, "hf:x:y:s:b:j:t:d:S:c:R:M:n:F:H:")) != -1) {
 		switch (opt) {
 		case 'f': {
 			const char *t = optarg;
-			format = symbol_get(pixelformats, &t);
+			format = symbol_get(symbol_pixelformats, &t);
 			break;
 		}
 		case 'x':
@@ -732,10 +517,49 @@ int main(int argc, char *argv[])
 		case 'b':
 			skip = atoi(optarg);
 			break;
+		case 'j':
+			threads = CLAMP(atoi(optarg), 1, MAX_THREADS);
+			break;
+		case 't':
+			type = conv_type(optarg);
+			if (type < 0)
+				error("bad output file type `%s'", optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			if (depth != 8 && depth != 16)
+				error("output depth must be 8 or 16");
+			break;
+		case 'S':
+			/* Accept both 1/4 and 4 */
+			scale = atoi(strchr(optarg, '/') ? strchr(optarg, '/') + 1 : optarg);
+			if (scale < 1 || scale > CONV_MAX_SCALE || (scale > 1 && (scale & 1)))
+				error("scale must be 1 or even number up to %i", CONV_MAX_SCALE);
+			break;
+		case 'c':
+			if (sscanf(optarg, "%i,%i,%i,%i", &crop[0], &crop[1], &crop[2], &crop[3]) != 4)
+				error("region must be given as x,y,width,height");
+			break;
+		case 'R':
+			rotate = atoi(optarg);
+			break;
+		case 'M':
+			strncat(flip, optarg, sizeof(flip) - 1 - strlen(flip));
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			if (frames < 0) error("bad number of frames");
+			break;
+		case 'F':
+			frame_stride = atol(optarg);
+			break;
+		case 'H':
+			header = atoi(optarg);
+			break;
 		default:
 			usage();
 			print(1, "Available formats:\n");
-			symbol_dump(V4L2_PIX_FMT, pixelformats);
+			symbol_dump(V4L2_PIX_FMT, symbol_pixelformats);
 			return -1;
 	        }
 	}
@@ -744,40 +568,45 @@ int main(int argc, char *argv[])
 		error("input or output filename missing");
 
 	in_name = argv[optind++];
-	out_name = argv[optind++];
-
-	print(1, "Reading file `%s', %ix%i stride %i format %s, skip %i\n",
-		in_name, width, height, stride, symbol_str(format, pixelformats), skip);
-	f = fopen(in_name, "rb");
-	if (!f) error("failed opening file");
-	in_size = fsize(f);
-	if (in_size == -1) error("error checking file size");
-	print(2, "File size %i bytes, data size %i bytes\n", in_size, in_size - skip);
-	if (skip >= in_size) error("no data left to read");
-	if (fseek(f, skip, SEEK_SET) != 0) error("seeking failed");
-	in_size -= skip;
-	in_buffer = malloc(in_size);
-	if (!in_buffer) error("can not allocate input buffer");
-	i = fread(in_buffer, in_size, 1, f);
-	if (i != 1) error("failed reading file");
-	fclose(f);
+	c.out_name = argv[optind++];
 
-	out_size = width * height * 3;
-	out_buffer = malloc(out_size);
-	if (!out_buffer) error("can not allocate output buffer");
-	i = convert(in_buffer, in_size, width, height, stride, format, out_buffer);
-	if (i < 0) error("failed to convert image");
-	free(in_buffer);
-
-	print(1, "Writing file `%s', %i bytes\n", out_name, out_size);
-	f = fopen(out_name, "wb");
-	if (!f) error("failed opening file");
-	i = fprintf(f, "P6\n%i %i 255\n", width, height);
-	if (i < 0) error("can not write file header");
-	i = fwrite(out_buffer, out_size, 1, f);
-	if (i != 1) error("failed writing file");
-	fclose(f);
+	c.frame_size = conv_frame_size(format, width, height, &stride);
+	if (c.frame_size < 0) {
+		errno = EINVAL;
+		error("unsupported format %s", symbol_str(format, symbol_pixelformats));
+	}
+	if (frame_stride <= 0)
+		frame_stride = header + c.frame_size;
+
+	c.width = width;
+	c.height = height;
+	orient = orient_rotate(rotate);
+	for (i = 0; orient >= 0 && flip[i]; i++)
+		orient = orient_flip(orient, flip[i]);
+	if (orient < 0)
+		error("bad rotation or flip");
+	c.stride = stride;
+	c.format = format;
+	c.type = type;
+	c.frames = frames;
+	c.frame_stride = frame_stride;
+	c.header = header;
+	c.skip = skip;
+
+	if (conv_output_init(&c.o, format, type, depth, scale) < 0)
+		error("y4m output supports only 8 bits per sample");
+	c.o.x = crop[0];
+	c.o.y = crop[1];
+	c.o.width = crop[2];
+	c.o.height = crop[3];
+	c.o.orient = orient;
+	conv_output_size(&c.o, width, height, &c.out_width, &c.out_height);
+
+	/* A file whose name has @ or wildcards is still converted alone */
+	if (strpbrk(in_name, "@*?[") && access(in_name, F_OK) < 0)
+		convert_batch(&c, in_name);
+	else
+		convert_clip(&c, in_name, threads);
 
-	free(out_buffer);
 	return 0;
 }
@@ -0,0 +1,316 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "cpulib.h"
+#ifdef CPU_X86
+#include <tmmintrin.h>
+#endif
+#include "utillib.h"
+#include "rawlib.h"
+
+#define MIN(a,b)	((a) <= (b) ? (a) : (b))
+#define SIZE(x)		(sizeof(x)/sizeof((x)[0]))
+
+static const struct {
+	const char *name;
+	int color[4];
+} raw_cfa[] = {
+	{ "SGRBG", { 1, 0, 2, 1 } },
+	{ "SRGGB", { 0, 1, 1, 2 } },
+	{ "SBGGR", { 2, 1, 1, 0 } },
+	{ "SGBRG", { 1, 2, 0, 1 } },
+};
+
+int raw_format_parse(struct raw_format *f, const char *name)
+{
+	char *end;
+	int i;
+
+	for (i = 0; i < SIZE(raw_cfa); i++)
+		if (!strncmp(name, raw_cfa[i].name, 5))
+			break;
+	if (i >= SIZE(raw_cfa))
+		return -1;
+	memcpy(f->color, raw_cfa[i].color, sizeof(f->color));
+
+	f->bits = strtol(name + 5, &end, 10);
+	f->packed = !strcmp(end, "P");
+	if (*end && !f->packed)
+		return -1;
+	if (f->bits == 8)
+		return f->packed ? -1 : 0;
+	if (f->bits != 10 && f->bits != 12 && f->bits != 14)
+		return -1;
+	return 0;
+}
+
+int raw_line_pixels(const struct raw_format *f, int bytes)
+{
+	if (f->packed)
+		return bytes * 8 / f->bits;
+	return f->bits > 8 ? bytes / 2 : bytes;
+}
+
+int raw_line_size(const struct raw_format *f, int width)
+{
+	if (f->packed)
+		return (width * f->bits + 7) / 8;
+	return f->bits > 8 ? width * 2 : width;
+}
+
+void raw_mosaic_row(const struct pnm_image *img, int y, const struct raw_format *f,
+		    unsigned short *row)
+{
+	const int step = img->channels * img->bps;
+	const int shift = 16 - f->bits;
+	const unsigned char *s = img->data + (long)y * img->width * step;
+	const unsigned char *end = s + img->width * step;
+	int c0 = f->color[(y & 1) * 2];
+	int c1 = f->color[(y & 1) * 2 + 1];
+
+	if (img->channels < 3)
+		c0 = c1 = 0;
+
+	/* 8-bit samples are scaled to 16 bits by repeating the byte */
+	if (img->bps == 1) {
+		for (; s + 2 * step <= end; s += 2 * step) {
+			*row++ = s[c0] * 257 >> shift;
+			*row++ = s[step + c1] * 257 >> shift;
+		}
+		if (s < end)
+			*row = s[c0] * 257 >> shift;
+		return;
+	}
+
+	c0 *= 2;
+	c1 *= 2;
+	for (; s + 2 * step <= end; s += 2 * step) {
+		*row++ = ((s[c0] << 8) | s[c0 + 1]) >> shift;
+		*row++ = ((s[step + c1] << 8) | s[step + c1 + 1]) >> shift;
+	}
+	if (s < end)
+		*row = ((s[c0] << 8) | s[c0 + 1]) >> shift;
+}
+
+void raw_pack_row(const struct raw_format *f, const unsigned short *row, int width,
+		  unsigned char *out)
+{
+	const int lsb_bits = f->bits - 8;
+	const unsigned int lsb_mask = (1 << lsb_bits) - 1;
+	int x = 0, i;
+
+	if (!f->packed) {
+		if (f->bits == 8) {
+			for (; x < width; x++)
+				out[x] = row[x];
+			return;
+		}
+		for (; x < width; x++) {
+			*out++ = row[x] & 0xff;
+			*out++ = row[x] >> 8;
+		}
+		return;
+	}
+
+	/* Whole groups */
+	switch (f->bits) {
+	case 10:
+		for (; x + 4 <= width; x += 4, row += 4, out += 5) {
+			out[0] = row[0] >> 2;
+			out[1] = row[1] >> 2;
+			out[2] = row[2] >> 2;
+			out[3] = row[3] >> 2;
+			out[4] = (row[0] & 3) | (row[1] & 3) << 2 |
+				 (row[2] & 3) << 4 | (row[3] & 3) << 6;
+		}
+		break;
+	case 12:
+		for (; x + 2 <= width; x += 2, row += 2, out += 3) {
+			out[0] = row[0] >> 4;
+			out[1] = row[1] >> 4;
+			out[2] = (row[0] & 15) | (row[1] & 15) << 4;
+		}
+		break;
+	case 14:
+		for (; x + 4 <= width; x += 4, row += 4, out += 7) {
+			unsigned int lsbs = (row[0] & 63) | (row[1] & 63) << 6 |
+					    (row[2] & 63) << 12 | (row[3] & 63) << 18;
+			out[0] = row[0] >> 6;
+			out[1] = row[1] >> 6;
+			out[2] = row[2] >> 6;
+			out[3] = row[3] >> 6;
+			out[4] = lsbs;
+			out[5] = lsbs >> 8;
+			out[6] = lsbs >> 16;
+		}
+		break;
+	}
+
+	/* Partial group at the end of the line, padded with zero bits */
+	if (x < width) {
+		int n = width - x;
+		unsigned int lsbs = 0;
+
+		for (i = 0; i < n; i++) {
+			*out++ = row[i] >> lsb_bits;
+			lsbs |= (row[i] & lsb_mask) << (i * lsb_bits);
+		}
+		for (i = 0; i < n * lsb_bits; i += 8, lsbs >>= 8)
+			*out++ = lsbs;
+	}
+}
+
+static inline void put_le16(unsigned char *d, unsigned int v)
+{
+	d[0] = v & 0xff;
+	d[1] = (v >> 8) & 0xff;
+}
+
+/*
+ * MIPI CSI-2 packing: a group of pixels stores the 8 most significant
+ * bits of each pixel in a byte, followed by the remaining bits of the
+ * pixels, first pixel in the lowest bits:
+ * RAW10 p0[9:2] p1[9:2] p2[9:2] p3[9:2] p3[1:0]p2[1:0]p1[1:0]p0[1:0]
+ * RAW12 p0[11:4] p1[11:4] p1[3:0]p0[3:0]
+ * RAW14 p0[13:6] p1[13:6] p2[13:6] p3[13:6]
+ *       p1[1:0]p0[5:0] p2[3:0]p1[5:2] p3[5:0]p2[5:4]
+ *
+ * With SSSE3, used from CPU level SSE4.2 up, 8 pixels are unpacked at
+ * a time, each pixel is
+ * (msb << msb_shift) | ((lsbs * lsb_mul) >> lsb_shift) & lsb_mask
+ * where msb is the byte with most significant bits and lsbs is the
+ * byte (or two bytes) containing the least significant bits of the pixel.
+ */
+struct mipi_shuffle {
+	int bytes;			/* Input bytes for 8 pixels */
+	int msb_shift;
+	int lsb_shift;
+	int lsb_mask;
+	unsigned char msb[16];
+	unsigned char lsb[16];
+	short lsb_mul[8];
+};
+
+#define Z	0x80			/* pshufb: zero the byte */
+static const struct mipi_packing {
+	int bits;
+	int pixels;			/* Pixels in a group */
+	int bytes;			/* Bytes taken by a group */
+	struct mipi_shuffle shuffle;
+} mipi_packings[] = {
+	{ 10, 4, 5, { 10, 2, 6, 0x03,
+		{ 0, Z, 1, Z, 2, Z, 3, Z, 5, Z, 6, Z, 7, Z, 8, Z },
+		{ 4, Z, 4, Z, 4, Z, 4, Z, 9, Z, 9, Z, 9, Z, 9, Z },
+		{ 1 << 6, 1 << 4, 1 << 2, 1, 1 << 6, 1 << 4, 1 << 2, 1 } } },
+	{ 12, 2, 3, { 12, 4, 4, 0x0f,
+		{ 0, Z, 1, Z, 3, Z, 4, Z, 6, Z, 7, Z, 9, Z, 10, Z },
+		{ 2, Z, 2, Z, 5, Z, 5, Z, 8, Z, 8, Z, 11, Z, 11, Z },
+		{ 1 << 4, 1, 1 << 4, 1, 1 << 4, 1, 1 << 4, 1 } } },
+	{ 14, 4, 7, { 14, 6, 6, 0x3f,
+		{ 0, Z, 1, Z, 2, Z, 3, Z, 7, Z, 8, Z, 9, Z, 10, Z },
+		{ 4, 5, 4, 5, 5, 6, 6, Z, 11, 12, 11, 12, 12, 13, 13, Z },
+		{ 1 << 6, 1, 1 << 2, 1 << 4, 1 << 6, 1, 1 << 2, 1 << 4 } } },
+};
+#undef Z
+
+#ifdef CPU_X86
+/* Return the number of pixels unpacked */
+static int CPU_TARGET("ssse3") mipi_unpack_ssse3(const struct mipi_shuffle *m, const unsigned char *s,
+			     int bytes, unsigned char *d, int width)
+{
+	const __m128i msb = _mm_loadu_si128((const __m128i *)m->msb);
+	const __m128i lsb = _mm_loadu_si128((const __m128i *)m->lsb);
+	const __m128i mul = _mm_loadu_si128((const __m128i *)m->lsb_mul);
+	const __m128i mask = _mm_set1_epi16(m->lsb_mask);
+	const __m128i msb_shift = _mm_cvtsi32_si128(m->msb_shift);
+	const __m128i lsb_shift = _mm_cvtsi32_si128(m->lsb_shift);
+	int x;
+
+	/* Stop when less than 16 bytes are left in the row */
+	for (x = 0; x + 8 <= width && bytes >= 16; x += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i hi = _mm_sll_epi16(_mm_shuffle_epi8(v, msb), msb_shift);
+		__m128i lo = _mm_mullo_epi16(_mm_shuffle_epi8(v, lsb), mul);
+		lo = _mm_and_si128(_mm_srl_epi16(lo, lsb_shift), mask);
+		_mm_storeu_si128((__m128i *)d, _mm_or_si128(hi, lo));
+		s += m->bytes;
+		bytes -= m->bytes;
+		d += 8 * 2;
+	}
+	return x;
+}
+#endif
+
+/* Unpack n pixels of a group, the least significant bits start at l */
+static inline void mipi_unpack_group(const unsigned char *s, const unsigned char *l,
+				     int n, int bits, unsigned char *d)
+{
+	const int lsb_bits = bits - 8;
+	const unsigned int mask = (1 << lsb_bits) - 1;
+	unsigned int lsbs = 0;
+	int i;
+
+	for (i = 0; i * 8 < n * lsb_bits; i++)
+		lsbs |= l[i] << (i * 8);
+	for (i = 0; i < n; i++)
+		put_le16(&d[i * 2], (s[i] << lsb_bits) | ((lsbs >> (i * lsb_bits)) & mask));
+}
+
+static const struct mipi_packing *mipi_packing(int bits)
+{
+	int i;
+
+	for (i = 0; i < SIZE(mipi_packings); i++)
+		if (mipi_packings[i].bits == bits)
+			return &mipi_packings[i];
+	return NULL;
+}
+
+void raw_unpack_mipi(int bits, const unsigned char *in, int bytes, int width, unsigned char *out)
+{
+	const struct mipi_packing *p;
+	const unsigned char *end = in + bytes;
+	int x = 0;
+
+	if (bits == 8) {
+		memcpy(out, in, MIN(bytes, width));
+		return;
+	}
+	p = mipi_packing(bits);
+	if (!p)
+		return;
+
+#ifdef CPU_X86
+	if (cpu_level() >= CPU_SSE42) {
+		x = mipi_unpack_ssse3(&p->shuffle, in, bytes, out, width);
+		in += x / p->pixels * p->bytes;
+		out += x * 2;
+	}
+#endif
+	for (; x + p->pixels <= width && in + p->bytes <= end; x += p->pixels) {
+		mipi_unpack_group(in, in + p->pixels, p->pixels, bits, out);
+		in += p->bytes;
+		out += p->pixels * 2;
+	}
+
+	/* Last group has only the bytes its pixels need unless it is padded */
+	if (x < width) {
+		int n = MIN(width - x, p->pixels);
+		mipi_unpack_group(in, in + (in + p->bytes <= end ? p->pixels : n), n, bits, out);
+	}
+}
@@ -0,0 +1,59 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef RAWLIB_H
+#define RAWLIB_H
+
+struct pnm_image;
+
+/*
+ * Raw Bayer formats as named by V4L2: SGRBG10 has 10-bit pixels
+ * in two bytes LSB first, SGRBG10P is MIPI CSI-2 packed with the 8 most
+ * significant bits of a group of pixels in consecutive bytes followed
+ * by the remaining bits of the group. 8-bit pixels take one byte.
+ */
+struct raw_format {
+	int color[4];			/* Channel of pixel (y & 1) * 2 + (x & 1) */
+	int bits;			/* 8, 10, 12, or 14 */
+	int packed;
+};
+
+/* Parse format name, return -1 if it is not supported */
+int raw_format_parse(struct raw_format *f, const char *name);
+
+/* Return bytes in a line of width pixels */
+int raw_line_size(const struct raw_format *f, int width);
+/* Return pixels in a line of the given bytes */
+int raw_line_pixels(const struct raw_format *f, int bytes);
+
+/* Take the colors of the Bayer pattern from row y of the image */
+void raw_mosaic_row(const struct pnm_image *img, int y, const struct raw_format *f,
+		    unsigned short *row);
+
+/* Store width pixels of the row into raw_line_size() bytes */
+void raw_pack_row(const struct raw_format *f, const unsigned short *row, int width,
+		  unsigned char *out);
+
+/*
+ * Unpack width pixels of a line of MIPI CSI-2 RAW8 to RAW14 data of
+ * the given bytes into one byte per pixel for RAW8, otherwise into two
+ * bytes LSB first. A partial group at the end of the line may be padded
+ * to a whole group or take only the bytes needed by its pixels.
+ */
+void raw_unpack_mipi(int bits, const unsigned char *in, int bytes, int width,
+		     unsigned char *out);
+
+#endif
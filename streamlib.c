@@ -0,0 +1,112 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "streamlib.h"
+
+struct stream {
+	const struct stream_ops *ops;
+	void *priv;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int read, converted, written;	/* Frames done by each stage */
+	int end;			/* Frames in stream, -1 until known */
+};
+
+/* Wait until the stage may take frame n, return 0 if the stream ended before it */
+static int stream_wait(struct stream *s, const int *done, int n)
+{
+	int r;
+
+	pthread_mutex_lock(&s->lock);
+	while (*done <= n && (s->end < 0 || n < s->end))
+		pthread_cond_wait(&s->cond, &s->lock);
+	r = *done > n;
+	pthread_mutex_unlock(&s->lock);
+	return r;
+}
+
+static void stream_done(struct stream *s, int *done, int n)
+{
+	pthread_mutex_lock(&s->lock);
+	*done = n + 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void *stream_reader(void *arg)
+{
+	struct stream *s = arg;
+	int n;
+
+	for (n = 0; ; n++) {
+		/* The slot is free when the frame before in it is written */
+		pthread_mutex_lock(&s->lock);
+		while (n - s->written >= STREAM_SLOTS)
+			pthread_cond_wait(&s->cond, &s->lock);
+		pthread_mutex_unlock(&s->lock);
+
+		if (!s->ops->read(s->priv, n % STREAM_SLOTS))
+			break;
+		stream_done(s, &s->read, n);
+	}
+
+	pthread_mutex_lock(&s->lock);
+	s->end = n;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+static void *stream_writer(void *arg)
+{
+	struct stream *s = arg;
+	int n;
+
+	for (n = 0; stream_wait(s, &s->converted, n); n++) {
+		s->ops->write(s->priv, n % STREAM_SLOTS);
+		stream_done(s, &s->written, n);
+	}
+	return NULL;
+}
+
+int stream_run(const struct stream_ops *ops, void *priv)
+{
+	struct stream s = { .ops = ops, .priv = priv, .end = -1 };
+	pthread_t reader, writer;
+	int n;
+
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+	if (pthread_create(&reader, NULL, stream_reader, &s) ||
+	    pthread_create(&writer, NULL, stream_writer, &s)) {
+		fprintf(stderr, "failed to create thread\n");
+		exit(1);
+	}
+
+	for (n = 0; stream_wait(&s, &s.read, n); n++) {
+		ops->convert(priv, n % STREAM_SLOTS);
+		stream_done(&s, &s.converted, n);
+	}
+
+	pthread_join(reader, NULL);
+	pthread_join(writer, NULL);
+	pthread_mutex_destroy(&s.lock);
+	pthread_cond_destroy(&s.cond);
+	return n;
+}
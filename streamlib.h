@@ -0,0 +1,37 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef STREAMLIB_H
+#define STREAMLIB_H
+
+/*
+ * Frames of a stream go through a ring of STREAM_SLOTS buffers: frame n
+ * is read while frame n-1 is converted and frame n-2 written, each stage
+ * in its own thread. The callbacks get the slot of the frame, which is
+ * frame number modulo STREAM_SLOTS, and own the buffers of the slots.
+ */
+#define STREAM_SLOTS	3
+
+struct stream_ops {
+	int (*read)(void *priv, int slot);	/* Return 0 at end of stream */
+	void (*convert)(void *priv, int slot);
+	void (*write)(void *priv, int slot);
+};
+
+/* Run all frames of the stream through the stages, return number of frames */
+int stream_run(const struct stream_ops *ops, void *priv);
+
+#endif
@@ -0,0 +1,361 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "linux/videodev2.h"
+
+#include "extradefs.h"
+#include "symlib.h"
+
+#define PIXFMT(id)	{ V4L2_PIX_FMT_##id, (#id) }
+const struct symbol_list symbol_pixelformats[] = {
+	PIXFMT(RGB332),
+	PIXFMT(RGB444),
+	PIXFMT(ARGB444),
+	PIXFMT(XRGB444),
+	PIXFMT(RGB555),
+	PIXFMT(ARGB555),
+	PIXFMT(XRGB555),
+	PIXFMT(RGB565),
+	PIXFMT(RGB555X),
+	PIXFMT(ARGB555X),
+	PIXFMT(XRGB555X),
+	PIXFMT(RGB565X),
+	PIXFMT(BGR666),
+	PIXFMT(BGR24),
+	PIXFMT(RGB24),
+	PIXFMT(BGR32),
+	PIXFMT(ABGR32),
+	PIXFMT(XBGR32),
+	PIXFMT(RGB32),
+	PIXFMT(ARGB32),
+	PIXFMT(XRGB32),
+	PIXFMT(GREY),
+	PIXFMT(Y4),
+	PIXFMT(Y6),
+	PIXFMT(Y10),
+	PIXFMT(Y12),
+	PIXFMT(Y16),
+	PIXFMT(Y10BPACK),
+	PIXFMT(PAL8),
+	PIXFMT(UV8),
+	PIXFMT(YVU410),
+	PIXFMT(YVU420),
+	PIXFMT(YUYV),
+	PIXFMT(YYUV),
+	PIXFMT(YVYU),
+	PIXFMT(UYVY),
+	PIXFMT(VYUY),
+	PIXFMT(YUV422P),
+	PIXFMT(YUV411P),
+	PIXFMT(Y41P),
+	PIXFMT(YUV444),
+	PIXFMT(YUV555),
+	PIXFMT(YUV565),
+	PIXFMT(YUV32),
+	PIXFMT(YUV410),
+	PIXFMT(YUV420),
+	PIXFMT(HI240),
+	PIXFMT(HM12),
+	PIXFMT(M420),
+	PIXFMT(NV12),
+	PIXFMT(NV21),
+	PIXFMT(NV16),
+	PIXFMT(NV61),
+	PIXFMT(NV24),
+	PIXFMT(NV42),
+	PIXFMT(NV12M),
+	PIXFMT(NV21M),
+	PIXFMT(NV16M),
+	PIXFMT(NV61M),
+	PIXFMT(NV12MT),
+	PIXFMT(NV12MT_16X16),
+	PIXFMT(YUV420M),
+	PIXFMT(YVU420M),
+	PIXFMT(SBGGR8),
+	PIXFMT(SGBRG8),
+	PIXFMT(SGRBG8),
+	PIXFMT(SRGGB8),
+	PIXFMT(SBGGR10),
+	PIXFMT(SGBRG10),
+	PIXFMT(SGRBG10),
+	PIXFMT(SRGGB10),
+	PIXFMT(SBGGR10P),
+	PIXFMT(SGBRG10P),
+	PIXFMT(SGRBG10P),
+	PIXFMT(SRGGB10P),
+	PIXFMT(SBGGR10ALAW8),
+	PIXFMT(SGBRG10ALAW8),
+	PIXFMT(SGRBG10ALAW8),
+	PIXFMT(SRGGB10ALAW8),
+	PIXFMT(SBGGR10DPCM8),
+	PIXFMT(SGBRG10DPCM8),
+	PIXFMT(SGRBG10DPCM8),
+	PIXFMT(SRGGB10DPCM8),
+	PIXFMT(SBGGR12),
+	PIXFMT(SGBRG12),
+	PIXFMT(SGRBG12),
+	PIXFMT(SRGGB12),
+	PIXFMT(SBGGR12P),
+	PIXFMT(SGBRG12P),
+	PIXFMT(SGRBG12P),
+	PIXFMT(SRGGB12P),
+	PIXFMT(SBGGR14),
+	PIXFMT(SGBRG14),
+	PIXFMT(SGRBG14),
+	PIXFMT(SRGGB14),
+	PIXFMT(SBGGR14P),
+	PIXFMT(SGBRG14P),
+	PIXFMT(SGRBG14P),
+	PIXFMT(SRGGB14P),
+	PIXFMT(SBGGR16),
+	PIXFMT(SGBRG16),
+	PIXFMT(SGRBG16),
+	PIXFMT(SRGGB16),
+	PIXFMT(SBGGR8_16V32),
+	PIXFMT(SGBRG8_16V32),
+	PIXFMT(SGRBG8_16V32),
+	PIXFMT(SRGGB8_16V32),
+	PIXFMT(SBGGR10V32),
+	PIXFMT(SGBRG10V32),
+	PIXFMT(SGRBG10V32),
+	PIXFMT(SRGGB10V32),
+	PIXFMT(SBGGR12V32),
+	PIXFMT(SGBRG12V32),
+	PIXFMT(SGRBG12V32),
+	PIXFMT(SRGGB12V32),
+	PIXFMT(SBGGR8V32),
+	PIXFMT(SGBRG8V32),
+	PIXFMT(SGRBG8V32),
+	PIXFMT(SRGGB8V32),
+	PIXFMT(UYVY_V32),
+	PIXFMT(YUYV420_V32),
+	PIXFMT(MJPEG),
+	PIXFMT(JPEG),
+	PIXFMT(DV),
+	PIXFMT(MPEG),
+	PIXFMT(H264),
+	PIXFMT(H264_NO_SC),
+	PIXFMT(H264_MVC),
+	PIXFMT(H263),
+	PIXFMT(MPEG1),
+	PIXFMT(MPEG2),
+	PIXFMT(MPEG4),
+	PIXFMT(XVID),
+	PIXFMT(VC1_ANNEX_G),
+	PIXFMT(VC1_ANNEX_L),
+	PIXFMT(VP8),
+	PIXFMT(CPIA1),
+	PIXFMT(WNVA),
+	PIXFMT(SN9C10X),
+	PIXFMT(SN9C20X_I420),
+	PIXFMT(PWC1),
+	PIXFMT(PWC2),
+	PIXFMT(ET61X251),
+	PIXFMT(SPCA501),
+	PIXFMT(SPCA505),
+	PIXFMT(SPCA508),
+	PIXFMT(SPCA561),
+	PIXFMT(PAC207),
+	PIXFMT(MR97310A),
+	PIXFMT(JL2005BCD),
+	PIXFMT(SN9C2028),
+	PIXFMT(SQ905C),
+	PIXFMT(PJPG),
+	PIXFMT(OV511),
+	PIXFMT(OV518),
+	PIXFMT(STV0680),
+	PIXFMT(TM6000),
+	PIXFMT(CIT_YYVYUY),
+	PIXFMT(KONICA420),
+	PIXFMT(JPGL),
+	PIXFMT(SE401),
+	PIXFMT(S5C_UYVY_JPG),
+	PIXFMT(SMIAPP_META_8),
+	PIXFMT(YYUV420_V32),
+	PIXFMT(PRIV_MAGIC),
+	PIXFMT(FLAG_PREMUL_ALPHA),
+	SYMBOL_END
+};
+
+/*
+ * Open addressing hash tables of the list indexes plus one by name and
+ * by id, with at least twice as many slots as symbols so that the probe
+ * sequences stay short, and the indexes sorted by name for abbreviations
+ */
+struct symbol_index {
+	const struct symbol_list *list;
+	int size;
+	unsigned int mask;
+	int *by_name;
+	int *by_id;
+	int *sorted;
+	struct symbol_index *next;
+};
+
+static struct symbol_index *indexes;
+static pthread_mutex_t indexes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int hash_name(const char *s, int len)
+{
+	unsigned int h = 2166136261u;	/* FNV-1a */
+	int i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ toupper((unsigned char)s[i])) * 16777619u;
+	return h;
+}
+
+static unsigned int hash_id(int id)
+{
+	unsigned int h = id;
+
+	h = (h ^ (h >> 16)) * 0x45d9f3bu;
+	return h ^ (h >> 16);
+}
+
+static const struct symbol_list *sort_list;
+
+static int compare_names(const void *a, const void *b)
+{
+	int r = strcasecmp(sort_list[*(const int *)a].symbol, sort_list[*(const int *)b].symbol);
+	return r ? r : *(const int *)a - *(const int *)b;
+}
+
+/* Return the index of the list, built at first use, or NULL if out of memory */
+static struct symbol_index *symbol_index(const struct symbol_list *list)
+{
+	struct symbol_index *x;
+	unsigned int slots, h;
+	int i;
+
+	pthread_mutex_lock(&indexes_lock);
+	for (x = indexes; x && x->list != list; x = x->next)
+		;
+	if (x)
+		goto out;
+
+	x = calloc(1, sizeof(*x));
+	if (!x)
+		goto out;
+	x->list = list;
+	while (list[x->size].symbol)
+		x->size++;
+	for (slots = 4; slots < 2 * x->size; slots *= 2)
+		;
+	x->mask = slots - 1;
+	x->by_name = calloc(slots, sizeof(*x->by_name));
+	x->by_id = calloc(slots, sizeof(*x->by_id));
+	x->sorted = malloc(sizeof(*x->sorted) * (x->size + 1));
+	if (!x->by_name || !x->by_id || !x->sorted) {
+		free(x->by_name);
+		free(x->by_id);
+		free(x->sorted);
+		free(x);
+		x = NULL;
+		goto out;
+	}
+
+	/* Only the first of equal names or ids is entered */
+	for (i = 0; i < x->size; i++) {
+		const char *s = list[i].symbol;
+		int len = strlen(s);
+
+		for (h = hash_name(s, len); x->by_name[h & x->mask]; h++)
+			if (!strcasecmp(list[x->by_name[h & x->mask] - 1].symbol, s))
+				break;
+		if (!x->by_name[h & x->mask])
+			x->by_name[h & x->mask] = i + 1;
+
+		for (h = hash_id(list[i].id); x->by_id[h & x->mask]; h++)
+			if (list[x->by_id[h & x->mask] - 1].id == list[i].id)
+				break;
+		if (!x->by_id[h & x->mask])
+			x->by_id[h & x->mask] = i + 1;
+
+		x->sorted[i] = i;
+	}
+	sort_list = list;
+	qsort(x->sorted, x->size, sizeof(*x->sorted), compare_names);
+
+	x->next = indexes;
+	indexes = x;
+out:
+	pthread_mutex_unlock(&indexes_lock);
+	return x;
+}
+
+int symbol_find(const struct symbol_list *list, const char *name, int len)
+{
+	struct symbol_index *x = symbol_index(list);
+	unsigned int h;
+	int lo, hi, i, r;
+
+	if (!x) {
+		/* Out of memory, fall back to scanning the list */
+		for (i = 0; list[i].symbol; i++)
+			if (!strncasecmp(name, list[i].symbol, len))
+				return i;
+		return -1;
+	}
+
+	for (h = hash_name(name, len); x->by_name[h & x->mask]; h++) {
+		i = x->by_name[h & x->mask] - 1;
+		if (!strncasecmp(list[i].symbol, name, len) && !list[i].symbol[len])
+			return i;
+	}
+
+	/* The symbols starting with name are next to each other when sorted */
+	lo = 0;
+	hi = x->size;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (strncasecmp(list[x->sorted[mid]].symbol, name, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	r = -1;
+	for (; lo < x->size && !strncasecmp(list[x->sorted[lo]].symbol, name, len); lo++)
+		if (r < 0 || x->sorted[lo] < r)
+			r = x->sorted[lo];
+	return r;
+}
+
+int symbol_find_id(const struct symbol_list *list, int id)
+{
+	struct symbol_index *x = symbol_index(list);
+	unsigned int h;
+	int i;
+
+	if (!x) {
+		for (i = 0; list[i].symbol; i++)
+			if (list[i].id == id)
+				return i;
+		return -1;
+	}
+
+	for (h = hash_id(id); x->by_id[h & x->mask]; h++) {
+		i = x->by_id[h & x->mask] - 1;
+		if (list[i].id == id)
+			return i;
+	}
+	return -1;
+}
@@ -0,0 +1,44 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef SYMLIB_H
+#define SYMLIB_H
+
+/*
+ * Tables of symbolic names of V4L2 constants. Lookups go through hash
+ * and sorted indexes of the table, built when it is first used, which
+ * may be from several threads at once.
+ */
+struct symbol_list {
+	int id;
+	const char *symbol;
+};
+#define SYMBOL_END	{ -1, NULL }
+
+#define V4L2_PIX_FMT	"V4L2_PIX_FMT_"
+extern const struct symbol_list symbol_pixelformats[];
+
+/*
+ * Return index of the symbol of len characters in the list, ignoring
+ * case, or -1 if not found. A name not in the list is taken as an
+ * abbreviation of the first symbol in the list starting with it.
+ */
+int symbol_find(const struct symbol_list *list, const char *name, int len);
+
+/* Return index of the first symbol of the id in the list, or -1 if none */
+int symbol_find_id(const struct symbol_list *list, int id);
+
+#endif
@@ -18,6 +18,12 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "utillib.h"
 
 static void error(char *s)
@@ -26,74 +32,140 @@ static void error(char *s)
 	exit(1);
 }
 
+/* Return next header token of PNM file f in t, skipping white space and comments */
+static char *pnm_token(FILE *f, char *t, int size)
+{
+	int c, n = 0;
+
+	c = fgetc(f);
+	while (isspace(c) || c == '#') {
+		if (c == '#') while (c != '\n' && c != EOF) c = fgetc(f);
+		c = fgetc(f);
+	}
+	while (c != EOF && !isspace(c) && c != '#') {
+		if (n >= size - 1) error("bad pnm header");
+		t[n++] = c;
+		c = fgetc(f);
+	}
+	if (c == '#')
+		ungetc(c, f);
+	t[n] = 0;
+	return t;
+}
+
+static int pnm_number(FILE *f)
+{
+	char t[16];
+	char *e;
+	long v = strtol(pnm_token(f, t, sizeof(t)), &e, 10);
+
+	if (!t[0] || *e || v <= 0 || v > (1 << 24)) error("bad pnm header");
+	return v;
+}
+
 /*
- * Read PNM image file and return the image buffer containing size[0]*size[1] pixels.
- * Each pixel is R, G, B triplet, each component containing 16 bits, MSB first.
- * Therefore there will be size[0]*size[1]*2*3 bytes in the returned buffer.
- * Stores the returned image size into size.
- * Supports both 8-bit and 16-bit PNM files. For 8-bit PNM files, scale pixel
- * values from 0..255 to 0..65535.
+ * Read PNM header, leaving the file at the first byte of sample data.
+ * Return 0 if the file has no more images.
  */
-unsigned char *read_pnm(char *input, int size[2])
+static int pnm_header(FILE *f, struct pnm_image *p)
+{
+	char t[32];
+
+	if (!pnm_token(f, t, sizeof(t))[0])
+		return 0;
+
+	if (!strcmp(t, "P5") || !strcmp(t, "P6")) {
+		p->channels = t[1] == '5' ? 1 : 3;
+		p->width = pnm_number(f);
+		p->height = pnm_number(f);
+		p->maxval = pnm_number(f);	/* Followed by one white space */
+	} else if (!strcmp(t, "P7")) {
+		p->width = p->height = p->channels = p->maxval = 0;
+		while (strcmp(pnm_token(f, t, sizeof(t)), "ENDHDR")) {
+			if (!strcmp(t, "WIDTH"))
+				p->width = pnm_number(f);
+			else if (!strcmp(t, "HEIGHT"))
+				p->height = pnm_number(f);
+			else if (!strcmp(t, "DEPTH"))
+				p->channels = pnm_number(f);
+			else if (!strcmp(t, "MAXVAL"))
+				p->maxval = pnm_number(f);
+			else if (!strcmp(t, "TUPLTYPE"))
+				pnm_token(f, t, sizeof(t));
+			else if (!t[0])
+				error("bad pam header");
+		}
+		if (!p->width || !p->height || !p->channels || !p->maxval || p->channels > 4)
+			error("bad pam header");
+	} else {
+		error("unsupported pnm file, only P5, P6, and P7 are supported");
+	}
+
+	if (p->maxval > 65535) error("bad maxval");
+	p->bps = p->maxval > 255 ? 2 : 1;
+	if ((long long)p->width * p->height * p->channels * p->bps > INT_MAX)
+		error("too large pnm image");
+	p->size = p->width * p->height * p->channels * p->bps;
+	return 1;
+}
+
+int pnm_read(FILE *f, struct pnm_image *p)
 {
+	if (!pnm_header(f, p))
+		return 0;
+	if (p->map || p->alloc < p->size) {
+		pnm_free(p);
+		p->data = malloc(p->size);
+		if (!p->data) error("out of memory");
+		p->alloc = p->size;
+	}
+	if (fread(p->data, p->size, 1, f) != 1)
+		error("pnm read error");
+	return 1;
+}
+
+void pnm_load(const char *name, struct pnm_image *p)
+{
+	struct stat st;
 	FILE *f;
-	unsigned char *buf, *p;
-	int r, tokens, maxval, byp;
-	int y, x, c, b;
-	char token[16];
+	long ofs;
 
-	f = fopen(input, "rb");
+	memset(p, 0, sizeof(*p));
+	f = fopen(name, "rb");
 	if (!f) error("failed to open input file");
+	if (!pnm_header(f, p)) error("bad pnm file");
 
-	/* Read PNM header */
-	tokens = 0;
-	b = 0;
-	c = fgetc(f);
-	do {
-		if ((isspace(c) || c == '#') && b > 0) {
-			/* New token found */
-			token[b] = 0;
-			if (tokens == 0) {
-				if (strcmp("P6", token) != 0) error("bad ppm header");
-			} else if (tokens >= 1 && tokens <= 2) {
-				r = sscanf(token, "%u", &size[tokens - 1]);
-				if (r != 1) error("bad resolution");
-			} else {
-				r = sscanf(token, "%u", &maxval);
-				if (r != 1) error("bad maxval");
-				break;		/* Done */
-			}
-			tokens++;
-			b = 0;
-		}
-		while (isspace(c) || c == '#') {
-			if (c == '#') while (c != '\n' && c != EOF) c = fgetc(f);
-			c = fgetc(f);
+	/* Map the file and use the samples in place when possible */
+	ofs = ftell(f);
+	if (ofs >= 0 && fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode)) {
+		if (st.st_size < ofs + p->size) error("pnm read error");
+		p->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		if (p->map != MAP_FAILED) {
+			p->map_size = st.st_size;
+			p->data = (unsigned char *)p->map + ofs;
+			fclose(f);
+			return;
 		}
-		if (c == EOF) error("bad ppm file");
-		token[b++] = c;
-		if (sizeof(token) < b) error("bad ppm header");
-		c = fgetc(f);
-	} while (1);
-
-	/* Read actual image data */
-	byp = maxval < 256 ? 1 : 2;
-	p = buf = malloc(size[0] * size[1] * 3 * 2);
-	for (y = 0; y < size[1]; y++)
-		for (x = 0; x < size[0]; x++)
-			for (c = 0; c < 3; c++) {
-				unsigned int v = 0;
-				for (b = 0; b < byp; b++) {
-					v <<= 8;
-					v |= fgetc(f) & 0xff;
-					if (feof(f)) error("ppm read error");
-				}
-				if (byp == 1) v = (v << 8) | v;		/* Scale 0..255 to 0..65535 */
-				*p++ = (v >> 8) & 0xff;
-				*p++ = v & 0xff;
-			}
+		p->map = NULL;
+	}
+
+	p->data = malloc(p->size);
+	if (!p->data) error("out of memory");
+	p->alloc = p->size;
+	if (fread(p->data, p->size, 1, f) != 1)
+		error("pnm read error");
 	fclose(f);
-	return buf;
+}
+
+void pnm_free(struct pnm_image *p)
+{
+	if (p->map)
+		munmap(p->map, p->map_size);
+	else
+		free(p->data);
+	p->map = NULL;
+	p->data = NULL;
+	p->alloc = 0;
 }
 
 void write_file(const char *name, const unsigned char *data, int size)
@@ -112,3 +184,264 @@ void write_file(const char *name, const unsigned char *data, int size)
 		error("failed to close file");
 }
 
+static const char hex_digits[] = "0123456789abcdef";
+static signed char hex_values[256];	/* Value of hex digit, -1 for other characters */
+
+int hex_encode_line(const unsigned char *in, int size, char *out)
+{
+	int i;
+
+	for (i = 0; i < size; i++) {
+		*out++ = hex_digits[in[i] >> 4];
+		*out++ = hex_digits[in[i] & 15];
+		*out++ = ' ';
+	}
+	if (size > 0)
+		out[-1] = '\n';
+	return size * 3;
+}
+
+#define HEX_BLOCK	(1 << 20)
+
+void hex_reader_init(struct hex_reader *r, FILE *f)
+{
+	int i;
+
+	memset(hex_values, -1, sizeof(hex_values));
+	for (i = 0; i < 16; i++)
+		hex_values[(unsigned char)hex_digits[i]] = i;
+	for (i = 10; i < 16; i++)
+		hex_values['A' + i - 10] = i;
+
+	memset(r, 0, sizeof(*r));
+	r->f = f;
+}
+
+/* Return length of next line of text in the buffer including the newline */
+static int hex_next_line(struct hex_reader *r)
+{
+	char *nl;
+	int n;
+
+	while (r->start == r->end ||
+	       !(nl = memchr(r->buf + r->start, '\n', r->end - r->start))) {
+		if (r->eof)
+			return r->end - r->start;
+
+		/* Keep the partial line and read more after it */
+		if (r->start) {
+			memmove(r->buf, r->buf + r->start, r->end - r->start);
+			r->end -= r->start;
+			r->start = 0;
+		}
+		if (r->buf_size - r->end < HEX_BLOCK) {
+			r->buf_size = r->end + HEX_BLOCK;
+			r->buf = realloc(r->buf, r->buf_size);
+			if (!r->buf) error("out of memory");
+		}
+		n = fread(r->buf + r->end, 1, r->buf_size - r->end, r->f);
+		if (n <= 0) {
+			if (ferror(r->f)) error("failed to read file");
+			r->eof = 1;
+		}
+		r->end += n;
+	}
+	return nl - (r->buf + r->start) + 1;
+}
+
+int hex_read_line(struct hex_reader *r, unsigned char **line)
+{
+	const unsigned char *p, *end;
+	unsigned char *d;
+	int len;
+
+	do {
+		len = hex_next_line(r);
+		if (len <= 0)
+			return 0;
+		p = (unsigned char *)r->buf + r->start;
+		end = p + len;
+		r->start += len;
+
+		/* At most a byte for each two characters */
+		if (r->line_size < len / 2 + 1) {
+			r->line_size = len / 2 + 1;
+			r->line = realloc(r->line, r->line_size);
+			if (!r->line) error("out of memory");
+		}
+
+		for (d = r->line; p < end; p++) {
+			int hi = hex_values[p[0]];
+			int lo;
+
+			if (hi < 0)
+				continue;
+			lo = p + 1 < end ? hex_values[p[1]] : -1;
+			if (lo < 0 || (p + 2 < end && hex_values[p[2]] >= 0))
+				error("only 8 bits per value supported");
+			*d++ = hi << 4 | lo;
+			p++;
+		}
+	} while (d == r->line);
+
+	*line = r->line;
+	return d - r->line;
+}
+
+void hex_reader_free(struct hex_reader *r)
+{
+	free(r->buf);
+	free(r->line);
+	memset(r, 0, sizeof(*r));
+}
+
+
+/* Return orientation for rotating clockwise by degrees, -1 if not multiple of 90 */
+int orient_rotate(int degrees)
+{
+	static const int rotations[] = {
+		0,
+		ORIENT_TRANSPOSE | ORIENT_MIRROR_Y,
+		ORIENT_MIRROR_X | ORIENT_MIRROR_Y,
+		ORIENT_TRANSPOSE | ORIENT_MIRROR_X,
+	};
+
+	if (degrees % 90)
+		return -1;
+	return rotations[(degrees / 90 % 4 + 4) % 4];
+}
+
+/* Return the orientation followed by horizontal (axis 'h') or vertical ('v') flip */
+int orient_flip(int orient, char axis)
+{
+	int m;
+
+	if (axis == 'h')
+		m = ORIENT_MIRROR_X;
+	else if (axis == 'v')
+		m = ORIENT_MIRROR_Y;
+	else
+		return -1;
+	if (orient & ORIENT_TRANSPOSE)
+		m ^= ORIENT_MIRROR_X | ORIENT_MIRROR_Y;
+	return orient ^ m;
+}
+
+static inline void copy_pixel(unsigned char *d, const unsigned char *s, const int bpp)
+{
+	switch (bpp) {
+	case 1: d[0] = s[0]; break;
+	case 2: memcpy(d, s, 2); break;
+	case 3: memcpy(d, s, 3); break;
+	case 6: memcpy(d, s, 6); break;
+	default: memcpy(d, s, bpp); break;
+	}
+}
+
+#ifdef __SSE2__
+/* Transpose 8x8 block of 1 or 2 byte pixels, rows r[], into columns c[] */
+static void transpose8x8(const unsigned char *r[8], unsigned char *c[8], int bpp)
+{
+	__m128i a[8], b[8];
+	int i;
+
+	if (bpp == 1) {
+		for (i = 0; i < 8; i += 2)
+			a[i / 2] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)r[i]),
+						    _mm_loadl_epi64((const __m128i *)r[i + 1]));
+		b[0] = _mm_unpacklo_epi16(a[0], a[1]);
+		b[1] = _mm_unpackhi_epi16(a[0], a[1]);
+		b[2] = _mm_unpacklo_epi16(a[2], a[3]);
+		b[3] = _mm_unpackhi_epi16(a[2], a[3]);
+		a[0] = _mm_unpacklo_epi32(b[0], b[2]);
+		a[1] = _mm_unpackhi_epi32(b[0], b[2]);
+		a[2] = _mm_unpacklo_epi32(b[1], b[3]);
+		a[3] = _mm_unpackhi_epi32(b[1], b[3]);
+		for (i = 0; i < 4; i++) {
+			_mm_storel_epi64((__m128i *)c[i * 2], a[i]);
+			_mm_storel_epi64((__m128i *)c[i * 2 + 1], _mm_unpackhi_epi64(a[i], a[i]));
+		}
+		return;
+	}
+
+	for (i = 0; i < 8; i += 2) {
+		__m128i r0 = _mm_loadu_si128((const __m128i *)r[i]);
+		__m128i r1 = _mm_loadu_si128((const __m128i *)r[i + 1]);
+		a[i] = _mm_unpacklo_epi16(r0, r1);
+		a[i + 1] = _mm_unpackhi_epi16(r0, r1);
+	}
+	for (i = 0; i < 8; i += 4) {
+		b[i] = _mm_unpacklo_epi32(a[i], a[i + 2]);
+		b[i + 1] = _mm_unpackhi_epi32(a[i], a[i + 2]);
+		b[i + 2] = _mm_unpacklo_epi32(a[i + 1], a[i + 3]);
+		b[i + 3] = _mm_unpackhi_epi32(a[i + 1], a[i + 3]);
+	}
+	for (i = 0; i < 4; i++) {
+		_mm_storeu_si128((__m128i *)c[i * 2], _mm_unpacklo_epi64(b[i], b[i + 4]));
+		_mm_storeu_si128((__m128i *)c[i * 2 + 1], _mm_unpackhi_epi64(b[i], b[i + 4]));
+	}
+}
+#endif
+
+/*
+ * Copy image of width x height pixels, bpp bytes each, from src into dst
+ * with the orientation. Transposition goes through tiles small enough to
+ * stay in cache, both in rows of the source and in rows of the result.
+ */
+void orient_image(const void *src, int width, int height, int bpp, int orient, void *dst)
+{
+	static const int TILE = 32;
+	const unsigned char *s = src;
+	unsigned char *d = dst;
+	const int mx = orient & ORIENT_MIRROR_X;
+	const int my = orient & ORIENT_MIRROR_Y;
+	const int dstride = (orient & ORIENT_TRANSPOSE ? height : width) * bpp;
+	int x, y, tx, ty, x1, y1;
+
+	if (!(orient & ORIENT_TRANSPOSE)) {
+		for (y = 0; y < height; y++) {
+			const unsigned char *r = s + (my ? height - 1 - y : y) * width * bpp;
+			if (!mx) {
+				memcpy(d, r, width * bpp);
+			} else {
+				for (x = 0; x < width; x++)
+					copy_pixel(d + x * bpp, r + (width - 1 - x) * bpp, bpp);
+			}
+			d += dstride;
+		}
+		return;
+	}
+
+	/* Source pixel (x, y) goes to column my ? height-1-y : y, row mx ? width-1-x : x */
+	for (ty = 0; ty < height; ty += TILE) {
+		for (tx = 0; tx < width; tx += TILE) {
+			y1 = ty + TILE < height ? ty + TILE : height;
+			x1 = tx + TILE < width ? tx + TILE : width;
+			y = ty;
+#ifdef __SSE2__
+			for (; (bpp == 1 || bpp == 2) && y + 8 <= y1; y += 8) {
+				const unsigned char *r[8];
+				unsigned char *c[8];
+				int i, col = my ? height - y - 8 : y;
+				for (x = tx; x + 8 <= x1; x += 8) {
+					for (i = 0; i < 8; i++) {
+						r[i] = s + ((my ? y + 7 - i : y + i) * width + x) * bpp;
+						c[i] = d + (mx ? width - 1 - x - i : x + i) * dstride + col * bpp;
+					}
+					transpose8x8(r, c, bpp);
+				}
+				for (; x < x1; x++)
+					for (i = 0; i < 8; i++)
+						copy_pixel(d + (mx ? width - 1 - x : x) * dstride +
+							   (my ? height - 1 - y - i : y + i) * bpp,
+							   s + ((y + i) * width + x) * bpp, bpp);
+			}
+#endif
+			for (; y < y1; y++)
+				for (x = tx; x < x1; x++)
+					copy_pixel(d + (mx ? width - 1 - x : x) * dstride +
+						   (my ? height - 1 - y : y) * bpp,
+						   s + (y * width + x) * bpp, bpp);
+		}
+	}
+}
@@ -1,2 +1,74 @@
-unsigned char *read_pnm(char *input, int size[2]);
+#include <stdio.h>
+
+/*
+ * PNM image with samples in the bit depth of the file: P5 grey, P6 RGB,
+ * or P7 (PAM) with 1 to 4 channels. Samples take one byte, or two bytes
+ * MSB first if maxval is over 255.
+ */
+struct pnm_image {
+	int width, height;
+	int channels;
+	int maxval;
+	int bps;			/* Bytes per sample */
+	unsigned char *data;		/* Rows of pixels without padding */
+	int size;			/* Bytes of data */
+	void *map;			/* Mapped file, NULL if data is allocated */
+	size_t map_size;
+	int alloc;			/* Bytes allocated for data */
+};
+
+/* Map PNM file, or read it if it can not be mapped */
+void pnm_load(const char *name, struct pnm_image *p);
+/* Read next image of PNM stream, reusing the data buffer. Return 0 at end of stream */
+int pnm_read(FILE *f, struct pnm_image *p);
+void pnm_free(struct pnm_image *p);
+
+/*
+ * Return channel c (0 red, 1 green, 2 blue) of pixel i scaled to 16 bits,
+ * 8-bit samples by repeating the byte. Grey images have the same value
+ * in all channels.
+ */
+static inline unsigned int pnm_sample16(const struct pnm_image *p, int i, int c)
+{
+	const unsigned char *s;
+
+	if (p->channels < 3)
+		c = 0;
+	s = p->data + ((long)i * p->channels + c) * p->bps;
+	return p->bps == 1 ? s[0] * 257 : (s[0] << 8) | s[1];
+}
+
 void write_file(const char *name, const unsigned char *data, int size);
+
+/*
+ * Text dumps of data are lines of bytes as two hex digits separated
+ * by spaces. Lines are read from the file in large blocks.
+ */
+struct hex_reader {
+	FILE *f;
+	char *buf;			/* Text read from the file */
+	int buf_size, start, end;
+	int eof;
+	unsigned char *line;		/* Decoded line */
+	int line_size;
+};
+
+/* Format size bytes as a line of text into out, size * 3 bytes, return its length */
+int hex_encode_line(const unsigned char *in, int size, char *out);
+void hex_reader_init(struct hex_reader *r, FILE *f);
+/* Decode next non-empty line, return its length and set *line, 0 at end of file */
+int hex_read_line(struct hex_reader *r, unsigned char **line);
+void hex_reader_free(struct hex_reader *r);
+
+/*
+ * Image orientation: pixel (x, y) of the oriented image is taken from
+ * pixel (u, v) of the original image, where (u, v) is (x, y), swapped
+ * if ORIENT_TRANSPOSE is set, and then mirrored as given by the flags.
+ */
+#define ORIENT_MIRROR_X		1
+#define ORIENT_MIRROR_Y		2
+#define ORIENT_TRANSPOSE	4
+
+int orient_rotate(int degrees);
+int orient_flip(int orient, char axis);
+void orient_image(const void *src, int width, int height, int bpp, int orient, void *dst);
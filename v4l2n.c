@@ -14,8 +14,12 @@
  *
  */
 
+#define _GNU_SOURCE			/* For accept4() */
 #include "v4l2n.h"
 #include "extradefs.h"
+#include "convlib.h"
+#include "symlib.h"
+#include "cpulib.h"
 
 #include <stdio.h>
 #include <errno.h>
@@ -36,6 +40,9 @@
 #include <sys/wait.h>
 #include <stdint.h>
 #include <setjmp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "linux/videodev2.h"
 #include "linux/v4l2-subdev.h"
 
@@ -94,6 +101,7 @@ struct capture_buffer {
 struct pipe {
 	int fd;
 	char *output;
+	int output_type;	/* CONV_TYPE_* to convert saved images, -1 for raw */
 	void *bufdata;		/* Data to be stored into buffers for driver */
 	unsigned int bufdata_length;
 	unsigned int bufdata_pos;	/* Current read position */
@@ -112,17 +120,13 @@ static struct {
 	FILE *logfile;
 	bool save_images;
 	bool calculate_stats;
+	bool daemon;			/* Commands come from a socket */
 	struct timeval start_time;
 	jmp_buf exception;
 	unsigned int pipe;
 	struct pipe pipes[MAX_PIPES];
 } vars;
 
-struct symbol_list {
-	int id;
-	const char *symbol;
-};
-#define SYMBOL_END	{ -1, NULL }
 
 struct token_list {
 	int id;
@@ -504,175 +508,6 @@ static const struct symbol_list v4l2_buf_types[] = {
 	SYMBOL_END
 };
 
-#define V4L2_PIX_FMT	"V4L2_PIX_FMT_"
-#define PIXFMT(id)	{ V4L2_PIX_FMT_##id, (#id) }
-static const struct symbol_list pixelformats[] = {
-	PIXFMT(RGB332),
-	PIXFMT(RGB444),
-	PIXFMT(ARGB444),
-	PIXFMT(XRGB444),
-	PIXFMT(RGB555),
-	PIXFMT(ARGB555),
-	PIXFMT(XRGB555),
-	PIXFMT(RGB565),
-	PIXFMT(RGB555X),
-	PIXFMT(ARGB555X),
-	PIXFMT(XRGB555X),
-	PIXFMT(RGB565X),
-	PIXFMT(BGR666),
-	PIXFMT(BGR24),
-	PIXFMT(RGB24),
-	PIXFMT(BGR32),
-	PIXFMT(ABGR32),
-	PIXFMT(XBGR32),
-	PIXFMT(RGB32),
-	PIXFMT(ARGB32),
-	PIXFMT(XRGB32),
-	PIXFMT(GREY),
-	PIXFMT(Y4),
-	PIXFMT(Y6),
-	PIXFMT(Y10),
-	PIXFMT(Y12),
-	PIXFMT(Y16),
-	PIXFMT(Y10BPACK),
-	PIXFMT(PAL8),
-	PIXFMT(UV8),
-	PIXFMT(YVU410),
-	PIXFMT(YVU420),
-	PIXFMT(YUYV),
-	PIXFMT(YYUV),
-	PIXFMT(YVYU),
-	PIXFMT(UYVY),
-	PIXFMT(VYUY),
-	PIXFMT(YUV422P),
-	PIXFMT(YUV411P),
-	PIXFMT(Y41P),
-	PIXFMT(YUV444),
-	PIXFMT(YUV555),
-	PIXFMT(YUV565),
-	PIXFMT(YUV32),
-	PIXFMT(YUV410),
-	PIXFMT(YUV420),
-	PIXFMT(HI240),
-	PIXFMT(HM12),
-	PIXFMT(M420),
-	PIXFMT(NV12),
-	PIXFMT(NV21),
-	PIXFMT(NV16),
-	PIXFMT(NV61),
-	PIXFMT(NV24),
-	PIXFMT(NV42),
-	PIXFMT(NV12M),
-	PIXFMT(NV21M),
-	PIXFMT(NV16M),
-	PIXFMT(NV61M),
-	PIXFMT(NV12MT),
-	PIXFMT(NV12MT_16X16),
-	PIXFMT(YUV420M),
-	PIXFMT(YVU420M),
-	PIXFMT(SBGGR8),
-	PIXFMT(SGBRG8),
-	PIXFMT(SGRBG8),
-	PIXFMT(SRGGB8),
-	PIXFMT(SBGGR10),
-	PIXFMT(SGBRG10),
-	PIXFMT(SGRBG10),
-	PIXFMT(SRGGB10),
-	PIXFMT(SBGGR10P),
-	PIXFMT(SGBRG10P),
-	PIXFMT(SGRBG10P),
-	PIXFMT(SRGGB10P),
-	PIXFMT(SBGGR10ALAW8),
-	PIXFMT(SGBRG10ALAW8),
-	PIXFMT(SGRBG10ALAW8),
-	PIXFMT(SRGGB10ALAW8),
-	PIXFMT(SBGGR10DPCM8),
-	PIXFMT(SGBRG10DPCM8),
-	PIXFMT(SGRBG10DPCM8),
-	PIXFMT(SRGGB10DPCM8),
-	PIXFMT(SBGGR12),
-	PIXFMT(SGBRG12),
-	PIXFMT(SGRBG12),
-	PIXFMT(SRGGB12),
-	PIXFMT(SBGGR12P),
-	PIXFMT(SGBRG12P),
-	PIXFMT(SGRBG12P),
-	PIXFMT(SRGGB12P),
-	PIXFMT(SBGGR14),
-	PIXFMT(SGBRG14),
-	PIXFMT(SGRBG14),
-	PIXFMT(SRGGB14),
-	PIXFMT(SBGGR14P),
-	PIXFMT(SGBRG14P),
-	PIXFMT(SGRBG14P),
-	PIXFMT(SRGGB14P),
-	PIXFMT(SBGGR16),
-	PIXFMT(SBGGR8_16V32),
-	PIXFMT(SGBRG8_16V32),
-	PIXFMT(SGRBG8_16V32),
-	PIXFMT(SRGGB8_16V32),
-	PIXFMT(SBGGR10V32),
-	PIXFMT(SGBRG10V32),
-	PIXFMT(SGRBG10V32),
-	PIXFMT(SRGGB10V32),
-	PIXFMT(SBGGR12V32),
-	PIXFMT(SGBRG12V32),
-	PIXFMT(SGRBG12V32),
-	PIXFMT(SRGGB12V32),
-	PIXFMT(SBGGR8V32),
-	PIXFMT(SGBRG8V32),
-	PIXFMT(SGRBG8V32),
-	PIXFMT(SRGGB8V32),
-	PIXFMT(UYVY_V32),
-	PIXFMT(YUYV420_V32),
-	PIXFMT(MJPEG),
-	PIXFMT(JPEG),
-	PIXFMT(DV),
-	PIXFMT(MPEG),
-	PIXFMT(H264),
-	PIXFMT(H264_NO_SC),
-	PIXFMT(H264_MVC),
-	PIXFMT(H263),
-	PIXFMT(MPEG1),
-	PIXFMT(MPEG2),
-	PIXFMT(MPEG4),
-	PIXFMT(XVID),
-	PIXFMT(VC1_ANNEX_G),
-	PIXFMT(VC1_ANNEX_L),
-	PIXFMT(VP8),
-	PIXFMT(CPIA1),
-	PIXFMT(WNVA),
-	PIXFMT(SN9C10X),
-	PIXFMT(SN9C20X_I420),
-	PIXFMT(PWC1),
-	PIXFMT(PWC2),
-	PIXFMT(ET61X251),
-	PIXFMT(SPCA501),
-	PIXFMT(SPCA505),
-	PIXFMT(SPCA508),
-	PIXFMT(SPCA561),
-	PIXFMT(PAC207),
-	PIXFMT(MR97310A),
-	PIXFMT(JL2005BCD),
-	PIXFMT(SN9C2028),
-	PIXFMT(SQ905C),
-	PIXFMT(PJPG),
-	PIXFMT(OV511),
-	PIXFMT(OV518),
-	PIXFMT(STV0680),
-	PIXFMT(TM6000),
-	PIXFMT(CIT_YYVYUY),
-	PIXFMT(KONICA420),
-	PIXFMT(JPGL),
-	PIXFMT(SE401),
-	PIXFMT(S5C_UYVY_JPG),
-	PIXFMT(SMIAPP_META_8),
-	PIXFMT(YYUV420_V32),
-	PIXFMT(PRIV_MAGIC),
-	PIXFMT(FLAG_PREMUL_ALPHA),
-	SYMBOL_END
-};
-
 static const struct symbol_list v4l2_memory[] = {
 	{ V4L2_MEMORY_MMAP, "MMAP" },
 	{ V4L2_MEMORY_USERPTR, "USERPTR" },
@@ -713,7 +548,7 @@ static const struct symbol_list v4l2_queryctrl_flags[] = {
 
 static char *get_pipestring(void)
 {
-	static char buf[5];
+	static char buf[8];
 	if (vars.pipe < 0 || vars.pipe >= MAX_PIPES)
 		return "";
 	snprintf(buf, sizeof(buf), "p%u: ", vars.pipe);
@@ -836,6 +671,7 @@ static void usage(void)
 		"		(VIDIOC_ENUM_FMT, VIDIOC_ENUM_FRAMESIZES, VIDIOC_ENUM_FRAMEINTERVALS)\n"
 		"-o FILENAME	Set output filename for captured images\n"
 		"--output\n"
+		"--output-format=X Save captured images as raw (default), ppm, pgm, pam, or y4m\n"
 		"--parm		Set/get parameters (VIDIOC_S/G_PARM)\n"
 		"-t		Try format (VIDIOC_TRY_FORMAT)\n"
 		"--try_fmt\n"
@@ -877,12 +713,14 @@ static void usage(void)
 		"		Read a line from given file (default stdin)\n"
 		"--shell=CMD	Run shell command CMD\n"
 		"--statistics	Calculate statistics from each frame\n"
-		"--file	<name>	Read commands (options) from given file\n"
+		"--file	<name>	Read commands (options) from given file, which may also\n"
+		"		have \"set NAME=VALUE\" and \"repeat N { options }\"\n"
 		"--pipe <n,m,..> Select current pipes to operate on\n"
 		"--load <name>	Load buffer data from file for driver\n"
 		"--crop <args>	Set/get cropping parameters\n"
 		"--cropcap <type=x> Get cropping capabilities\n"
 		"--selection <args> Set/get selection parameters\n"
+		"--daemon <path>	Run command lines received from UNIX socket path\n"
 		"\n"
 		"List of V4L2 controls syntax: <[V4L2_CID_]control_name_or_id>[+][=value|?|#][,...]\n"
 		"where control_name_or_id is either symbolic name or numerical id.\n"
@@ -930,11 +768,8 @@ static int symbol_get(const struct symbol_list *list, const char **symbol)
 			error("zero-length symbol");
 		if (!list)
 			error("only numeric value allowed");
-		for (i=0; list[i].symbol!=NULL; i++) {
-			if (strncasecmp(start, list[i].symbol, end-start) == 0)
-				break;
-		}
-		if (list[i].symbol == NULL)
+		i = symbol_find(list, start, end - start);
+		if (i < 0)
 			error("symbol `%s' not found", start);
 		r = list[i].id;
 	}
@@ -1042,11 +877,8 @@ static const char *symbol_str(int id, const struct symbol_list list[])
 	static char buffer[200];
 	int i;
 
-	for (i=0; list[i].symbol; i++)
-		if (list[i].id == id)
-			break;
-
-	if (list[i].symbol) {
+	i = symbol_find_id(list, id);
+	if (i >= 0) {
 		if (id < 1000)
 			sprintf(buffer, "%s [%i]", list[i].symbol, id);
 		else
@@ -1104,19 +936,39 @@ static void print_time(void)
 	print(1, "[%3i.%06i]\n", tv.tv_sec, tv.tv_usec);
 }
 
+/*
+ * Open file for writing size bytes, return NULL on error. File name - is
+ * the standard output, or the socket in daemon mode, where the data
+ * follows a line "DATA <size>" to tell it apart from the messages.
+ */
+static FILE *output_open(const char *name, const char *mode, int size)
+{
+	if (!strcmp(name, "-")) {
+		printf("DATA %i\n", size);
+		return stdout;
+	}
+	return fopen(name, mode);
+}
+
+static int output_close(FILE *f)
+{
+	return (f == stdout ? fflush(f) : fclose(f)) ? -1 : 0;
+}
+
 static void write_file(const char *name, const void *data, int size)
 {
 	FILE *f;
 	int r;
 
-	f = fopen(name, "wb");
+	f = output_open(name, "wb", size);
 	if (!f)
 		error("can not open file `%s'", name);
 	r = fwrite(data, size, 1, f);
-	if (r != 1)
+	if (r != 1) {
+		output_close(f);
 		error("failed to write data to file");
-	r = fclose(f);
-	if (r != 0)
+	}
+	if (output_close(f) < 0)
 		error("failed to close file");
 }
 
@@ -1127,14 +979,22 @@ static void *read_file(const char *name, int *len)
 	void *p;
 	FILE *f;
 
-	f = fopen(name, "rb");			if (!f) error("failed to open file `%s'", name);
-	r = fseek(f, 0, SEEK_END);		if (r < 0) error("failed to seek file");
-	length = ftell(f);			if (length <= 0) error("failed to get file size");
-	r = fseek(f, 0, SEEK_SET);		if (r < 0) error("failed to seek file");
-	p = ralloc(NULL, length);		if (!p) error("out of memory");
-
-	r = fread(p, length, 1, f);		if (r != 1) error("failed to read file");
+	f = fopen(name, "rb");
+	if (!f)
+		error("failed to open file `%s'", name);
+	r = fseek(f, 0, SEEK_END);
+	length = ftell(f);
+	if (r < 0 || length <= 0 || fseek(f, 0, SEEK_SET) < 0) {
+		fclose(f);
+		error("failed to get size of file `%s'", name);
+	}
+	p = malloc(length);
+	r = p ? fread(p, length, 1, f) : 0;
 	fclose(f);
+	if (r != 1) {
+		free(p);
+		error("failed to read file `%s'", name);
+	}
 
 	*len = length;
 	return p;
@@ -1240,7 +1100,7 @@ static void itd_vidioc_enum_fmt(const char *arg)
 		print(1, "VIDIOC_ENUM_FMT (type=%s) %i: ",
 			symbol_str(fmtdesc.type, v4l2_buf_types), fmtdesc.index);
 		print(1, "%s `%.32s' flags %s\n",
-			symbol_str(fmtdesc.pixelformat, pixelformats),
+			symbol_str(fmtdesc.pixelformat, symbol_pixelformats),
 			fmtdesc.description, symbol_flag_str(fmtdesc.flags, fmt_flags));
 
 		for (is = 0;; is++) {
@@ -1399,7 +1259,7 @@ static void print_v4l2_format(int v, struct v4l2_format *f, char c)
 	    f->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
 		print(v, "%c width:         %i\n", c, f->fmt.pix.width);
 		print(v, "%c height:        %i\n", c, f->fmt.pix.height);
-		print(v, "%c pixelformat:   %s\n", c, symbol_str(f->fmt.pix.pixelformat, pixelformats));
+		print(v, "%c pixelformat:   %s\n", c, symbol_str(f->fmt.pix.pixelformat, symbol_pixelformats));
 		print(v, "%c field:         %i\n", c, f->fmt.pix.field);
 		print(v, "%c bytesperline:  %i\n", c, f->fmt.pix.bytesperline);
 		print(v, "%c sizeimage:     %i\n", c, f->fmt.pix.sizeimage);
@@ -1414,7 +1274,7 @@ static void itd_vidioc_fmt(bool try, const char *s)
 		{ 't', TOKEN_F_ARG, "type", v4l2_buf_types },
 		{ 'w', TOKEN_F_ARG, "width", NULL },
 		{ 'h', TOKEN_F_ARG, "height", NULL },
-		{ 'p', TOKEN_F_ARG, "pixelformat", pixelformats },
+		{ 'p', TOKEN_F_ARG, "pixelformat", symbol_pixelformats },
 		{ 'f', TOKEN_F_ARG, "field", NULL },
 		{ 'b', TOKEN_F_ARG, "bytesperline", NULL },
 		{ 's', TOKEN_F_ARG, "sizeimage", NULL },
@@ -1733,15 +1593,56 @@ static void itd_vidioc_querybuf(const char *unused)
 	}
 }
 
+struct stats_column {
+	unsigned int sum, min, max;
+};
+
+/*
+ * Sum, minimum, and maximum of the even and odd 16-bit little endian
+ * pixels of a row. The columns are kept apart so that the loop vectorizes.
+ */
+static inline __attribute__((always_inline)) void
+stats_row_body(const int cpu, const unsigned char *s, int width, struct stats_column *c)
+{
+	unsigned int sum0 = 0, min0 = UINT_MAX, max0 = 0;
+	unsigned int sum1 = 0, min1 = UINT_MAX, max1 = 0;
+	int x;
+
+	for (x = 0; x < width / 2; x++) {
+		unsigned int v0 = s[x * 4 + 0] | (s[x * 4 + 1] << 8);
+		unsigned int v1 = s[x * 4 + 2] | (s[x * 4 + 3] << 8);
+		sum0 += v0;
+		min0 = MIN(min0, v0);
+		max0 = MAX(max0, v0);
+		sum1 += v1;
+		min1 = MIN(min1, v1);
+		max1 = MAX(max1, v1);
+	}
+	if (width & 1) {
+		unsigned int v0 = s[x * 4 + 0] | (s[x * 4 + 1] << 8);
+		sum0 += v0;
+		min0 = MIN(min0, v0);
+		max0 = MAX(max0, v0);
+	}
+	c[0].sum = sum0;
+	c[0].min = min0;
+	c[0].max = max0;
+	c[1].sum = sum1;
+	c[1].min = min1;
+	c[1].max = max1;
+}
+
+CPU_KERNEL(stats_row, (const unsigned char *s, int width, struct stats_column *c), s, width, c)
+
 static void capture_buffer_stats(void *image, struct v4l2_format *format)
 {
-	static const int BPP = 2;
 	static const int NUM = 0;
 	static const int SUM = 1;
 	static const int MIN = 2;
 	static const int MAX = 3;
 	long long stat[4][4];
-	int y, x, p, stride;
+	struct stats_column row[2];
+	int y, x, p, stride, width;
 	unsigned char *line;
 
 	if (!vars.calculate_stats)
@@ -1768,17 +1669,16 @@ static void capture_buffer_stats(void *image, struct v4l2_format *format)
 	}
 
 	stride = format->fmt.pix.bytesperline;
+	width = format->fmt.pix.width;
 	line = image;
 	for (y = 0; y < format->fmt.pix.height; y++) {
-		unsigned char *ptr = line;
-		for (x = 0; x < format->fmt.pix.width; x++) {
-			int v = ptr[0] | (ptr[1] << 8);
-			p = ((y & 1) << 1) | (x & 1);
-			stat[p][NUM]++;
-			stat[p][SUM] += v;
-			stat[p][MIN] = MIN(stat[p][MIN], v);
-			stat[p][MAX] = MAX(stat[p][MAX], v);
-			ptr += BPP;
+		stats_row(line, width, row);
+		for (x = 0; x < 2; x++) {
+			p = ((y & 1) << 1) | x;
+			stat[p][NUM] += (width + 1 - x) / 2;
+			stat[p][SUM] += row[x].sum;
+			stat[p][MIN] = MIN(stat[p][MIN], row[x].min);
+			stat[p][MAX] = MAX(stat[p][MAX], row[x].max);
 		}
 		line += stride;
 	}
@@ -2085,11 +1985,10 @@ static void itd_vidioc_sg_input(const char *arg)
 static const char *get_control_name(__u32 id)
 {
 	static char buf[11];
-	int i;
+	int i = symbol_find_id(controls, id);
 
-	for (i = 0; controls[i].symbol != NULL; i++)
-		if (controls[i].id == id)
-			return controls[i].symbol;
+	if (i >= 0)
+		return controls[i].symbol;
 
 	sprintf(buf, "0x%08X", id);
 	return buf;
@@ -2117,90 +2016,126 @@ static __s32 itd_v4l2_g_ctrl(__u32 id)
 	return c.value;
 }
 
-static void itd_v4l2_s_ext_ctrl(__u32 id, const char *opts)
-{
-	struct v4l2_ext_controls cs;
+/*
+ * Extended controls of one request. Consecutive sets or gets are batched
+ * and done with one VIDIOC_S/G_EXT_CTRLS for each control class, so that
+ * the controls of a class take effect at once. All memory of the request
+ * is held here, to be freed by ext_ctrls_free() also after errors.
+ */
+struct ext_ctrl {
 	struct v4l2_ext_control c;
+	char *type;		/* Value type, NULL for value */
+	char *spec;		/* Value to set, after the type */
+	char *filename;		/* File where got value is written */
+	void *buf;		/* Value of pointer controls, or read from file */
+	unsigned int size;	/* Size of buffer for got value */
+};
+
+struct ext_ctrls {
+	bool set;
+	int count;
+	int max;
+	struct ext_ctrl *ctrls;
+	struct v4l2_ext_control *cc;	/* Controls of one class for the ioctl */
+	bool *done;
+};
+
+/* Free the batched controls, or with all also the batch itself */
+static void ext_ctrls_free(struct ext_ctrls *b, bool all)
+{
+	int i;
 
-	char *type = NULL;
-	char *valuescan = NULL;
-	char *valuebuf = NULL;
+	for (i = 0; i < b->count; i++) {
+		free(b->ctrls[i].type);
+		free(b->ctrls[i].spec);
+		free(b->ctrls[i].filename);
+		free(b->ctrls[i].buf);
+	}
+	b->count = 0;
+	if (!all)
+		return;
+	free(b->ctrls);
+	free(b->cc);
+	free(b->done);
+	b->ctrls = NULL;
+	b->cc = NULL;
+	b->done = NULL;
+	b->max = 0;
+}
+
+static struct ext_ctrl *ext_ctrl_new(struct ext_ctrls *b, __u32 id)
+{
+	struct ext_ctrl *e;
+
+	if (b->count >= b->max) {
+		b->max = b->max ? b->max * 2 : 16;
+		b->ctrls = ralloc(b->ctrls, sizeof(*b->ctrls) * b->max);
+	}
+	e = &b->ctrls[b->count++];
+	memset(e, 0, sizeof(*e));
+	e->c.id = id;
+	return e;
+}
+
+static void ext_ctrl_set(struct ext_ctrls *b, __u32 id, const char *opts)
+{
+	struct ext_ctrl *e = ext_ctrl_new(b, id);
+	struct v4l2_ext_control *c = &e->c;
 	const char *valuespec;
+	unsigned char *valuebuf;
 	long value;
 	int size = 0;
 
-	CLEAR(cs);
-	cs.ctrl_class = V4L2_CTRL_ID2CLASS(id);
-	cs.count = 1;
-	cs.controls = &c;
-
-	CLEAR(c);
-	c.id = id;
-
-	sscanf(opts, "%m[^:]:%ms", &type, &valuescan);
+	/* Plain values and file names starting with a colon have no type */
+	if (opts[0] != ':' && strchr(opts, ':'))
+		sscanf(opts, "%m[^:]:%ms", &e->type, &e->spec);
 
-	if (type && !valuescan) error("bad compound type extended control specification");
-	valuespec = valuescan ? valuescan : opts;
+	if (e->type && !e->spec) error("bad compound type extended control specification");
+	valuespec = e->spec ? e->spec : opts;
 
 	if (valuespec[0]==':') {
 		const char *filename = &valuespec[1];
-		valuebuf = read_file(filename, &size);
-		if (size <= 0 || !valuebuf)
-			error("can not read control value from file `%s'", filename);
+		e->buf = read_file(filename, &size);
 		print(1, "Reading control %s (%i bytes) from `%s'\n", get_control_name(id), size, filename);
 	}
 
-	if (!type || strcmp(type, "value") == 0) {
+	if (!e->type || strcmp(e->type, "value") == 0) {
 		if (sscanf(valuespec, "%li", &value) != 1)
 			error("bad extended control value");
-		c.value = value;
-		print(1, "VIDIOC_S_EXT_CTRLS[%s] = %i\n", get_control_name(id), (int)c.value);
-	} else if (strcmp(type, "value64") == 0) {
+		c->value = value;
+		print(1, "VIDIOC_S_EXT_CTRLS[%s] = %i\n", get_control_name(id), (int)c->value);
+	} else if (strcmp(e->type, "value64") == 0) {
 		if (sscanf(valuespec, "%li", &value) != 1)
 			error("bad extended control value64");
-		c.value64 = value;
-		print(1, "VIDIOC_S_EXT_CTRLS[%s] = %li\n", get_control_name(id), (long)c.value64);
-	} else if (strcmp(type, "string") == 0) {
-		if (!valuespec) error("get extended control string: buffer size missing");
-		c.size = strlen(valuespec);
-		c.string = (char *)valuespec;	/* OK to cast from const, since not modified */
-		print(1, "VIDIOC_S_EXT_CTRLS[%s] = `%s'\n", get_control_name(id), c.string);
-	} else if (strcmp(type, "p_u8") == 0 ||
-		   strcmp(type, "p_u16") == 0 ||
-		   strcmp(type, "p_u32") == 0 ||
-		   strcmp(type, "ptr") == 0) {
+		c->value64 = value;
+		print(1, "VIDIOC_S_EXT_CTRLS[%s] = %li\n", get_control_name(id), (long)c->value64);
+	} else if (strcmp(e->type, "string") == 0) {
+		c->size = strlen(valuespec);
+		c->string = (char *)valuespec;	/* OK to cast from const, since not modified */
+		print(1, "VIDIOC_S_EXT_CTRLS[%s] = `%s'\n", get_control_name(id), c->string);
+	} else if (strcmp(e->type, "p_u8") == 0 ||
+		   strcmp(e->type, "p_u16") == 0 ||
+		   strcmp(e->type, "p_u32") == 0 ||
+		   strcmp(e->type, "ptr") == 0) {
 		int max_size = 0;
-		if (!valuebuf) {
+		if (!e->buf) {
 			while (isxdigit(valuespec[size*2]) && isxdigit(valuespec[size*2+1])) {
 				while (max_size <= size) {
 					max_size += 16;
-					valuebuf = ralloc(valuebuf, max_size);
+					e->buf = ralloc(e->buf, max_size);
 				}
+				valuebuf = e->buf;
 				sscanf(&valuespec[size*2], "%02lx", &value);
 				valuebuf[size] = value;
 				size++;
 			}
 		}
-		c.ptr = valuebuf;
-		c.size = size;
-		print(1, "VIDIOC_S_EXT_CTRLS[%s] = %p\n", get_control_name(id), c.ptr);
+		c->ptr = e->buf;
+		c->size = size;
+		print(1, "VIDIOC_S_EXT_CTRLS[%s] = %p\n", get_control_name(id), c->ptr);
 	} else {
-		error("bad extended control type `%s'", type);
+		error("bad extended control type `%s'", e->type);
 	}
-
-	print(2, "< ctrl_class: 0x%08X\n", cs.ctrl_class);
-	print(2, "< count:      %i\n", cs.count);
-	print(2, "< controls:   %p\n", cs.controls);
-	print(2, "<< id:        0x%08X\n", c.id);
-	print(2, "<< size:      %i\n", c.size);
-	print(2, "<< value:     %i\n", c.value);
-	print(2, "<< value64:   %li\n", (long)c.value64);
-	print(2, "<< ptr:       %p\n", c.ptr);
-	itd_xioctl(VIDIOC_S_EXT_CTRLS, &cs);
-
-	free(type);
-	free(valuescan);
-	free(valuebuf);
 }
 
 static int itd_v4l2_query_ctrl(__u32 id, int errout, int *next_id)
@@ -2267,43 +2202,35 @@ static int itd_v4l2_query_ext_ctrl(__u32 id, int errout, int *next_id)
 	return 0;
 }
 
-static void itd_v4l2_g_ext_ctrl(__u32 id, char *opts)
+static void ext_ctrl_get(struct ext_ctrls *b, __u32 id, char *opts)
 {
-	char buf[256] = "<truncated>";
-	struct v4l2_ext_controls cs;
-	struct v4l2_ext_control c;
-	unsigned char *ptr = NULL;
-	int i;
-
-	char *type = NULL;
-	unsigned int size = 0;
-	char *filename = NULL;
-
-	CLEAR(cs);
-	cs.ctrl_class = V4L2_CTRL_ID2CLASS(id);
-	cs.count = 1;
-	cs.controls = &c;
-
-	CLEAR(c);
-	c.id = id;
+	struct ext_ctrl *e = ext_ctrl_new(b, id);
 
 	if (opts)
-		sscanf(opts, "%m[^:]:%u:%ms", &type, &size, &filename);
-	if (size > 0) {
-		ptr = ralloc(NULL, size);
-		c.size = size;
-		c.ptr = ptr;
+		sscanf(opts, "%m[^:]:%u:%ms", &e->type, &e->size, &e->filename);
+	if (e->size > 0) {
+		e->buf = ralloc(NULL, e->size);
+		e->c.size = e->size;
+		e->c.ptr = e->buf;
 	}
+}
 
-	itd_xioctl(VIDIOC_G_EXT_CTRLS, &cs);
+static void ext_ctrl_print(struct ext_ctrl *e)
+{
+	char buf[256] = "<truncated>";
+	const __u32 id = e->c.id;
+	unsigned char *ptr = e->buf;
+	const char *type = e->type;
+	unsigned int size = e->size;
+	int i;
 
 	if (ptr && size*2+1 < SIZE(buf))
 		for (i = 0; i < size; i++) sprintf(&buf[2*i], "%02X", ptr[i]);
 
 	if (!type || strcmp(type, "value") == 0) {
-		print(1, "VIDIOC_G_EXT_CTRLS[%s] = %i\n", get_control_name(id), c.value);
+		print(1, "VIDIOC_G_EXT_CTRLS[%s] = %i\n", get_control_name(id), e->c.value);
 	} else if (strcmp(type, "value64") == 0) {
-		print(1, "VIDIOC_G_EXT_CTRLS[%s] = %li\n", get_control_name(id), (long)c.value64);
+		print(1, "VIDIOC_G_EXT_CTRLS[%s] = %li\n", get_control_name(id), (long)e->c.value64);
 	} else if (strcmp(type, "string") == 0) {
 		if (!ptr) error("get extended control string: buffer size missing");
 		ptr[size - 1] = 0;
@@ -2318,17 +2245,71 @@ static void itd_v4l2_g_ext_ctrl(__u32 id, char *opts)
 		error("bad extended control type `%s'", type);
 	}
 
-	if (ptr && filename) {
-		print(1, "Writing control %s (%i bytes) to `%s'\n", get_control_name(id), size, filename);
-		write_file(filename, ptr, size);
+	if (ptr && e->filename) {
+		print(1, "Writing control %s (%i bytes) to `%s'\n", get_control_name(id), size, e->filename);
+		write_file(e->filename, ptr, size);
+	}
+}
+
+/* Set or get the batched controls, one ioctl for each class */
+static void ext_ctrls_flush(struct ext_ctrls *b)
+{
+	const char *ios = b->set ? "VIDIOC_S_EXT_CTRLS" : "VIDIOC_G_EXT_CTRLS";
+	struct v4l2_ext_control *cc;
+	struct v4l2_ext_controls cs;
+	bool *done;
+	int i, j;
+
+	if (!b->count)
+		return;
+
+	cc = b->cc = ralloc(b->cc, sizeof(*cc) * b->max);
+	done = b->done = ralloc(b->done, sizeof(*done) * b->max);
+	memset(done, 0, sizeof(*done) * b->count);
+
+	for (i = 0; i < b->count; i++) {
+		if (done[i])
+			continue;
+		CLEAR(cs);
+		cs.ctrl_class = V4L2_CTRL_ID2CLASS(b->ctrls[i].c.id);
+		cs.controls = cc;
+		for (j = i; j < b->count; j++) {
+			if (done[j] || V4L2_CTRL_ID2CLASS(b->ctrls[j].c.id) != cs.ctrl_class)
+				continue;
+			cc[cs.count++] = b->ctrls[j].c;
+		}
+
+		print(2, "%c ctrl_class: 0x%08X\n", b->set ? '<' : '>', cs.ctrl_class);
+		print(2, "%c count:      %i\n", b->set ? '<' : '>', cs.count);
+		for (j = 0; j < cs.count && b->set; j++) {
+			print(2, "<< id:        0x%08X\n", cc[j].id);
+			print(2, "<< size:      %i\n", cc[j].size);
+			print(2, "<< value:     %i\n", cc[j].value);
+			print(2, "<< value64:   %li\n", (long)cc[j].value64);
+			print(2, "<< ptr:       %p\n", cc[j].ptr);
+		}
+		if (ioctl(vars.pipes[vars.pipe].fd, b->set ? VIDIOC_S_EXT_CTRLS : VIDIOC_G_EXT_CTRLS, &cs)) {
+			/* error_idx is count if the error was not due to one control */
+			if (cs.error_idx < cs.count)
+				error("%s failed on control %s", ios, get_control_name(cc[cs.error_idx].id));
+			error("%s failed on fd %i", ios, vars.pipes[vars.pipe].fd);
+		}
+
+		for (j = i, cs.count = 0; j < b->count; j++) {
+			if (done[j] || V4L2_CTRL_ID2CLASS(b->ctrls[j].c.id) != cs.ctrl_class)
+				continue;
+			b->ctrls[j].c = cc[cs.count++];
+			done[j] = TRUE;
+		}
 	}
 
-	free(filename);
-	free(type);
-	free(ptr);
+	for (i = 0; i < b->count && !b->set; i++)
+		ext_ctrl_print(&b->ctrls[i]);
+	ext_ctrls_free(b, FALSE);
 }
 
-static void itd_request_controls(const char *start)
+/* Do the requests of the control list, which is cut into controls in place */
+static void request_controls(struct ext_ctrls *b, char *start)
 {
 	char *end, *value, *type;
 	bool ext, next;
@@ -2337,7 +2318,7 @@ static void itd_request_controls(const char *start)
 	int val;
 
 	do {
-		for (end = (char*)start; isident(*end); end++);
+		for (end = start; isident(*end); end++);
 		value = end;
 		ext = FALSE;
 		if (*value == '+') {
@@ -2348,6 +2329,8 @@ static void itd_request_controls(const char *start)
 		*end = 0;
 		next = FALSE;
 		id = get_control_id(start);
+		if (!ext || (op != '=' && op != '?') || b->set != (op == '='))
+			ext_ctrls_flush(b);
 		if (op == '=') {
 			/* Set value */
 			for (end = value; *end && *end != ','; end++);
@@ -2355,7 +2338,8 @@ static void itd_request_controls(const char *start)
 				next = TRUE;
 			if (*end) *end++ = 0;
 			if (ext) {
-				itd_v4l2_s_ext_ctrl(id, value);
+				b->set = TRUE;
+				ext_ctrl_set(b, id, value);
 			} else {
 				if (sscanf(value, "%i", &val) != 1)
 					error("bad control value");
@@ -2372,7 +2356,8 @@ static void itd_request_controls(const char *start)
 				next = TRUE;
 			*value = 0;
 			if (ext) {
-				itd_v4l2_g_ext_ctrl(id, type);
+				b->set = FALSE;
+				ext_ctrl_get(b, id, type);
 			} else
 				itd_v4l2_g_ctrl(id);
 			end = value + 1;
@@ -2388,6 +2373,31 @@ static void itd_request_controls(const char *start)
 		} else error("bad request for control");
 		start = end;
 	} while (next);
+	ext_ctrls_flush(b);
+}
+
+static void itd_request_controls(const char *arg)
+{
+	struct ext_ctrls b = { FALSE, 0, 0, NULL, NULL, NULL };
+	jmp_buf saved_exception;
+	char *copy;
+	int r;
+
+	/* Keep the argument intact for the next pipe or repeat */
+	copy = strdup(arg);
+	if (!copy)
+		error("out of memory");
+
+	/* Catch errors to free the copy and the batch, for the daemon */
+	memcpy(saved_exception, vars.exception, sizeof(saved_exception));
+	r = setjmp(vars.exception);
+	if (!r)
+		request_controls(&b, copy);
+	memcpy(vars.exception, saved_exception, sizeof(vars.exception));
+	ext_ctrls_free(&b, TRUE);
+	free(copy);
+	if (r)
+		longjmp(vars.exception, r);
 }
 
 static void itd_enumerate_controls(const char *s)
@@ -2800,6 +2810,18 @@ static void itd_output_name(const char *arg)
 	vars.save_images = TRUE;
 }
 
+static void itd_output_format(const char *arg)
+{
+	int type = -1;
+
+	if (strcmp(arg, "raw") != 0) {
+		type = strcmp(arg, "pnm") ? conv_type(arg) : CONV_TYPE_PPM;
+		if (type < 0)
+			error("unknown output format `%s'", arg);
+	}
+	vars.pipes[vars.pipe].output_type = type;
+}
+
 static void itd_load_bufdata(const char *arg)
 {
 	int length;
@@ -2894,24 +2916,332 @@ static void shell(char *cmd)
 	print(1, "Executed `%s', status: %i\n", cmd, status);
 }
 
-static void process_commands(int argc, char *argv[]);
+/*
+ * Commands are parsed into a script once and then run, so that blocks
+ * repeated in a loop cost only the work of their commands.
+ */
+#define SCRIPT_REPEAT	-2	/* Option of a repeated block */
 
-static void process_file(char *name)
+struct script_command {
+	int option;		/* As returned by getopt_long() */
+	char *arg;		/* Option argument or NULL */
+	int count;		/* Times to run the block of SCRIPT_REPEAT */
+	struct script *block;
+};
+
+struct script {
+	struct script_command *commands;
+	int size;
+	int max;
+};
+
+/* Variables defined in script files with "set NAME=VALUE" */
+struct script_var {
+	char *name;
+	char *value;
+	struct script_var *next;
+};
+
+static const struct option long_options[] = {
+	{ "help", 0, NULL, 'h' },
+	{ "verbose", 2, NULL, 'v' },
+	{ "quiet", 0, NULL, 'q' },
+	{ "log", 2, NULL, 'l' },
+	{ "device", 1, NULL, 'd' },	/* Synonym for --open for backwards compatibility */
+	{ "open", 1, NULL, 'd' },
+	{ "close", 0, NULL, 1017 },
+	{ "querycap", 0, NULL, 1001 },
+	{ "input", 1, NULL, 'i' },
+	{ "enuminput", 0, NULL, 1005 },
+	{ "enumfmt", 2, NULL, 1020 },
+	{ "output", 1, NULL, 'o' },
+	{ "parm", 1, NULL, 'p' },
+	{ "try_fmt", 1, NULL, 't' },
+	{ "fmt", 1, NULL, 'f' },
+	{ "reqbufs", 1, NULL, 'r' },
+	{ "streamon", 0, NULL, 's' },
+	{ "streamoff", 0, NULL, 'e' },
+	{ "capture", 2, NULL, 'a' },
+	{ "stream", 2, NULL, 1006 },
+	{ "subdev_frame_interval", 1, NULL, 1019 },
+	{ "exposure", 1, NULL, 'x' },
+	{ "sensor_mode_data", 0, NULL, 1011 },
+	{ "priv_data", 2, NULL, 1008 },
+	{ "motor_priv_data", 2, NULL, 1010 },
+	{ "isp_dump", 1, NULL, 9999 },
+	{ "cvf_parm", 1, NULL, 1012 },
+	{ "parameters", 1, NULL, 1014 },
+	{ "ctrl-list", 0, NULL, 1003 },
+	{ "fmt-list", 0, NULL, 1004 },
+	{ "enumctrl", 2, NULL, 1018 },
+	{ "ctrl", 1, NULL, 'c' },
+	{ "wait", 2, NULL, 'w' },
+	{ "waitkey", 2, NULL, 1009 },
+	{ "shell", 1, NULL, 1007 },
+	{ "statistics", 0, NULL, 1013 },
+	{ "file", 1, NULL, 1015 },
+	{ "pipe", 1, NULL, 1016 },
+	{ "load", 1, NULL, 1021 },
+	{ "crop", 1, NULL, 1022 },
+	{ "cropcap", 2, NULL, 1023 },
+	{ "selection", 1, NULL, 1024 },
+	{ "output-format", 1, NULL, 1025 },
+	{ "daemon", 1, NULL, 1026 },
+	{ NULL, 0, NULL, 0 }
+};
+
+static void run_command(int c, char *arg);
+static void capture_buffers_free(void);
+static void capture_buffers_flush(void);
+
+static struct script_command *script_add(struct script *s, int option, const char *arg)
+{
+	struct script_command *c;
+
+	if (s->size >= s->max) {
+		s->max = s->max ? s->max * 2 : 16;
+		s->commands = ralloc(s->commands, sizeof(*s->commands) * s->max);
+	}
+	c = &s->commands[s->size++];
+	c->option = option;
+	c->arg = arg ? strdup(arg) : NULL;
+	c->count = 0;
+	c->block = NULL;
+	if (arg && !c->arg)
+		error("out of memory");
+	return c;
+}
+
+static void script_free(struct script *s)
+{
+	int i;
+
+	for (i = 0; i < s->size; i++) {
+		free(s->commands[i].arg);
+		if (s->commands[i].block) {
+			script_free(s->commands[i].block);
+			free(s->commands[i].block);
+		}
+	}
+	free(s->commands);
+	s->commands = NULL;
+	s->size = s->max = 0;
+}
+
+static void script_run(const struct script *s)
+{
+	int i, n;
+
+	for (i = 0; i < s->size; i++) {
+		const struct script_command *c = &s->commands[i];
+		if (c->option == SCRIPT_REPEAT) {
+			for (n = 0; n < c->count; n++)
+				script_run(c->block);
+		} else {
+			run_command(c->option, c->arg);
+		}
+	}
+}
+
+/*
+ * Append the options in argv[1..argc-1] into the script, return 0 or -1
+ * with a message about the bad option in msg. The message is not printed
+ * by getopt, which would write it to stderr of the daemon instead of its
+ * client.
+ */
+static int script_parse_options(struct script *s, int argc, char *argv[], char *msg, int msg_size)
+{
+	int saved_optind = optind;
+	int saved_opterr = opterr;
+	int c;
+
+	optind = 1;
+	opterr = 0;
+	while ((c = getopt_long(argc, argv, ":hv::ql::d:i:o:p:t:f:r:sea::x:c:w::",
+				long_options, NULL)) != -1) {
+		if (c == ':')
+			snprintf(msg, msg_size, "missing argument for option `%s'", argv[optind - 1]);
+		else if (c == '?' && optopt > 0 && optopt < 256)
+			snprintf(msg, msg_size, "bad option `-%c'", optopt);
+		else if (c == '?')
+			snprintf(msg, msg_size, "bad option `%s'", argv[optind - 1]);
+		else {
+			script_add(s, c, optarg);
+			continue;
+		}
+		break;
+	}
+	opterr = saved_opterr;
+	optind = saved_optind;
+	return c == -1 ? 0 : -1;
+}
+
+/*
+ * Return word with $NAME, ${NAME}, and $$ expanded, allocated with malloc.
+ * Undefined variables and other dollar signs are kept as they are, so
+ * that for example $? and $1 in --shell commands are left to the shell.
+ */
+static char *script_expand(const struct script_var *variables, const char *word)
+{
+	int size = strlen(word) + 1;
+	char *r = ralloc(NULL, size);
+	int len = 0;
+
+	while (*word) {
+		const struct script_var *v;
+		const char *value = NULL;
+		const char *start, *end;
+		char name[64];
+		int l = 0;
+
+		if (*word != '$' || word[1] == '$') {
+			if (*word == '$')
+				word++;
+			r[len++] = *word++;
+			continue;
+		}
+		if (word[1] == '{') {
+			start = word + 2;
+			end = strchr(start, '}');
+			if (end)
+				l = end++ - start;
+		} else {
+			start = word + 1;
+			while (isident(start[l]))
+				l++;
+			end = start + l;
+		}
+		if (l > 0 && l < sizeof(name)) {
+			memcpy(name, start, l);
+			name[l] = 0;
+			for (v = variables; v && strcmp(v->name, name); v = v->next)
+				;
+			value = v ? v->value : getenv(name);
+		}
+		if (!value) {
+			r[len++] = *word++;
+			continue;
+		}
+		word = end;
+
+		l = strlen(value);
+		size += l;
+		r = ralloc(r, size);
+		memcpy(&r[len], value, l);
+		len += l;
+	}
+	r[len] = 0;
+	return r;
+}
+
+/* Parse the options words[start..end-1] into the script */
+static void script_parse_range(struct script *s, char **words, int start, int end)
 {
-	FILE *f;
-	int argv_max = 16;
-	int argv_size = 1;
 	char **argv;
+	char msg[256];
+	int i, r;
+
+	if (start >= end)
+		return;
+	argv = ralloc(NULL, sizeof(*argv) * (end - start + 2));
+	argv[0] = "<none>";
+	for (i = start; i < end; i++)
+		argv[i - start + 1] = words[i];
+	argv[end - start + 1] = NULL;
+	r = script_parse_options(s, end - start + 1, argv, msg, sizeof(msg));
+	free(argv);
+	if (r < 0)
+		error("%s", msg);
+}
+
+/*
+ * Parse words from *pos into the script until the end or, if depth
+ * is nonzero, the closing brace of the block. Variables are expanded
+ * in each word when it is parsed.
+ */
+static void script_parse_words(struct script *s, struct script_var **variables, char **words, int *pos, int n,
+			       int depth)
+{
+	int start = *pos;
+	int i;
+
+	for (i = *pos; i < n; i++) {
+		char *w = script_expand(*variables, words[i]);
+		free(words[i]);
+		words[i] = w;
+
+		if (!strcmp(w, "set")) {
+			struct script_var *v;
+			char *eq;
+
+			script_parse_range(s, words, start, i);
+			if (++i >= n)
+				error("missing variable after `set'");
+			w = script_expand(*variables, words[i]);
+			free(words[i]);
+			words[i] = w;
+			eq = strchr(w, '=');
+			if (!eq || eq == w)
+				error("bad variable definition `%s'", w);
+			v = ralloc(NULL, sizeof(*v));
+			v->name = strndup(w, eq - w);
+			v->value = strdup(eq + 1);
+			if (!v->name || !v->value)
+				error("out of memory");
+			v->next = *variables;
+			*variables = v;
+			start = i + 1;
+		} else if (!strcmp(w, "repeat")) {
+			struct script_command *c;
+			char *end;
+			long count;
+
+			script_parse_range(s, words, start, i);
+			if (i + 2 >= n)
+				error("missing count or block after `repeat'");
+			w = script_expand(*variables, words[++i]);
+			free(words[i]);
+			words[i] = w;
+			count = strtol(w, &end, 0);
+			if (*end || end == w || count < 0 || count > INT_MAX)
+				error("bad repeat count `%s'", w);
+			if (strcmp(words[++i], "{"))
+				error("missing `{' after `repeat %s'", w);
+			c = script_add(s, SCRIPT_REPEAT, NULL);
+			c->count = count;
+			c->block = ralloc(NULL, sizeof(*c->block));
+			memset(c->block, 0, sizeof(*c->block));
+			i++;
+			script_parse_words(c->block, variables, words, &i, n, depth + 1);
+			start = i + 1;
+		} else if (!strcmp(w, "}")) {
+			if (!depth)
+				error("unexpected `}'");
+			script_parse_range(s, words, start, i);
+			*pos = i;
+			return;
+		}
+	}
+	if (depth)
+		error("missing `}'");
+	script_parse_range(s, words, start, i);
+	*pos = i;
+}
+
+/* Parse the words of file into the script */
+static void script_load(struct script *s, FILE *f)
+{
+	struct script_var *variables = NULL;
+	jmp_buf saved_exception;
+	int words_max = 16;
+	int words_size = 0;
+	char **words;
 	int arg_max;
 	int arg_size;
 	char *arg;
-	int c;
+	int c, i, r;
 
-	f = fopen(name, "r");
-	if (!f)
-		error("failed to open `%s'", name);
-	argv = ralloc(NULL, sizeof(*argv) * argv_max);
-	argv[0] = "<none>";
+	words = ralloc(NULL, sizeof(*words) * words_max);
 	do {
 		do {
 			c = getc(f);
@@ -2930,285 +3260,398 @@ static void process_file(char *name)
 			c = getc(f);
 		} while (!isspace(c) && c != EOF);
 		arg[arg_size] = 0;
-		if (argv_size + 1 >= argv_max) {
-			argv_max *= 2;
-			argv = ralloc(argv, sizeof(*argv) * argv_max);
+		if (words_size >= words_max) {
+			words_max *= 2;
+			words = ralloc(words, sizeof(*words) * words_max);
 		}
-		argv[argv_size++] = arg;
+		words[words_size++] = arg;
 	} while (c != EOF);
-	argv[argv_size] = NULL;
-	fclose(f);
 
-	process_commands(argv_size, argv);
+	/* Catch parse errors to free the words and variables, for the daemon */
+	memcpy(saved_exception, vars.exception, sizeof(saved_exception));
+	r = setjmp(vars.exception);
+	if (!r) {
+		i = 0;
+		script_parse_words(s, &variables, words, &i, words_size, 0);
+	}
+	memcpy(vars.exception, saved_exception, sizeof(vars.exception));
+	while (words_size > 0) free(words[--words_size]);
+	free(words);
+	while (variables) {
+		struct script_var *v = variables;
+		variables = v->next;
+		free(v->name);
+		free(v->value);
+		free(v);
+	}
+	if (r)
+		longjmp(vars.exception, r);
+}
 
-	while (--argv_size > 0) free(argv[argv_size]);
-	free(argv);
+static void process_file(char *name)
+{
+	struct script s = { NULL, 0, 0 };
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f)
+		error("failed to open `%s'", name);
+	script_load(&s, f);
+	fclose(f);
+	script_run(&s);
+	script_free(&s);
 }
 
-static void process_commands(int argc, char *argv[])
+/*
+ * Run a command line received by the daemon and save the captured images,
+ * return nonzero on error
+ */
+static int daemon_command(char *line)
 {
-	int saved_optind = optind;
-	optind = 1;
+	/* Static to be released after errors */
+	static struct script s;
+	static FILE *f;
+	static unsigned int pipe;
+	int r;
 
-	while (1) {
-		static const struct option long_options[] = {
-			{ "help", 0, NULL, 'h' },
-			{ "verbose", 2, NULL, 'v' },
-			{ "quiet", 0, NULL, 'q' },
-			{ "log", 2, NULL, 'l' },
-			{ "device", 1, NULL, 'd' },	/* Synonym for --open for backwards compatibility */
-			{ "open", 1, NULL, 'd' },
-			{ "close", 0, NULL, 1017 },
-			{ "querycap", 0, NULL, 1001 },
-			{ "input", 1, NULL, 'i' },
-			{ "enuminput", 0, NULL, 1005 },
-			{ "enumfmt", 2, NULL, 1020 },
-			{ "output", 1, NULL, 'o' },
-			{ "parm", 1, NULL, 'p' },
-			{ "try_fmt", 1, NULL, 't' },
-			{ "fmt", 1, NULL, 'f' },
-			{ "reqbufs", 1, NULL, 'r' },
-			{ "streamon", 0, NULL, 's' },
-			{ "streamoff", 0, NULL, 'e' },
-			{ "capture", 2, NULL, 'a' },
-			{ "stream", 2, NULL, 1006 },
-			{ "subdev_frame_interval", 1, NULL, 1019 },
-			{ "exposure", 1, NULL, 'x' },
-			{ "sensor_mode_data", 0, NULL, 1011 },
-			{ "priv_data", 2, NULL, 1008 },
-			{ "motor_priv_data", 2, NULL, 1010 },
-			{ "isp_dump", 1, NULL, 9999 },
-			{ "cvf_parm", 1, NULL, 1012 },
-			{ "parameters", 1, NULL, 1014 },
-			{ "ctrl-list", 0, NULL, 1003 },
-			{ "fmt-list", 0, NULL, 1004 },
-			{ "enumctrl", 2, NULL, 1018 },
-			{ "ctrl", 1, NULL, 'c' },
-			{ "wait", 2, NULL, 'w' },
-			{ "waitkey", 2, NULL, 1009 },
-			{ "shell", 1, NULL, 1007 },
-			{ "statistics", 0, NULL, 1013 },
-			{ "file", 1, NULL, 1015 },
-			{ "pipe", 1, NULL, 1016 },
-			{ "load", 1, NULL, 1021 },
-			{ "crop", 1, NULL, 1022 },
-			{ "cropcap", 2, NULL, 1023 },
-			{ "selection", 1, NULL, 1024 },
-			{ NULL, 0, NULL, 0 }
-		};
-
-		int c = getopt_long(argc, argv, "hv::ql::d:i:o:p:t:f:r:sea::x:c:w::", long_options, NULL);
-		if (c == -1)
-			break;
+	pipe = vars.pipe;
+	errno = 0;
+	r = setjmp(vars.exception);
+	if (r) {
+		/* Loops over the pipes leave vars.pipe changed on errors */
+		vars.pipe = pipe;
+		if (f)
+			fclose(f);
+		f = NULL;
+		script_free(&s);
+		capture_buffers_free();
+		return r;
+	}
+	f = fmemopen(line, strlen(line), "r");
+	if (!f)
+		error("fmemopen failed");
+	script_load(&s, f);
+	fclose(f);
+	f = NULL;
+	script_run(&s);
+	script_free(&s);
+	capture_buffers_flush();
+	return 0;
+}
 
-		switch (c) {
-		case 'h':	/* --help, -h */
-			usage();
-			break;
+/*
+ * Serve clients connecting to the UNIX socket at path, one at a time,
+ * until a client sends "quit". Each line from the client is a command
+ * line as in a script file, run with the state of the earlier ones, so
+ * that devices stay open and buffers mapped between the commands. The
+ * messages and images written to file "-" go back to the client,
+ * followed by a line "END <status>", where nonzero status is an error.
+ */
+static void daemon_run(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	jmp_buf saved_exception;
+	char *line = NULL;
+	size_t line_size = 0;
+	int sock, out;
+	bool quit = FALSE;
+
+	if (vars.daemon)
+		error("already running as daemon");
+	if (strlen(path) >= sizeof(addr.sun_path))
+		error("too long socket name `%s'", path);
+
+	CLEAR(addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+	/* Commands run with --shell must not inherit the sockets */
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		error("socket failed");
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 4) < 0) {
+		close(sock);
+		error("can not listen on `%s'", path);
+	}
 
-		case 'v':	/* --verbose, -v */
-			if (optarg) {
-				vars.verbosity = atoi(optarg);
-			} else {
-				vars.verbosity++;
-			}
-			break;
+	/* A client going away must not kill the daemon */
+	signal(SIGPIPE, SIG_IGN);
+	out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+	memcpy(saved_exception, vars.exception, sizeof(saved_exception));
+	vars.daemon = TRUE;
+	print(1, "Listening on `%s'\n", path);
 
-		case 'q':	/* --quiet, -q */
-			vars.verbosity--;
-			break;
+	while (!quit) {
+		int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+		FILE *f;
 
-		case 'l':	/* --log, -l */
-			if (vars.logfile)
-				fclose(vars.logfile);
-			vars.logfile = fopen(optarg ? optarg : "/dev/kmsg", "w");
-			if (!vars.logfile)
-				error("opening log file failed");
+		if (conn < 0) {
+			if (errno == EINTR)
+				continue;
 			break;
+		}
+		f = fdopen(conn, "r");
+		if (!f) {
+			close(conn);
+			continue;
+		}
+		fflush(stdout);
+		dup2(conn, STDOUT_FILENO);
+		while (getline(&line, &line_size, f) > 0) {
+			if (!strncmp(line, "quit", 4) && (!line[4] || isspace(line[4]))) {
+				quit = TRUE;
+				break;
+			}
+			printf("END %i\n", daemon_command(line));
+			if (fflush(stdout))
+				break;
+		}
+		fflush(stdout);
+		dup2(out, STDOUT_FILENO);
+		fclose(f);
+		clearerr(stdout);
+	}
 
-		case 'd':	/* --device, --open, -d */
-			itr_iterate(itd_open_device, optarg);
-			break;
+	memcpy(vars.exception, saved_exception, sizeof(vars.exception));
+	vars.daemon = FALSE;
+	free(line);
+	close(out);
+	close(sock);
+	unlink(path);
+	print(1, "Daemon on `%s' stopped\n", path);
+}
 
-		case 1017:	/* --close */
-			itr_iterate(itd_close_device, NULL);
-			break;
+static void run_command(int c, char *arg)
+{
+	switch (c) {
+	case 'h':	/* --help, -h */
+		usage();
+		break;
 
-		case 1001:	/* --querycap */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_vidioc_querycap, NULL);
-			break;
+	case 'v':	/* --verbose, -v */
+		if (arg) {
+			vars.verbosity = atoi(arg);
+		} else {
+			vars.verbosity++;
+		}
+		break;
 
-		case 'i':	/* --input, -i, VIDIOC_S/G_INPUT */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_vidioc_sg_input, optarg);
-			break;
+	case 'q':	/* --quiet, -q */
+		vars.verbosity--;
+		break;
 
-		case 1005:	/* --enuminput */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_vidioc_enuminput, NULL);
-			break;
+	case 'l':	/* --log, -l */
+		if (vars.logfile)
+			fclose(vars.logfile);
+		vars.logfile = fopen(arg ? arg : "/dev/kmsg", "w");
+		if (!vars.logfile)
+			error("opening log file failed");
+		break;
 
-		case 1020:	/* --enumfmt, VIDIOC_ENUM_FMT/FRAMESIZES/FRAMEINTERVALS */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_vidioc_enum_fmt, optarg);
-			break;
+	case 'd':	/* --device, --open, -d */
+		itr_iterate(itd_open_device, arg);
+		break;
 
-		case 'o':
-			itr_iterate(itd_output_name, optarg);
-			break;
+	case 1017:	/* --close */
+		itr_iterate(itd_close_device, NULL);
+		break;
 
-		case 'p':	/* --parm, -p, VIDIOC_S/G_PARM */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_vidioc_parm, optarg);
-			break;
+	case 1001:	/* --querycap */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_vidioc_querycap, NULL);
+		break;
 
-		case 't':	/* --try-fmt, -t, VIDIOC_TRY_FMT */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_vidioc_try_fmt, optarg);
-			break;
+	case 'i':	/* --input, -i, VIDIOC_S/G_INPUT */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_vidioc_sg_input, arg);
+		break;
 
-		case 'f':	/* --fmt, -f, VIDIOC_S/G_FMT */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_vidioc_sg_fmt, optarg);
-			break;
+	case 1005:	/* --enuminput */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_vidioc_enuminput, NULL);
+		break;
 
-		case 'r':	/* --reqbufs, -r, VIDIOC_REQBUFS */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_vidioc_reqbufs, optarg);
-			break;
+	case 1020:	/* --enumfmt, VIDIOC_ENUM_FMT/FRAMESIZES/FRAMEINTERVALS */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_vidioc_enum_fmt, arg);
+		break;
 
-		case 's':	/* --streamon, -s, VIDIOC_STREAMON: start streaming */
-			itr_iterate(itd_streamon, (char*)TRUE);
-			break;
+	case 'o':
+		itr_iterate(itd_output_name, arg);
+		break;
 
-		case 'e':	/* --streamoff, -e, VIDIOC_STREAMOFF: stop streaming */
-			itr_iterate(itd_streamon, (char*)FALSE);
-			break;
+	case 'p':	/* --parm, -p, VIDIOC_S/G_PARM */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_vidioc_parm, arg);
+		break;
 
-		case 'a':	/* --capture=N, -a: capture N buffers using QBUF/DQBUF */
-			itr_capture(optarg ? atoi(optarg) : 1);
-			break;
+	case 't':	/* --try-fmt, -t, VIDIOC_TRY_FMT */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_vidioc_try_fmt, arg);
+		break;
 
-		case 1006:	/* --stream=N: capture N buffers and leave streaming on */
-			itr_stream(optarg ? atoi(optarg) : 1);
-			break;
+	case 'f':	/* --fmt, -f, VIDIOC_S/G_FMT */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_vidioc_sg_fmt, arg);
+		break;
 
-		case 1019:	/* --subdev_frame_interval=X */
-			itr_iterate(itd_subdev_frame_interval, optarg);
-			break;
+	case 'r':	/* --reqbufs, -r, VIDIOC_REQBUFS */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_vidioc_reqbufs, arg);
+		break;
+
+	case 's':	/* --streamon, -s, VIDIOC_STREAMON: start streaming */
+		itr_iterate(itd_streamon, (char*)TRUE);
+		break;
+
+	case 'e':	/* --streamoff, -e, VIDIOC_STREAMOFF: stop streaming */
+		itr_iterate(itd_streamon, (char*)FALSE);
+		break;
+
+	case 'a':	/* --capture=N, -a: capture N buffers using QBUF/DQBUF */
+		itr_capture(arg ? atoi(arg) : 1);
+		break;
+
+	case 1006:	/* --stream=N: capture N buffers and leave streaming on */
+		itr_stream(arg ? atoi(arg) : 1);
+		break;
+
+	case 1019:	/* --subdev_frame_interval=X */
+		itr_iterate(itd_subdev_frame_interval, arg);
+		break;
 
 #if USE_ATOMISP
-		case 'x':	/* --exposure=S, -x: ATOMISP_IOC_S_EXPOSURE */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_atomisp_ioc_s_exposure, optarg);
-			break;
+	case 'x':	/* --exposure=S, -x: ATOMISP_IOC_S_EXPOSURE */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_atomisp_ioc_s_exposure, arg);
+		break;
 
-		case 1011:	/* --sensor_mode_data, ATOMISP_IOC_G_SENSOR_MODE_DATA */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_atomisp_ioc_g_sensor_mode_data, NULL);
-			break;
+	case 1011:	/* --sensor_mode_data, ATOMISP_IOC_G_SENSOR_MODE_DATA */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_atomisp_ioc_g_sensor_mode_data, NULL);
+		break;
 
-		case 1008:	/* --priv_data=F, ATOMISP_IOC_G_SENSOR_PRIV_INT_DATA */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_atomisp_ioc_g_sensor_priv_int_data, optarg);
-			break;
+	case 1008:	/* --priv_data=F, ATOMISP_IOC_G_SENSOR_PRIV_INT_DATA */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_atomisp_ioc_g_sensor_priv_int_data, arg);
+		break;
 
-		case 1010:	/* --motor_priv_data=F, ATOMISP_IOC_G_MOTOR_PRIV_INT_DATA */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_atomisp_ioc_g_motor_priv_int_data, optarg);
-			break;
+	case 1010:	/* --motor_priv_data=F, ATOMISP_IOC_G_MOTOR_PRIV_INT_DATA */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_atomisp_ioc_g_motor_priv_int_data, arg);
+		break;
 
-		case 9999:	/* --isp_dump */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_atomisp_memory_dump, optarg);
-			break;
+	case 9999:	/* --isp_dump */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_atomisp_memory_dump, arg);
+		break;
 
-		case 1012:	/* --cvf_parm */
-			itr_iterate(itd_atomisp_ioc_s_cvf_params, optarg);
-			break;
+	case 1012:	/* --cvf_parm */
+		itr_iterate(itd_atomisp_ioc_s_cvf_params, arg);
+		break;
 
-		case 1014:	/* --parameters, ATOMISP_IOC_S_PARAMETERS */
-			itr_iterate(itd_atomisp_ioc_s_parameters, optarg);
-			break;
+	case 1014:	/* --parameters, ATOMISP_IOC_S_PARAMETERS */
+		itr_iterate(itd_atomisp_ioc_s_parameters, arg);
+		break;
 #endif
 
-		case 1003:	/* --ctrl-list */
-			symbol_dump(V4L2_CID, controls);
-			break;
+	case 1003:	/* --ctrl-list */
+		symbol_dump(V4L2_CID, controls);
+		break;
 
-		case 1004:	/* --fmt-list */
-			symbol_dump(V4L2_PIX_FMT, pixelformats);
-			break;
+	case 1004:	/* --fmt-list */
+		symbol_dump(V4L2_PIX_FMT, symbol_pixelformats);
+		break;
 
-		case 1018:	/* --enumctrl */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_enumerate_controls, optarg);
-			break;
+	case 1018:	/* --enumctrl */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_enumerate_controls, arg);
+		break;
 
-		case 'c':	/* --ctrl, -c, VIDIOC_QUERYCTRL / VIDIOC_S/G_CTRL / VIDIOC_S/G_EXT_CTRLS */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_request_controls, optarg);
-			break;
+	case 'c':	/* --ctrl, -c, VIDIOC_QUERYCTRL / VIDIOC_S/G_CTRL / VIDIOC_S/G_EXT_CTRLS */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_request_controls, arg);
+		break;
 
-		case 'w':	/* -w, --wait */
-			delay(optarg ? atof(optarg) : 0.0);
-			break;
+	case 'w':	/* -w, --wait */
+		delay(arg ? atof(arg) : 0.0);
+		break;
 
-		case 1009: {	/* --waitkey */
-			char b[256] = { 0 };
-			FILE *f = optarg ? fopen(optarg, "r") : stdin;
-			int l;
-			if (!f) error("could not open file for reading a line");
-			print(1, "WAITKEY from %s...", optarg ? optarg : "stdin");
-			fgets(b, sizeof(b), f);
-			if (optarg) fclose(f);
-			l = strlen(b);
-			if (l>0 && b[l-1]=='\n') b[l-1] = 0;
-			print(1, "got `%s'\n", b);
-			break;
-		}
+	case 1009: {	/* --waitkey */
+		char b[256] = { 0 };
+		FILE *f = arg ? fopen(arg, "r") : stdin;
+		int l;
+		if (!f) error("could not open file for reading a line");
+		print(1, "WAITKEY from %s...", arg ? arg : "stdin");
+		fgets(b, sizeof(b), f);
+		if (arg) fclose(f);
+		l = strlen(b);
+		if (l>0 && b[l-1]=='\n') b[l-1] = 0;
+		print(1, "got `%s'\n", b);
+		break;
+	}
 
-		case 1007:	/* --shell */
-			shell(optarg);
-			break;
+	case 1007:	/* --shell */
+		shell(arg);
+		break;
 
-		case 1013:	/* --statistics */
-			vars.calculate_stats = TRUE;
-			break;
+	case 1013:	/* --statistics */
+		vars.calculate_stats = TRUE;
+		break;
 
-		case 1015:	/* --file */
-			process_file(optarg);
-			break;
+	case 1015:	/* --file */
+		process_file(arg);
+		break;
 
-		case 1016:	/* --pipe */
-			select_pipes(optarg);
-			break;
+	case 1016:	/* --pipe */
+		select_pipes(arg);
+		break;
 
-		case 1021:	/* --load */
-			itr_iterate(itd_load_bufdata, optarg);
-			break;
+	case 1021:	/* --load */
+		itr_iterate(itd_load_bufdata, arg);
+		break;
 
-		case 1022:	/* --crop */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_vidioc_sg_crop, optarg);
-			break;
+	case 1022:	/* --crop */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_vidioc_sg_crop, arg);
+		break;
 
-		case 1023:	/* --cropcap */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_vidioc_cropcap, optarg);
-			break;
+	case 1023:	/* --cropcap */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_vidioc_cropcap, arg);
+		break;
 
-		case 1024:	/* --selection */
-			itr_iterate(itd_open_device, NULL);
-			itr_iterate(itd_vidioc_sg_selection, optarg);
-			break;
+	case 1024:	/* --selection */
+		itr_iterate(itd_open_device, NULL);
+		itr_iterate(itd_vidioc_sg_selection, arg);
+		break;
 
-		default:
-			error("unknown option");
-		}
+	case 1025:	/* --output-format */
+		itr_iterate(itd_output_format, arg);
+		break;
+
+	case 1026:	/* --daemon */
+		daemon_run(arg);
+		break;
+
+	default:
+		error("unknown option");
 	}
-	optind = saved_optind;
+}
+
+static void process_commands(int argc, char *argv[])
+{
+	struct script s = { NULL, 0, 0 };
+	char msg[256];
+
+	if (script_parse_options(&s, argc, argv, msg, sizeof(msg)) < 0) {
+		script_free(&s);
+		error("%s", msg);
+	}
+	script_run(&s);
+	script_free(&s);
 }
 
 int v4l2n_process_commands(int argc, char *argv[])
@@ -3221,21 +3664,111 @@ int v4l2n_process_commands(int argc, char *argv[])
 	return ret;
 }
 
+static void conv_error(const char *msg)
+{
+	error("%s", msg);
+}
+
+static void conv_warning(const char *msg)
+{
+	print(2, "warning: %s\n", msg);
+}
+
+/*
+ * Convert the captured image into RGB or grey and write it with the
+ * file header. Frames of y4m and rgb streams are appended to one file.
+ */
+static void capture_buffer_convert(struct capture_buffer *cb, const char *name, int type, int i)
+{
+	const struct v4l2_pix_format *pix = &cb->pix_format;
+	struct conv_output o;
+	unsigned char *out, *yuv;
+	int stride = pix->bytesperline;
+	int size, width, height;
+	const char *msg = NULL;
+	char h[128];
+	FILE *f;
+	int r, e;
+
+	if (conv_frame_size(pix->pixelformat, pix->width, pix->height, &stride) < 0)
+		error("can not convert format %s", symbol_str(pix->pixelformat, symbol_pixelformats));
+	if (conv_output_init(&o, pix->pixelformat, type, 8, 1) < 0)
+		error("can not write format %s as %s", symbol_str(pix->pixelformat, symbol_pixelformats),
+		      conv_type_name(type));
+	size = conv_output_size(&o, pix->width, pix->height, &width, &height);
+	r = 0;
+	if (!CONV_TYPE_STREAM(type) || i == 0)
+		r = conv_header(h, sizeof(h), type, &o, width, height);
+	if (r < 0)
+		error("failed to write header to file");
+
+	/* The buffers are freed before any error, which jumps out of here */
+	out = malloc(size);
+	if (!out) error("out of memory");
+	if (conv_convert(cb->image, cb->length, pix->width, pix->height, stride,
+			 pix->pixelformat, &o, out) < 0) {
+		free(out);
+		error("failed to convert image");
+	}
+	if (type == CONV_TYPE_Y4M && o.channels == 3) {
+		yuv = malloc(size);
+		if (!yuv) {
+			free(out);
+			error("out of memory");
+		}
+		conv_rgb_to_yuv444(out, yuv, width * height);
+		free(out);
+		out = yuv;
+	}
+
+	print(1, "Writing buffer #%03i format %s as %ix%i %s to `%s'\n", i,
+		symbol_str(pix->pixelformat, symbol_pixelformats), width, height, conv_type_name(type), name);
+	f = output_open(name, CONV_TYPE_STREAM(type) && i > 0 ? "ab" : "wb",
+			r + (type == CONV_TYPE_Y4M ? strlen(CONV_Y4M_FRAME) : 0) + size);
+	if (!f) {
+		free(out);
+		error("can not open file `%s'", name);
+	}
+	if ((r > 0 && fwrite(h, r, 1, f) != 1) ||
+	    (type == CONV_TYPE_Y4M && fputs(CONV_Y4M_FRAME, f) < 0))
+		msg = "failed to write header to file";
+	else if (fwrite(out, size, 1, f) != 1)
+		msg = "failed to write data to file";
+	e = errno;
+	if (output_close(f) < 0 && !msg) {
+		msg = "failed to close file";
+		e = errno;
+	}
+	free(out);
+	if (msg) {
+		errno = e;
+		error("%s", msg);
+	}
+}
+
 static void capture_buffer_write(struct capture_buffer *cb, char *name, int i)
 {
 	static const char number_mark = '@';
+	const int type = vars.pipes[vars.pipe].output_type;
 	char b[256];
-	char n[5];
+	char n[12];
 	char *c;
 
 	if (!name || !cb->image)
 		return;
 
+	if (CONV_TYPE_STREAM(type)) {
+		capture_buffer_convert(cb, name, type, i);
+		return;
+	}
+
 	if (strlen(name)+sizeof(n) >= sizeof(b))
 		error("too long filename");
 
 	sprintf(n, "%03i", i);
-	if ((c = strrchr(name, number_mark))) {
+	if (!strcmp(name, "-")) {
+		strcpy(b, name);
+	} else if ((c = strrchr(name, number_mark))) {
 		int l = c - name;
 		memcpy(b, name, l);
 		strcpy(&b[l], n);
@@ -3244,8 +3777,13 @@ static void capture_buffer_write(struct capture_buffer *cb, char *name, int i)
 		sprintf(b, "%s_%s", name, n);
 	}
 
+	if (type >= 0) {
+		capture_buffer_convert(cb, b, type, i);
+		return;
+	}
+
 	print(1, "Writing buffer #%03i (%i bytes) format %s to `%s'\n", i, cb->length,
-		symbol_str(cb->pix_format.pixelformat, pixelformats), b);
+		symbol_str(cb->pix_format.pixelformat, symbol_pixelformats), b);
 	write_file(b, cb->image, cb->length);
 }
 
@@ -3264,26 +3802,65 @@ int v4l2n_init(void)
 
 	for (i = 0; i < MAX_PIPES; i++) {
 		vars.pipes[i].fd = -1;
+		vars.pipes[i].output_type = -1;
 		vars.pipes[i].reqbufs.count = 2;
 		vars.pipes[i].reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		vars.pipes[i].reqbufs.memory = V4L2_MEMORY_USERPTR;
 	}
 	vars.pipes[0].active = TRUE;
+	conv_set_handlers(conv_error, conv_warning);
 
 	return 0;
 }
 
-int v4l2n_cleanup(void)
+/* Free the captured images of all pipes */
+static void capture_buffers_free(void)
+{
+	struct pipe *p;
+	int i, j;
+
+	for (j = 0; j < MAX_PIPES; j++) {
+		p = &vars.pipes[j];
+		for (i = 0; i < p->num_capture_buffers; i++) {
+			free(p->capture_buffers[i].image);
+			p->capture_buffers[i].image = NULL;
+		}
+		p->num_capture_buffers = 0;
+		p->msg_full_printed = FALSE;
+	}
+}
+
+/*
+ * Save the captured images of all pipes and free them. Each image is
+ * freed once written, so that after an error the rest can be freed
+ * with capture_buffers_free().
+ */
+static void capture_buffers_flush(void)
 {
+	unsigned int pipe = vars.pipe;
+	struct capture_buffer *cb;
+	struct pipe *p;
 	int i;
-	int ret = setjmp(vars.exception);
-	if (ret) return ret;
 
 	for (vars.pipe = 0; vars.pipe < MAX_PIPES; vars.pipe++) {
-		/* Save images */
-		for (i = 0; i < vars.pipes[vars.pipe].num_capture_buffers; i++)
-			capture_buffer_write(&vars.pipes[vars.pipe].capture_buffers[i], vars.pipes[vars.pipe].output, i);
+		p = &vars.pipes[vars.pipe];
+		for (i = 0; i < p->num_capture_buffers; i++) {
+			cb = &p->capture_buffers[i];
+			capture_buffer_write(cb, p->output, i);
+			free(cb->image);
+			cb->image = NULL;
+		}
 	}
+	vars.pipe = pipe;
+	capture_buffers_free();
+}
+
+int v4l2n_cleanup(void)
+{
+	int ret = setjmp(vars.exception);
+	if (ret) return ret;
+
+	capture_buffers_flush();
 
 	for (vars.pipe = 0; vars.pipe < MAX_PIPES; vars.pipe++) {
 		/* Stop streaming */
@@ -3292,9 +3869,6 @@ int v4l2n_cleanup(void)
 
 		/* Free memory */
 		itd_vidioc_querybuf_cleanup();
-		for (i = 0; i < vars.pipes[vars.pipe].num_capture_buffers; i++) {
-			free(vars.pipes[vars.pipe].capture_buffers[i].image);
-		}
 		itd_close_device(NULL);
 		free(vars.pipes[vars.pipe].output);
 		free(vars.pipes[vars.pipe].bufdata);
@@ -20,10 +20,17 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include "utillib.h"
+#include "streamlib.h"
+#include "yuvlib.h"
 
 static char *name = "yuv2yuv";
 
 static int verbosity = 2;
+static int output_stdout;	/* Errors go to stderr to keep them out of the output */
+
+static char *tmp_name;		/* Output written in place of the input, removed on errors */
 
 static void print(int lvl, char *msg, ...)
 {
@@ -39,7 +46,7 @@ static void print(int lvl, char *msg, ...)
 
 static void error(char *msg, ...)
 {
-	FILE *f = stdout;
+	FILE *f = output_stdout ? stderr : stdout;
 	va_list ap;
 	int e = errno;
 
@@ -50,107 +57,246 @@ static void error(char *msg, ...)
 		fprintf(f, ": %s (%i)", strerror(e), e);
 	fprintf(f, "\n");
 	va_end(ap);
+	if (tmp_name)
+		unlink(tmp_name);
 	exit(1);
 }
 
-static void usage(void)
+static const struct yuv_layout *layout_get(const char *name)
 {
-	print(1, "Convert planar YUV 4:2:0 to interleaved NV12 or vice versa\n");
-	print(1, "Usage: %s [-r] [-x width] [-y height] [inputfile] [outputfile]\n", name);
-	print(1, "-r: Convert from interleaved NV12 to planar YUV 4:2:0\n");
-	print(1, "    Default is to convert planar YUV 4:2:0 to interleaved NV12\n");
-	print(1, "-x, -y: Image width and height\n");
+	const struct yuv_layout *l = yuv_layout_get(name);
+
+	if (!l)
+		error("unknown layout `%s'", name);
+	return l;
 }
 
-static long fsize(FILE *f)
+static void usage(void)
 {
 	int i;
-	long p, s, r = 0;
-
-	p = ftell(f);
-	if (p == -1)
-		return -1;
-	i = fseek(f, 0, SEEK_END);
-	if (i == -1)
-		r = -1;
-	s = ftell(f);
-	if (s == -1)
-		r = -1;
-	i = fseek(f, p, SEEK_SET);
-	if (i != p)
-		r = -1;
-
-	return r == 0 ? s : r;
+
+	print(1, "Convert YUV image between planar, semiplanar, and packed layouts\n");
+	print(1, "Usage: %s [-r] [-f format] [-t format] [-x width] [-y height] [-s stride] [-S stride]\n"
+		 "       [-n frames] [-c center|top] [-R 90|180|270] [-M h|v] [inputfile] [outputfile]\n", name);
+	print(1, "-f, -t: Input and output layout, default YUV420 (I420) and NV12.\n"
+		 "    Layout y4m reads or writes YUV4MPEG2 stream of planar frames\n");
+	print(1, "-r: Convert from interleaved NV12 to planar YUV 4:2:0\n");
+	print(1, "-x, -y: Image width and height\n");
+	print(1, "-s, -S: Bytes per luma or packed row of input and output image\n");
+	print(1, "-n: Number of frames to convert, by default all frames of the input\n");
+	print(1, "-c: Vertical chroma siting of 4:2:0 images, between (center, default)\n"
+		 "    or on (top) the even luma rows, used when converting to or from 4:2:2.\n"
+		 "    Y4M streams give it as C420jpeg or C420paldv\n");
+	print(1, "-R: Rotate output image clockwise by 90, 180, or 270 degrees\n");
+	print(1, "-M: Flip output image horizontally (h) or vertically (v), after rotation\n");
+	print(1, "File name - is standard input or output\n");
+	print(1, "Layouts:");
+	for (i = 0; yuv_layout_index(i); i++)
+		print(1, " %s", yuv_layout_index(i)->name);
+	print(1, "\n");
 }
 
-/* Conversion routines from Aleksandar Sutic */
-static int yuv420_to_nv12(void *image, int width, int height)
+/* Set up frame of the layout at data and return its size in bytes */
+static int frame_init(struct yuv_frame *f, const struct yuv_layout *l,
+		      int width, int height, int stride, unsigned char *data)
 {
-	unsigned char *u, *v, *uv, *uv_head;
-	int w, h, len = width * height / 2;
+	int size = yuv_frame_init(f, l, width, height, stride, data);
 
-	uv_head = uv = calloc(1, len);			if (!uv) error("out of memory");
-	u = (unsigned char *) image + 4 * width * height / 4;
-	v = (unsigned char *) image + 5 * width * height / 4;
+	if (size < 0)
+		error("stride too small");
+	return size;
+}
 
-	for (h=0; h<height/2; h++) {
-		for (w=0; w<width; w+=2) {
-			*(uv + w) = *(u++);
-			*(uv + w + 1) = *(v++);
-		}
-		uv += width;
-	}
+static void convert(const struct yuv_frame *s, const struct yuv_frame *d, int siting)
+{
+	if (yuv_convert(s, d, siting) < 0)
+		error("out of memory");
+}
 
-	memcpy(((unsigned char *) image) + width * height, uv_head, len);
-	free(uv_head);
+/*
+ * Stream of frames, each slot of the ring has an input and output
+ * buffer. Orienting is done in the converting stage only, so its
+ * buffers are shared by all slots.
+ */
+struct clip {
+	FILE *in, *out;
+	int y4m_in, y4m_out;
+	int frames;			/* Frames to convert, 0 for all */
+	int siting;
+	int orient;
+	struct yuv_frame in_frame[STREAM_SLOTS];
+	struct yuv_frame out_frame[STREAM_SLOTS];
+	int in_size, out_size;
+	struct yuv_frame tmp, oriented;
+	int read;			/* Frames read */
+};
+
+static FILE *open_file(const char *name, int out)
+{
+	FILE *f;
 
-	return 0;
+	if (!strcmp(name, "-"))
+		return out ? stdout : stdin;
+	f = fopen(name, out ? "wb" : "rb");
+	if (!f) error("failed opening file `%s'", name);
+	return f;
 }
 
-static int nv12_to_yuv420(void *image, int width, int height)
+/*
+ * Open the output file. If it is the input file, which would be
+ * truncated before it is read, write into a temporary file in the same
+ * directory, named in tmp_name, which is renamed over the output at the end.
+ */
+static FILE *open_output(const char *name, FILE *in)
 {
-	unsigned char *u, *v, *uv, *u_head, *v_head;
-	int w, h, len = width * height / 2;
+	struct stat in_st, out_st;
+	FILE *f;
+	int fd;
+
+	if (strcmp(name, "-") && fstat(fileno(in), &in_st) == 0 && stat(name, &out_st) == 0 &&
+	    in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+		tmp_name = malloc(strlen(name) + 8);
+		if (!tmp_name) error("out of memory");
+		sprintf(tmp_name, "%s.XXXXXX", name);
+		fd = mkstemp(tmp_name);
+		if (fd < 0) error("failed creating temporary file for `%s'", name);
+		fchmod(fd, out_st.st_mode & 07777);
+		f = fdopen(fd, "wb");
+		if (!f) error("failed opening file `%s'", tmp_name);
+		return f;
+	}
+	return open_file(name, 1);
+}
 
-	u_head = u = calloc(1, len / 2);		if (!u) error("out of memory");
-	v_head = v = calloc(1, len / 2);		if (!v) error("out of memory");
-	uv = (unsigned char *) image + width * height;
+/*
+ * Parse YUV4MPEG2 stream header for frame size and chroma subsampling,
+ * and set siting if the header gives the vertical siting of 4:2:0 chroma
+ */
+static const struct yuv_layout *y4m_read_header(FILE *f, int *width, int *height, char *fps,
+						int *siting)
+{
+	const char *layout = "YUV420";
+	char b[256];
+	char *t;
+
+	if (!fgets(b, sizeof(b), f) || strncmp(b, "YUV4MPEG2 ", 10))
+		error("bad y4m header");
+	for (t = strtok(b + 10, " \n"); t; t = strtok(NULL, " \n")) {
+		switch (t[0]) {
+		case 'W':
+			*width = atoi(t + 1);
+			break;
+		case 'H':
+			*height = atoi(t + 1);
+			break;
+		case 'F':
+			snprintf(fps, 32, "%s", t + 1);
+			break;
+		case 'C':
+			if (!strncmp(t + 1, "422", 3))
+				layout = "YUV422P";
+			else if (strncmp(t + 1, "420", 3))
+				error("unsupported y4m colour space `%s'", t + 1);
+			else if (siting)
+				*siting = strcmp(t + 1, "420paldv") ? YUV_SITING_CENTER : YUV_SITING_TOP;
+			break;
+		}
+	}
+	return layout_get(layout);
+}
 
-	for (h=0; h<height/2; h++) {
-		for (w=0; w<width; w+=2) {
-			*(u++) = *(uv + w);
-			*(v++) = *(uv + w + 1);
+static int read_frame(void *priv, int slot)
+{
+	struct clip *c = priv;
+	char b[256];
+	int r;
+
+	if (c->frames > 0 && c->read >= c->frames)
+		return 0;
+	if (c->y4m_in) {
+		if (!fgets(b, sizeof(b), c->in)) {
+			if (ferror(c->in))
+				error("failed to read frame header %i", c->read);
+			return 0;
 		}
-		uv += width;
+		if (strncmp(b, "FRAME", 5))
+			error("bad y4m frame header");
 	}
+	r = fread(c->in_frame[slot].y, 1, c->in_size, c->in);
+	if (r < c->in_size && ferror(c->in))
+		error("failed to read frame %i", c->read);
+	if (r == 0 && !c->y4m_in)
+		return 0;
+	if (r < c->in_size)
+		error("incomplete frame: %i of %i bytes", r, c->in_size);
+	c->read++;
+	return 1;
+}
 
-	memcpy(((unsigned char *) image) + 4 * width * height / 4, u_head, len / 2);
-	memcpy(((unsigned char *) image) + 5 * width * height / 4, v_head, len / 2);
+static void convert_frame(void *priv, int slot)
+{
+	struct clip *c = priv;
+
+	if (!c->orient) {
+		convert(&c->in_frame[slot], &c->out_frame[slot], c->siting);
+		return;
+	}
+	convert(&c->in_frame[slot], &c->tmp, c->siting);
+	if (c->out_frame[slot].stride == c->out_frame[slot].width) {
+		yuv_orient_frame(&c->tmp, c->orient, &c->out_frame[slot]);
+	} else {
+		yuv_orient_frame(&c->tmp, c->orient, &c->oriented);
+		convert(&c->oriented, &c->out_frame[slot], c->siting);
+	}
+}
 
-	free(u_head);
-	free(v_head);
+static void write_frame(void *priv, int slot)
+{
+	struct clip *c = priv;
 
-	return 0;
+	if (c->y4m_out && fputs("FRAME\n", c->out) < 0)
+		error("failed writing file");
+	if (fwrite(c->out_frame[slot].y, c->out_size, 1, c->out) != 1)
+		error("failed writing file");
 }
 
 int main(int argc, char *argv[])
 {
-	int to_planar = 0;
+	static const struct stream_ops ops = { read_frame, convert_frame, write_frame };
+	const struct yuv_layout *in_layout = layout_get("YUV420");
+	const struct yuv_layout *out_layout = layout_get("NV12");
+	struct clip c = { .siting = YUV_SITING_CENTER };
 	char *in_name = NULL;
 	char *out_name = NULL;
-	void *buffer;
-	int size;
-	FILE *f;
-	int i;
+	char fps[32] = "30:1";
+	unsigned char *buffer;
+	int i, n;
 
 	int opt;
 	int width = -1;
 	int height = -1;
-
-	while ((opt = getopt(argc, argv, "hrx:y:")) != -1) {
+	int out_width, out_height;
+	int in_stride = -1;
+	int out_stride = -1;
+	int orient = 0;
+	char *flip = "";
+	int siting_given = 0;
+
+	while ((opt = getopt(argc, argv, "hrf:t:x:y:s:S:n:c:R:M:")) != -1) {
 		switch (opt) {
 		case 'r':
-			to_planar = 1;
+			in_layout = layout_get("NV12");
+			out_layout = layout_get("YUV420");
+			break;
+		case 'f':
+			c.y4m_in = !strcasecmp(optarg, "y4m");
+			if (!c.y4m_in)
+				in_layout = layout_get(optarg);
+			break;
+		case 't':
+			c.y4m_out = !strcasecmp(optarg, "y4m");
+			if (!c.y4m_out)
+				out_layout = layout_get(optarg);
 			break;
 		case 'x':
 			width = atoi(optarg);
@@ -158,6 +304,31 @@ int main(int argc, char *argv[])
 		case 'y':
 			height = atoi(optarg);
 			break;
+		case 's':
+			in_stride = atoi(optarg);
+			break;
+		case 'S':
+			out_stride = atoi(optarg);
+			break;
+		case 'n':
+			c.frames = atoi(optarg);
+			break;
+		case 'c':
+			if (!strcmp(optarg, "center"))
+				c.siting = YUV_SITING_CENTER;
+			else if (!strcmp(optarg, "top"))
+				c.siting = YUV_SITING_TOP;
+			else
+				error("bad chroma siting `%s'", optarg);
+			siting_given = 1;
+			break;
+		case 'R':
+			orient = orient_rotate(atoi(optarg));
+			if (orient < 0) error("bad rotation");
+			break;
+		case 'M':
+			flip = optarg;
+			break;
 		default:
 			usage();
 			return -1;
@@ -169,36 +340,93 @@ int main(int argc, char *argv[])
 
 	in_name = argv[optind++];
 	out_name = argv[optind++];
+	if (!strcmp(out_name, "-")) {
+		verbosity = 0;		/* Keep messages out of the output */
+		output_stdout = 1;
+	}
 
-	print(1, "Reading file `%s', %ix%i\n", in_name, width, height);
-	f = fopen(in_name, "rb");
-	if (!f) error("failed opening file");
-	size = fsize(f);
-	if (size == -1) error("error checking file size");
-	if (size < width*height + width*height/2) error("file too small");
-	if (size > width*height + width*height/2) print(1, "warning: file has extra bytes");
-	size = width*height + width*height/2;
-	print(2, "File size %i bytes\n", size);
-	buffer = malloc(size);
-	if (!buffer) error("can not allocate input buffer");
-	i = fread(buffer, size, 1, f);
-	if (i != 1) error("failed reading file");
-	fclose(f);
-
-	if (to_planar) {
-		i = nv12_to_yuv420(buffer, width, height);
-	} else {
-		i = yuv420_to_nv12(buffer, width, height);
+	for (; *flip; flip++)
+		if ((orient = orient_flip(orient, *flip)) < 0)
+			error("bad flip");
+
+	c.in = open_file(in_name, 0);
+	if (c.y4m_in) {
+		in_layout = y4m_read_header(c.in, &width, &height, fps,
+					    siting_given ? NULL : &c.siting);
+		in_stride = -1;
+	}
+	if (c.y4m_out) {
+		/* Stream has planar frames with the chroma subsampling of the input */
+		out_layout = layout_get(in_layout->vsub == 2 ? "YUV420" : "YUV422P");
+		out_stride = -1;
+	}
+	if (width <= 0 || height <= 0)
+		error("image width and height must be given");
+	out_width = width;
+	out_height = height;
+	if (orient && out_layout->type == YUV_PACKED)
+		error("packed images can not be rotated or flipped");
+	if ((orient & ORIENT_TRANSPOSE) && out_layout->vsub == 1)
+		error("4:2:2 images can not be rotated by 90 or 270 degrees");
+	c.orient = orient;
+
+	if (orient & ORIENT_TRANSPOSE) {
+		out_width = height;
+		out_height = width;
 	}
-	if (i < 0) error("failed to convert image");
 
-	print(1, "Writing file `%s', %i bytes\n", out_name, size);
-	f = fopen(out_name, "wb");
-	if (!f) error("failed opening file");
-	i = fwrite(buffer, size, 1, f);
-	if (i != 1) error("failed writing file");
-	fclose(f);
+	/* Allocate all buffers up front, memory use does not depend on the frames */
+	c.in_size = frame_init(&c.tmp, in_layout, width, height, in_stride, NULL);
+	c.out_size = frame_init(&c.tmp, out_layout, out_width, out_height, out_stride, NULL);
+	for (i = 0; i < STREAM_SLOTS; i++) {
+		/* Zeroed so that the padding of output rows is written as zeros */
+		buffer = calloc(1, c.in_size + c.out_size);
+		if (!buffer) error("can not allocate buffers");
+		frame_init(&c.in_frame[i], in_layout, width, height, in_stride, buffer);
+		frame_init(&c.out_frame[i], out_layout, out_width, out_height, out_stride,
+			   buffer + c.in_size);
+	}
+	if (orient) {
+		/* Orienting needs the planes without padding */
+		int size = frame_init(&c.tmp, out_layout, width, height, -1, NULL);
+
+		buffer = malloc(size * 2);
+		if (!buffer) error("can not allocate output buffer");
+		frame_init(&c.tmp, out_layout, width, height, -1, buffer);
+		frame_init(&c.oriented, out_layout, out_width, out_height, -1, buffer + size);
+	}
 
-	free(buffer);
+	print(1, "Reading file `%s', %ix%i %s stride %i\n", in_name, width, height,
+	      in_layout->name, c.in_frame[0].stride);
+	print(1, "Writing file `%s', %ix%i %s stride %i, %i bytes per frame\n", out_name,
+	      out_width, out_height, out_layout->name, c.out_frame[0].stride, c.out_size);
+
+	c.out = open_output(out_name, c.in);
+	/* Of the 4:2:0 tags, only paldv has chroma on the even luma rows */
+	if (c.y4m_out && fprintf(c.out, "YUV4MPEG2 W%i H%i F%s Ip A1:1 %s\n",
+				 out_width, out_height, fps,
+				 out_layout->vsub == 1 ? "C422" :
+				 c.siting == YUV_SITING_TOP ? "C420paldv" : "C420jpeg") < 0)
+		error("failed writing file");
+
+	n = stream_run(&ops, &c);
+	print(1, "Converted %i frames\n", n);
+	if (n == 0)
+		error("no frames in input");
+
+	if (c.in != stdin)
+		fclose(c.in);
+	if (fclose(c.out) != 0)
+		error("failed writing file");
+	if (tmp_name) {
+		if (rename(tmp_name, out_name) != 0)
+			error("failed renaming `%s' to `%s'", tmp_name, out_name);
+		free(tmp_name);
+		tmp_name = NULL;
+	}
+	for (i = 0; i < STREAM_SLOTS; i++)
+		free(c.in_frame[i].y);
+	if (orient)
+		free(c.tmp.y);
 	return 0;
 }
@@ -0,0 +1,429 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "utillib.h"
+#include "yuvlib.h"
+
+#define SIZE(x)		(sizeof(x)/sizeof((x)[0]))
+#define DIV_ROUND_UP(a,b)	(((a) + (b) - 1) / (b))
+#define CLAMP(a,lo,hi)	((a) < (lo) ? (lo) : (a) > (hi) ? (hi) : (a))
+
+static const struct yuv_layout yuv_layouts[] = {
+	{ "YUV420",	2, YUV_PLANAR,		0 },
+	{ "I420",	2, YUV_PLANAR,		0 },
+	{ "YVU420",	2, YUV_PLANAR,		1 },
+	{ "YV12",	2, YUV_PLANAR,		1 },
+	{ "YUV422P",	1, YUV_PLANAR,		0 },
+	{ "NV12",	2, YUV_SEMIPLANAR,	0 },
+	{ "NV21",	2, YUV_SEMIPLANAR,	1 },
+	{ "NV16",	1, YUV_SEMIPLANAR,	0 },
+	{ "NV61",	1, YUV_SEMIPLANAR,	1 },
+	{ "YUYV",	1, YUV_PACKED,		0, 0 },
+	{ "YVYU",	1, YUV_PACKED,		1, 0 },
+	{ "UYVY",	1, YUV_PACKED,		0, 1 },
+	{ "VYUY",	1, YUV_PACKED,		1, 1 },
+};
+
+const struct yuv_layout *yuv_layout_get(const char *name)
+{
+	int i;
+
+	for (i = 0; i < SIZE(yuv_layouts); i++)
+		if (!strcasecmp(name, yuv_layouts[i].name))
+			return &yuv_layouts[i];
+	return NULL;
+}
+
+const struct yuv_layout *yuv_layout_index(int i)
+{
+	return i >= 0 && i < SIZE(yuv_layouts) ? &yuv_layouts[i] : NULL;
+}
+
+/* Interleave n bytes from each of u and v into pairs in uv, also luma and chroma */
+static void interleave_uv(const unsigned char *u, const unsigned char *v, unsigned char *uv, int n)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(u + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(v + i));
+		_mm_storeu_si128((__m128i *)(uv + i * 2), _mm_unpacklo_epi8(a, b));
+		_mm_storeu_si128((__m128i *)(uv + i * 2 + 16), _mm_unpackhi_epi8(a, b));
+	}
+#endif
+	for (; i < n; i++) {
+		uv[i * 2] = u[i];
+		uv[i * 2 + 1] = v[i];
+	}
+}
+
+/* Split n pairs of bytes in uv into u and v */
+static void deinterleave_uv(const unsigned char *uv, unsigned char *u, unsigned char *v, int n)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	const __m128i mask = _mm_set1_epi16(0xff);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(uv + i * 2));
+		__m128i b = _mm_loadu_si128((const __m128i *)(uv + i * 2 + 16));
+		_mm_storeu_si128((__m128i *)(u + i),
+				 _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+		_mm_storeu_si128((__m128i *)(v + i),
+				 _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+	}
+#endif
+	for (; i < n; i++) {
+		u[i] = uv[i * 2];
+		v[i] = uv[i * 2 + 1];
+	}
+}
+
+int yuv_frame_init(struct yuv_frame *f, const struct yuv_layout *l,
+		   int width, int height, int stride, unsigned char *data)
+{
+	f->l = l;
+	f->width = width;
+	f->height = height;
+	f->cwidth = DIV_ROUND_UP(width, 2);
+	f->cheight = DIV_ROUND_UP(height, l->vsub);
+
+	switch (l->type) {
+	case YUV_PACKED:
+		f->stride = stride > 0 ? stride : f->cwidth * 4;
+		if (f->stride < f->cwidth * 4)
+			return -1;
+		f->cstride = 0;
+		f->y = data;
+		return f->stride * height;
+	case YUV_SEMIPLANAR:
+		f->stride = stride > 0 ? stride : width;
+		f->cstride = f->stride + (f->stride & 1);
+		break;
+	default:
+		f->stride = stride > 0 ? stride : width;
+		f->cstride = DIV_ROUND_UP(f->stride, 2);
+		break;
+	}
+	if (f->stride < width)
+		return -1;
+
+	f->y = data;
+	f->u = data + f->stride * height;
+	f->v = f->u + f->cstride * f->cheight;
+	if (l->type == YUV_PLANAR && l->swap) {
+		f->v = f->u;
+		f->u = f->v + f->cstride * f->cheight;
+	}
+	return f->stride * height + f->cstride * f->cheight * (l->type == YUV_PLANAR ? 2 : 1);
+}
+
+/* Row buffers, each large enough for a packed row */
+struct row_buffers {
+	unsigned char *y, *c, *t;
+	unsigned char *u[3], *v[3];
+	unsigned char *ou, *ov;
+};
+
+/* Return luma row i, unpacked into b->y from packed images */
+static const unsigned char *get_luma(const struct yuv_frame *f, int i, struct row_buffers *b)
+{
+	const unsigned char *s = f->y + (long)i * f->stride;
+
+	if (f->l->type != YUV_PACKED)
+		return s;
+	if (f->l->yofs)
+		deinterleave_uv(s, b->c, b->y, f->cwidth * 2);
+	else
+		deinterleave_uv(s, b->y, b->c, f->cwidth * 2);
+	return b->y;
+}
+
+/* Get chroma row c into u and v, which may point to the image itself */
+static void get_chroma(const struct yuv_frame *f, int c, struct row_buffers *b, int slot,
+		       const unsigned char **u, const unsigned char **v)
+{
+	unsigned char *bu = f->l->swap ? b->v[slot] : b->u[slot];
+	unsigned char *bv = f->l->swap ? b->u[slot] : b->v[slot];
+	const unsigned char *s;
+
+	c = CLAMP(c, 0, f->cheight - 1);
+	switch (f->l->type) {
+	case YUV_PLANAR:
+		*u = f->u + (long)c * f->cstride;
+		*v = f->v + (long)c * f->cstride;
+		return;
+	case YUV_SEMIPLANAR:
+		s = f->u + (long)c * f->cstride;
+		break;
+	default:
+		s = f->y + (long)c * f->stride;
+		if (f->l->yofs)
+			deinterleave_uv(s, b->c, b->t, f->cwidth * 2);
+		else
+			deinterleave_uv(s, b->t, b->c, f->cwidth * 2);
+		s = b->c;
+		break;
+	}
+	deinterleave_uv(s, bu, bv, f->cwidth);
+	*u = b->u[slot];
+	*v = b->v[slot];
+}
+
+/* Weighted sum (wa * a + wb * b + wc * c + 2) / 4 of rows of n bytes */
+static void blend_rows(const unsigned char *a, const unsigned char *b, const unsigned char *c,
+		       int wa, int wb, int wc, unsigned char *d, int n)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(2);
+	const __m128i ka = _mm_set1_epi16(wa);
+	const __m128i kb = _mm_set1_epi16(wb);
+	const __m128i kc = _mm_set1_epi16(wc);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i z = _mm_loadu_si128((const __m128i *)(c + i));
+		__m128i lo = _mm_add_epi16(_mm_add_epi16(
+				_mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), ka),
+				_mm_mullo_epi16(_mm_unpacklo_epi8(y, zero), kb)),
+				_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(z, zero), kc), round));
+		__m128i hi = _mm_add_epi16(_mm_add_epi16(
+				_mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), ka),
+				_mm_mullo_epi16(_mm_unpackhi_epi8(y, zero), kb)),
+				_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(z, zero), kc), round));
+		_mm_storeu_si128((__m128i *)(d + i),
+				 _mm_packus_epi16(_mm_srli_epi16(lo, 2), _mm_srli_epi16(hi, 2)));
+	}
+#endif
+	for (; i < n; i++)
+		d[i] = (wa * a[i] + wb * b[i] + wc * c[i] + 2) >> 2;
+}
+
+/*
+ * Get chroma row c of the output image from the input image, resampling
+ * vertically between 4:2:0 and 4:2:2 by filtering the nearest rows.
+ */
+static void resample_chroma(const struct yuv_frame *s, const struct yuv_frame *d, int c,
+			    int siting, struct row_buffers *b,
+			    const unsigned char **u, const unsigned char **v)
+{
+	const unsigned char *u0, *v0, *u1, *v1, *u2, *v2;
+	int r0, r1, r2, w0, w1, w2;
+
+	if (s->l->vsub == d->l->vsub) {
+		get_chroma(s, c, b, 0, u, v);
+		return;
+	}
+
+	if (s->l->vsub == 1) {
+		/* 4:2:2 to 4:2:0: average the two rows, or filter around the even row */
+		r0 = 2 * c - 1; r1 = 2 * c; r2 = 2 * c + 1;
+		w0 = 0; w1 = 2; w2 = 2;
+		if (siting == YUV_SITING_TOP)
+			w0 = 1, w1 = 2, w2 = 1;
+	} else {
+		/* 4:2:0 to 4:2:2: interpolate between the nearest rows */
+		r1 = c / 2;
+		r0 = r1 - 1;
+		r2 = r1 + 1;
+		w0 = 0; w1 = 4; w2 = 0;
+		if (siting == YUV_SITING_TOP) {
+			if (c & 1)
+				w1 = 2, w2 = 2;
+		} else {
+			w1 = 3;
+			if (c & 1)
+				w2 = 1;
+			else
+				w0 = 1;
+		}
+	}
+
+	if (w1 == 4) {
+		get_chroma(s, r1, b, 0, u, v);
+		return;
+	}
+	get_chroma(s, r1, b, 1, &u1, &v1);
+	u0 = u2 = u1;
+	v0 = v2 = v1;
+	if (w0)
+		get_chroma(s, r0, b, 0, &u0, &v0);
+	if (w2)
+		get_chroma(s, r2, b, 2, &u2, &v2);
+	blend_rows(u0, u1, u2, w0, w1, w2, b->ou, s->cwidth);
+	blend_rows(v0, v1, v2, w0, w1, w2, b->ov, s->cwidth);
+	*u = b->ou;
+	*v = b->ov;
+}
+
+/* Write luma row i and chroma row for it if u is given */
+static void put_row(const struct yuv_frame *f, int i, const unsigned char *y,
+		    const unsigned char *u, const unsigned char *v, struct row_buffers *b)
+{
+	unsigned char *d = f->y + (long)i * f->stride;
+	int c = i / f->l->vsub;
+
+	/* Planes of planar images are already swapped in the frame */
+	if (f->l->swap && f->l->type != YUV_PLANAR) {
+		const unsigned char *t = u;
+		u = v;
+		v = t;
+	}
+
+	switch (f->l->type) {
+	case YUV_PLANAR:
+		memcpy(d, y, f->width);
+		if (u) {
+			memcpy(f->u + (long)c * f->cstride, u, f->cwidth);
+			memcpy(f->v + (long)c * f->cstride, v, f->cwidth);
+		}
+		break;
+	case YUV_SEMIPLANAR:
+		memcpy(d, y, f->width);
+		if (u)
+			interleave_uv(u, v, f->u + (long)c * f->cstride, f->cwidth);
+		break;
+	default:
+		if (f->width & 1) {
+			/* Repeat the last pixel to fill the pair */
+			if (y != b->y)
+				memcpy(b->y, y, f->width);
+			b->y[f->width] = b->y[f->width - 1];
+			y = b->y;
+		}
+		interleave_uv(u, v, b->c, f->cwidth);
+		if (f->l->yofs)
+			interleave_uv(b->c, y, d, f->cwidth * 2);
+		else
+			interleave_uv(y, b->c, d, f->cwidth * 2);
+		break;
+	}
+}
+
+int yuv_convert(const struct yuv_frame *s, const struct yuv_frame *d, int siting)
+{
+	const int n = s->cwidth * 4 + 16;
+	struct row_buffers b;
+	unsigned char *m;
+	const unsigned char *y, *u, *v;
+	int i;
+
+	if (s->l->type == d->l->type && s->l->vsub == d->l->vsub &&
+	    s->l->swap == d->l->swap && s->l->yofs == d->l->yofs) {
+		/* Same layout, only the strides may differ */
+		const int bytes = s->l->type == YUV_PACKED ? s->cwidth * 4 : s->width;
+		for (i = 0; i < s->height; i++)
+			memcpy(d->y + (long)i * d->stride, s->y + (long)i * s->stride, bytes);
+		for (i = 0; s->l->type != YUV_PACKED && i < s->cheight; i++) {
+			const int cbytes = s->l->type == YUV_PLANAR ? s->cwidth : s->cwidth * 2;
+			memcpy(d->u + (long)i * d->cstride, s->u + (long)i * s->cstride, cbytes);
+			if (s->l->type == YUV_PLANAR)
+				memcpy(d->v + (long)i * d->cstride, s->v + (long)i * s->cstride, cbytes);
+		}
+		return 0;
+	}
+
+	m = malloc(n * 11);
+	if (!m)
+		return -1;
+	b.y = m;
+	b.c = m + n;
+	b.t = m + n * 2;
+	for (i = 0; i < 3; i++) {
+		b.u[i] = m + n * (3 + i * 2);
+		b.v[i] = m + n * (4 + i * 2);
+	}
+	b.ou = m + n * 9;
+	b.ov = m + n * 10;
+
+	for (i = 0; i < s->height; i++) {
+		y = get_luma(s, i, &b);
+		u = v = NULL;
+		if (i % d->l->vsub == 0)
+			resample_chroma(s, d, i / d->l->vsub, siting, &b, &u, &v);
+		put_row(d, i, y, u, v, &b);
+	}
+
+	free(m);
+	return 0;
+}
+
+void yuv_orient_frame(const struct yuv_frame *s, int orient, const struct yuv_frame *d)
+{
+	orient_image(s->y, s->width, s->height, 1, orient, d->y);
+	if (s->l->type == YUV_PLANAR) {
+		orient_image(s->u, s->cwidth, s->cheight, 1, orient, d->u);
+		orient_image(s->v, s->cwidth, s->cheight, 1, orient, d->v);
+	} else {
+		orient_image(s->u, s->cwidth, s->cheight, 2, orient, d->u);
+	}
+}
+
+/* From https://msdn.microsoft.com/en-us/library/aa917087.aspx */
+/* Modified so that R, G, B are 16-bit pixel values 0..65535 */
+#define RGB2Y(R,G,B)	(((  66 * (R) + 129 * (G) +  25 * (B) + 32768) >> 16) +  16)
+#define RGB2U(R,G,B)	((( -38 * (R) -  74 * (G) + 112 * (B) + 32768) >> 16) + 128)
+#define RGB2V(R,G,B)	((( 112 * (R) -  94 * (G) -  18 * (B) + 32768) >> 16) + 128)
+
+static inline void get_rgb(const struct pnm_image *img, int i, int *r, int *g, int *b)
+{
+	*r = pnm_sample16(img, i, 0);
+	*g = pnm_sample16(img, i, 1);
+	*b = pnm_sample16(img, i, 2);
+}
+
+void yuv_rgb_to_420(const struct pnm_image *img, unsigned char *yuv,
+		    unsigned char *u, unsigned char *v, int cstep)
+{
+	int r, g, b;
+	int x, y, i = 0;
+
+	for (y = 0; y < img->height; y += 2) {
+		/* y is even, convert chrominance */
+		for (x = 0; x < img->width; x += 2) {
+			/* x is even, convert chrominance */
+			get_rgb(img, i++, &r, &g, &b);
+			*yuv++ = RGB2Y(r, g, b);
+			*u = RGB2U(r, g, b);
+			*v = RGB2V(r, g, b);
+			u += cstep;
+			v += cstep;
+			/* x is odd, don't convert chrominance */
+			if (x + 1 == img->width)
+				break;
+			get_rgb(img, i++, &r, &g, &b);
+			*yuv++ = RGB2Y(r, g, b);
+		}
+		if (y + 1 == img->height)
+			break;
+		/* y is odd, don't convert chrominance */
+		for (x = 0; x < img->width; x++) {
+			get_rgb(img, i++, &r, &g, &b);
+			*yuv++ = RGB2Y(r, g, b);
+		}
+	}
+}
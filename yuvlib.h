@@ -0,0 +1,84 @@
+/*
+ * Next Video Tool for Linux* OS - Video4Linux2 API tool for developers.
+ *
+ * Copyright (c) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef YUVLIB_H
+#define YUVLIB_H
+
+/*
+ * Conversion between YUV image layouts as used by yuv2yuv, and from RGB
+ * into YUV as used by pnm2yuv.
+ */
+
+enum { YUV_PLANAR, YUV_SEMIPLANAR, YUV_PACKED };
+enum { YUV_SITING_CENTER, YUV_SITING_TOP };
+
+/*
+ * Image layouts. Chroma is subsampled horizontally by two in all of them
+ * and vertically by vsub. Planar and semiplanar images have chroma after
+ * the luma plane, packed images have two pixels in four bytes.
+ */
+struct yuv_layout {
+	const char *name;
+	int vsub;		/* 2 for 4:2:0, 1 for 4:2:2 */
+	int type;
+	int swap;		/* V before U */
+	int yofs;		/* Offset of first luma byte in packed pixel pair */
+};
+
+/*
+ * Image in memory. Planar chroma rows take half of the luma stride,
+ * semiplanar chroma rows the luma stride rounded up to pairs.
+ */
+struct yuv_frame {
+	const struct yuv_layout *l;
+	int width, height;
+	int cwidth, cheight;		/* Chroma samples per row and rows */
+	int stride, cstride;
+	unsigned char *y, *u, *v;	/* u for both in semiplanar images */
+};
+
+/* Return layout by name, case insensitive, or NULL if unknown */
+const struct yuv_layout *yuv_layout_get(const char *name);
+/* Return layout i of all known ones, NULL past the last */
+const struct yuv_layout *yuv_layout_index(int i);
+
+/*
+ * Set up frame of the layout at data and return its size in bytes, or -1
+ * if the stride is too small. Stride 0 or less selects rows without padding.
+ */
+int yuv_frame_init(struct yuv_frame *f, const struct yuv_layout *l,
+		   int width, int height, int stride, unsigned char *data);
+
+/*
+ * Convert image s into d of the same size, row by row, resampling chroma
+ * with the siting when the subsampling differs. Return -1 if out of memory.
+ */
+int yuv_convert(const struct yuv_frame *s, const struct yuv_frame *d, int siting);
+
+/* Orient each plane of the image, chroma pairs of semiplanar images as one pixel */
+void yuv_orient_frame(const struct yuv_frame *s, int orient, const struct yuv_frame *d);
+
+struct pnm_image;
+
+/*
+ * Convert RGB or grey image into YUV 4:2:0, chroma samples taken from
+ * the top left pixel of each 2x2 block and stored every cstep bytes.
+ * Blocks of odd sized images are cut at the right and bottom edges.
+ */
+void yuv_rgb_to_420(const struct pnm_image *img, unsigned char *yuv,
+		    unsigned char *u, unsigned char *v, int cstep);
+
+#endif